@@ -11,6 +11,12 @@
 #define CLLIB_PRINT_PROGRAM_LOG true
 #endif
 
+#ifdef CONFIG_DISABLE_BINARY_CACHE
+#define CLLIB_BINARY_CACHE false
+#else
+#define CLLIB_BINARY_CACHE true
+#endif
+
 typedef struct {
 	cl_device_id __device;
 } device_t;
@@ -24,18 +30,92 @@ typedef struct {
 	unsigned short __arg;
 	unsigned short __dimentions;
 	bool __set_local;
+	bool __set_offset;
 	size_t __global_size[3];
 	size_t __local_size[3];
+	size_t __global_offset[3];
 } kernel_t;
 
+struct __profile;
+
 typedef struct {
 	cl_command_queue __queue;
+	struct __profile *__profile;
 } queue_t;
 
+/**
+ * profile_stats is aggregated device time of one kernel or transfer kind
+ * recorded by profiling queue. Times are in milliseconds
+ */
+struct profile_stats {
+	const char *name;
+	unsigned long count;
+	double min;
+	double mean;
+	double p99;
+	double max;
+	/* mean time between command enqueue and its start on device */
+	double wait;
+};
+
+/**
+ * kernel_usage is limits and resources of kernel on device. Work-group size is
+ * limited by registers and local memory kernel uses, so kernel with high
+ * private memory usage runs fewer work-items per compute unit
+ */
+struct kernel_usage {
+	size_t work_group_size;
+	/* local size should be multiple of it, usually SIMD width */
+	size_t preferred_multiple;
+	/* bytes per work-item, spilled registers are counted too */
+	cl_ulong private_mem_size;
+	/* bytes per work-group */
+	cl_ulong local_mem_size;
+};
+
 typedef struct {
 	cl_mem __buffer;
 } buffer_t;
 
+/* size classes of pool, class i holds sub-buffers of 2^i bytes */
+#define POOL_CLASSES 48
+
+struct __pool_region;
+
+/**
+ * pool_t hands out sub-buffers of large device allocations. Sizes are rounded
+ * up to power of two classes and freed sub-buffers are recycled by later
+ * allocations of the same class, so device memory of pool grows only to its
+ * peak usage. Sub-buffer origins are aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN
+ */
+typedef struct {
+	context_t __context;
+	size_t __block_size;
+	size_t __align;
+
+	cl_mem *__blocks;
+	unsigned int __blocks_num;
+	unsigned int __blocks_capacity;
+	/* sub-buffers are cut from the last block starting at it */
+	size_t __offset;
+
+	struct __pool_region *__free[POOL_CLASSES];
+
+	size_t __in_use;
+	size_t __peak;
+	size_t __reserved;
+} pool_t;
+
+/**
+ * pool_stats is device memory of pool in bytes. Used memory counts sizes
+ * rounded up to class, reserved memory is size of all allocations of pool
+ */
+struct pool_stats {
+	size_t used;
+	size_t peak;
+	size_t reserved;
+};
+
 enum buffer_type {
 	/**
 	 * created memory buffer can be read and wrote when used inside a kernel
@@ -72,18 +152,62 @@ enum buffer_type {
 
 enum device_type {
 	cpu_type = CL_DEVICE_TYPE_CPU,
-	gpu_type = CL_DEVICE_TYPE_GPU
+	gpu_type = CL_DEVICE_TYPE_GPU,
+	all_type = CL_DEVICE_TYPE_ALL
 };
 
 typedef cl_context_properties context_props;
 
+/* most devices select_device() chooses from */
+#define CLLIB_MAX_DEVICES 16
+
+/**
+ * device_info is capabilities of device. Sizes are in bytes, clock is in MHz
+ */
+struct device_info {
+	char name[128];
+	char vendor[64];
+	cl_device_type type;
+	unsigned int compute_units;
+	unsigned int max_clock;
+	size_t max_work_group_size;
+	cl_ulong global_mem_size;
+	cl_ulong local_mem_size;
+	cl_ulong constant_mem_size;
+	/* preferred number of lanes of float and int vector operations */
+	unsigned int float_vector_width;
+	unsigned int int_vector_width;
+	bool image_support;
+	/* cl_khr_gl_sharing, buffers can be shared with GL context */
+	bool gl_sharing;
+	/* cl_khr_gl_event, GL fence can be waited on by device */
+	bool gl_event;
+};
+
+/**
+ * device_rank_fn returns score of device, select_device() chooses device with
+ * the highest one. Negative score means device can not be used
+ */
+typedef long (*device_rank_fn)(const struct device_info *info);
+
 device_t create_device(enum device_type type);
+unsigned int create_devices(enum device_type type, device_t *devices,
+			    unsigned int size);
+unsigned int device_compute_units(device_t device);
+struct device_info device_info(device_t device);
+bool device_has_extension(device_t device, const char *extension);
+cl_platform_id device_platform(device_t device);
+void device_info_dump(const struct device_info *info, FILE *file);
+long device_rank_throughput(const struct device_info *info);
+device_t select_device(enum device_type type, device_rank_fn rank);
 context_t create_context(device_t device);
 context_t create_context_with_props(device_t device,
 				    const context_props *properties);
 kernel_t create_kernel(device_t device, context_t context, const char *source,
 		       const char *kernel_name, const char *options);
+kernel_t create_program_kernel(kernel_t kernel, const char *kernel_name);
 queue_t create_queue(context_t context, device_t device);
+queue_t create_profiling_queue(context_t context, device_t device);
 buffer_t create_buffer(context_t context, enum buffer_type, size_t size);
 buffer_t create_buffer_from(context_t context, enum buffer_type, void *ptr,
 			    size_t size);
@@ -93,7 +217,31 @@ void fill_buffer(queue_t queue, buffer_t buffer, size_t size, void *data,
 		 bool blocking_write);
 void dump_buffer(queue_t queue, buffer_t buffer, size_t size, void *data,
 		 bool blocking_read);
+void fill_buffer_range(queue_t queue, buffer_t buffer, size_t offset,
+		       size_t size, void *data, bool blocking_write);
+void dump_buffer_range(queue_t queue, buffer_t buffer, size_t offset,
+		       size_t size, void *data, bool blocking_read);
+void copy_buffer(queue_t queue, buffer_t src, buffer_t dst, size_t size);
+void release_buffer(buffer_t buffer);
+pool_t create_pool(context_t context, device_t device, size_t block_size);
+void destroy_pool(pool_t *pool);
+/* zero size is rounded up to the smallest class, like any other size */
+buffer_t pool_alloc(pool_t *pool, enum buffer_type type, size_t size);
+void pool_free(pool_t *pool, buffer_t buffer);
+struct pool_stats pool_stats(const pool_t *pool);
+void release_kernel(kernel_t kernel);
+void release_queue(queue_t queue);
+void release_context(context_t context);
 void flush_queue(queue_t queue);
+void free_after_queue(queue_t queue, void *data);
+
+struct kernel_usage kernel_usage(kernel_t kernel, device_t device);
+
+void profile_event(queue_t queue, const char *name, cl_event event);
+unsigned int profile_stats(queue_t queue, struct profile_stats *stats,
+			   unsigned int size);
+void profile_dump(queue_t queue, FILE *file);
+void profile_reset(queue_t queue);
 
 #define set_kernel_size_1d(kernel, size) \
 	__set_kernel_size(&(kernel), 1, size, 0, 0)
@@ -109,6 +257,13 @@ void flush_queue(queue_t queue);
 #define set_kernel_local_size_3d(kernel, width, height, depth) \
 	__set_kernel_local_size(&(kernel), 3, width, height, depth)
 
+#define set_kernel_offset_1d(kernel, x) \
+	__set_kernel_offset(&(kernel), 1, x, 0, 0)
+#define set_kernel_offset_2d(kernel, x, y) \
+	__set_kernel_offset(&(kernel), 2, x, y, 0)
+#define set_kernel_offset_3d(kernel, x, y, z) \
+	__set_kernel_offset(&(kernel), 3, x, y, z)
+
 #define set_kernel_arg(kernel, arg) \
 	__set_kernel_arg((kernel).__kernel, (kernel).__arg++, sizeof(arg), &arg)
 
@@ -117,13 +272,18 @@ void flush_queue(queue_t queue);
 
 #define run_kernel(queue, kernel) __run_kernel(queue, &(kernel))
 
+#define tune_kernel(queue, device, kernel) \
+	__tune_kernel(queue, device, &(kernel))
+
 void __set_kernel_arg(cl_kernel kernel, unsigned int arg_index, size_t arg_size,
 		      void *arg_value);
 void __set_kernel_size(kernel_t *kernel, unsigned short dimentions,
 		       size_t width, size_t height, size_t depth);
 void __set_kernel_local_size(kernel_t *kernel, unsigned short dimentions,
 			     size_t width, size_t height, size_t depth);
+void __set_kernel_offset(kernel_t *kernel, unsigned short dimentions,
+			 size_t x, size_t y, size_t z);
 void __run_kernel(queue_t queue, kernel_t *kernel);
-cl_platform_id __create_platform(void);
+void __tune_kernel(queue_t queue, device_t device, kernel_t *kernel);
 
 #endif /* _CLLIB_CLLIB_H */
@@ -2,6 +2,10 @@
 #ifndef _CLLIB_COMMON_H
 #define _CLLIB_COMMON_H
 
+#include <stdint.h>
+
+#include <cllib/cllib.h>
+
 #define cl_panic_on(expr, msg, error)         \
 	do {                                  \
 		if (unlikely(expr)) {         \
@@ -15,4 +19,31 @@ const char *cl_strerror(cl_int error);
 void __cl_panic(const char *msg, cl_int error, const char *file,
 		unsigned long line);
 
+uint64_t __program_cache_key(cl_device_id dev, const char *source,
+			     const char *options);
+cl_program __load_program_binary(cl_context ctx, cl_device_id dev, uint64_t key,
+				 const char *options);
+void __store_program_binary(cl_program program, uint64_t key);
+bool __cache_path(const char *name, char *path, size_t size);
+
+uint64_t __tune_cache_key(const kernel_t *kernel, cl_device_id dev,
+			  const struct kernel_usage *usage);
+bool __load_tuned_size(cl_device_id dev, uint64_t key, size_t *local);
+void __store_tuned_size(cl_device_id dev, uint64_t key, const size_t *local);
+
+struct __profile *__create_profile(void);
+void __destroy_profile(struct __profile *profile);
+void __profile_record(queue_t queue, const char *name, cl_event event);
+void __profile_record_kernel(queue_t queue, cl_kernel kernel, cl_event event);
+
+/**
+ * __profile_event() returns event to pass to enqueue call, which is NULL if
+ * queue is not profiled, so no event is created for regular queues
+ */
+static __always_inline cl_event *__profile_event(queue_t queue,
+						 cl_event *event)
+{
+	return queue.__profile != NULL ? event : NULL;
+}
+
 #endif /* _CLLIB_COMMON_H */
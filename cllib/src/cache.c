@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cllib/cllib.h>
+#include <cllib/common.h>
+
+#define CACHE_MAGIC "CLLIBBIN"
+#define CACHE_INCLUDE_DIRS 16
+#define CACHE_MAX_FILES 256
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct __cache_header {
+	char magic[8];
+	uint64_t key;
+	uint64_t size;
+};
+
+struct __source_hash {
+	uint64_t hash;
+	const char *dirs[CACHE_INCLUDE_DIRS];
+	char *dirs_data;
+	unsigned int dirs_num;
+	char *files[CACHE_MAX_FILES];
+	unsigned int files_num;
+};
+
+static __always_inline uint64_t __fnv(uint64_t hash, const void *data,
+				      size_t size)
+{
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t __fnv_str(uint64_t hash, const char *str)
+{
+	/* terminating zero is hashed too, so "ab" "c" and "a" "bc" differ */
+	return __fnv(hash, str, strlen(str) + 1);
+}
+
+/**
+ * __parse_include_dirs() collects `-I dir` and `-Idir` options, so includes of
+ * kernel source are resolved the same way the OpenCL compiler does
+ */
+static void __parse_include_dirs(struct __source_hash *state,
+				 const char *options)
+{
+	char *token;
+	char *save;
+	bool next_is_dir = false;
+
+	state->dirs_num = 0;
+	state->dirs_data = strdup(options != NULL ? options : "");
+	panic_on(state->dirs_data == NULL, "strdup");
+
+	for (token = strtok_r(state->dirs_data, " \t", &save); token != NULL;
+	     token = strtok_r(NULL, " \t", &save)) {
+		const char *dir = NULL;
+
+		if (next_is_dir) {
+			dir = token;
+			next_is_dir = false;
+		} else if (strcmp(token, "-I") == 0) {
+			next_is_dir = true;
+		} else if (strncmp(token, "-I", 2) == 0) {
+			dir = token + 2;
+		}
+		if (dir != NULL && state->dirs_num < CACHE_INCLUDE_DIRS) {
+			state->dirs[state->dirs_num++] = dir;
+		}
+	}
+}
+
+static char *__read_text(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	char *text;
+	long size;
+
+	if (file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	text = malloc(size + 1);
+	panic_on(text == NULL, "malloc");
+	if (fread(text, 1, size, file) != (size_t)size) {
+		free(text);
+		fclose(file);
+		return NULL;
+	}
+	text[size] = '\0';
+	fclose(file);
+	return text;
+}
+
+static bool __visited(struct __source_hash *state, const char *path)
+{
+	for (unsigned int i = 0; i < state->files_num; ++i) {
+		if (strcmp(state->files[i], path) == 0) {
+			return true;
+		}
+	}
+	if (state->files_num == CACHE_MAX_FILES) {
+		/* stop descending, deeper includes are not hashed */
+		return true;
+	}
+	state->files[state->files_num] = strdup(path);
+	panic_on(state->files[state->files_num] == NULL, "strdup");
+	++state->files_num;
+	return false;
+}
+
+static void __hash_text(struct __source_hash *state, const char *text,
+			const char *dir);
+
+/**
+ * __hash_include() hashes content of included file found in directory of
+ * including file (for quoted includes) or in one of include directories.
+ * Every file is hashed once, which is enough to notice any change of it.
+ * Includes which are not found, like system headers, contribute only their
+ * name
+ */
+static void __hash_include(struct __source_hash *state, const char *name,
+			   bool quoted, const char *dir)
+{
+	char path[4096];
+	char *text = NULL;
+
+	state->hash = __fnv_str(state->hash, name);
+	if (quoted && dir != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		text = __read_text(path);
+	}
+	for (unsigned int i = 0; text == NULL && i < state->dirs_num; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", state->dirs[i], name);
+		text = __read_text(path);
+	}
+	if (text == NULL) {
+		return;
+	}
+	if (!__visited(state, path)) {
+		char *slash = strrchr(path, '/');
+
+		*slash = '\0';
+		__hash_text(state, text, path);
+	}
+	free(text);
+}
+
+static void __hash_text(struct __source_hash *state, const char *text,
+			const char *dir)
+{
+	const char *line = text;
+
+	state->hash = __fnv_str(state->hash, text);
+	while (line != NULL && *line != '\0') {
+		const char *p = line + strspn(line, " \t");
+
+		if (*p == '#') {
+			p += 1 + strspn(p + 1, " \t");
+			if (strncmp(p, "include", 7) == 0) {
+				p += 7 + strspn(p + 7, " \t");
+			} else {
+				p = NULL;
+			}
+		} else {
+			p = NULL;
+		}
+
+		if (p != NULL && (*p == '<' || *p == '"')) {
+			char close = *p == '<' ? '>' : '"';
+			size_t len = strcspn(p + 1, "\n");
+			const char *end = memchr(p + 1, close, len);
+
+			if (end != NULL && (size_t)(end - p - 1) < 4096) {
+				char name[4096];
+
+				memcpy(name, p + 1, end - p - 1);
+				name[end - p - 1] = '\0';
+				__hash_include(state, name, close == '"', dir);
+			}
+		}
+
+		line = strchr(line, '\n');
+		line = line != NULL ? line + 1 : NULL;
+	}
+}
+
+static void __hash_device_info(uint64_t *hash, cl_device_id dev,
+			       cl_device_info param)
+{
+	size_t size;
+	cl_int err;
+
+	err = clGetDeviceInfo(dev, param, 0, NULL, &size);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+	char info[size];
+	err = clGetDeviceInfo(dev, param, size, info, NULL);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+	*hash = __fnv(*hash, info, size);
+}
+
+/**
+ * __program_cache_key() computes key of program binary. Key covers source
+ * with content of every file it includes, build options, device name, device
+ * OpenCL version and driver version, so binary is rebuilt if any of them
+ * changes
+ */
+uint64_t __program_cache_key(cl_device_id dev, const char *source,
+			     const char *options)
+{
+	struct __source_hash state = { .hash = FNV_OFFSET };
+
+	__hash_device_info(&state.hash, dev, CL_DEVICE_NAME);
+	__hash_device_info(&state.hash, dev, CL_DEVICE_VERSION);
+	__hash_device_info(&state.hash, dev, CL_DRIVER_VERSION);
+	state.hash = __fnv_str(state.hash, options != NULL ? options : "");
+
+	__parse_include_dirs(&state, options);
+	__hash_text(&state, source, NULL);
+
+	for (unsigned int i = 0; i < state.files_num; ++i) {
+		free(state.files[i]);
+	}
+	free(state.dirs_data);
+	return state.hash;
+}
+
+/**
+ * __cache_path() returns path of file in cache directory. Cache lives in
+ * CLLIB_CACHE_DIR or, if it is not set, in $XDG_CACHE_HOME/cllib or
+ * ~/.cache/cllib. Directories are created when needed
+ *
+ * @return false if there is no place for cache
+ */
+bool __cache_path(const char *name, char *path, size_t size)
+{
+	const char *env = getenv("CLLIB_CACHE_DIR");
+	char dir[4096];
+
+	if (env != NULL && *env != '\0') {
+		snprintf(dir, sizeof(dir), "%s", env);
+	} else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0') {
+		snprintf(dir, sizeof(dir), "%s/cllib", env);
+	} else if ((env = getenv("HOME")) != NULL && *env != '\0') {
+		snprintf(dir, sizeof(dir), "%s/.cache/cllib", env);
+	} else {
+		return false;
+	}
+
+	for (char *p = dir + 1; *p != '\0'; ++p) {
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(dir, 0755);
+			*p = '/';
+		}
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		return false;
+	}
+	snprintf(path, size, "%s/%s", dir, name);
+	return true;
+}
+
+/**
+ * __program_cache_path() returns path of cache entry with given key
+ *
+ * @return false if there is no place for cache
+ */
+static bool __program_cache_path(uint64_t key, char *path, size_t size)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return __cache_path(name, path, size);
+}
+
+/**
+ * __load_program_binary() creates program from cached binary and builds it
+ *
+ * @return built program or NULL if there is no valid cache entry, in which
+ * 	case program should be built from source
+ */
+cl_program __load_program_binary(cl_context ctx, cl_device_id dev, uint64_t key,
+				 const char *options)
+{
+	struct __cache_header header;
+	char path[4096];
+	unsigned char *binary;
+	cl_program program;
+	cl_int status;
+	cl_int err;
+	FILE *file;
+
+	if (!__program_cache_path(key, path, sizeof(path))) {
+		return NULL;
+	}
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.key != key || header.size == 0) {
+		fclose(file);
+		return NULL;
+	}
+	binary = malloc(header.size);
+	panic_on(binary == NULL, "malloc");
+	if (fread(binary, 1, header.size, file) != header.size) {
+		free(binary);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
+
+	size_t size = header.size;
+	const unsigned char *binaries = binary;
+	program = clCreateProgramWithBinary(ctx, 1, &dev, &size, &binaries,
+					    &status, &err);
+	free(binary);
+	if (err != CL_SUCCESS || status != CL_SUCCESS) {
+		if (err == CL_SUCCESS) {
+			clReleaseProgram(program);
+		}
+		return NULL;
+	}
+	err = clBuildProgram(program, 1, &dev, options, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+	return program;
+}
+
+/**
+ * __store_program_binary() saves binary of built program to cache. Entry is
+ * written to temporary file and renamed, so concurrent processes never see
+ * partially written entry. Failures are not fatal, program is just rebuilt
+ * next time
+ */
+void __store_program_binary(cl_program program, uint64_t key)
+{
+	struct __cache_header header = { .key = key };
+	char path[4096];
+	char tmp[4096 + 32];
+	unsigned char *binary;
+	size_t size;
+	cl_int err;
+	FILE *file;
+
+	if (!__program_cache_path(key, path, sizeof(path))) {
+		return;
+	}
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size),
+			       &size, NULL);
+	if (err != CL_SUCCESS || size == 0) {
+		return;
+	}
+	binary = malloc(size);
+	panic_on(binary == NULL, "malloc");
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+			       sizeof(binary), &binary, NULL);
+	if (err != CL_SUCCESS) {
+		free(binary);
+		return;
+	}
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.size = size;
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+	file = fopen(tmp, "wb");
+	if (file == NULL) {
+		free(binary);
+		return;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		       fwrite(binary, 1, size, file) == size;
+	written = fclose(file) == 0 && written;
+	if (!written || rename(tmp, path) != 0) {
+		remove(tmp);
+	}
+	free(binary);
+}
+
+/**
+ * __tune_cache_path() returns path of local size cache of device. Every
+ * device has its own file, it is rebuilt if device or driver changes
+ */
+static bool __tune_cache_path(cl_device_id dev, char *path, size_t size)
+{
+	uint64_t hash = FNV_OFFSET;
+	char name[32];
+
+	__hash_device_info(&hash, dev, CL_DEVICE_NAME);
+	__hash_device_info(&hash, dev, CL_DEVICE_VERSION);
+	__hash_device_info(&hash, dev, CL_DRIVER_VERSION);
+	snprintf(name, sizeof(name), "tune-%016llx.txt",
+		 (unsigned long long)hash);
+	return __cache_path(name, path, size);
+}
+
+/**
+ * __tune_cache_key() computes key of tuned local size. Key covers kernel
+ * name, build options of its program, NDRange and resources kernel uses, so
+ * key changes when kernel code or its -D options change enough to use other
+ * registers or local memory
+ */
+uint64_t __tune_cache_key(const kernel_t *kernel, cl_device_id dev,
+			  const struct kernel_usage *usage)
+{
+	uint64_t hash = FNV_OFFSET;
+	cl_program program;
+	size_t options_size;
+	char name[256];
+	cl_int err;
+
+	err = clGetKernelInfo(kernel->__kernel, CL_KERNEL_FUNCTION_NAME,
+			      sizeof(name), name, NULL);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	hash = __fnv_str(hash, name);
+
+	err = clGetKernelInfo(kernel->__kernel, CL_KERNEL_PROGRAM,
+			      sizeof(program), &program, NULL);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	err = clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_OPTIONS, 0,
+				    NULL, &options_size);
+	cl_panic_on(err, "clGetProgramBuildInfo", err);
+	char options[options_size + 1];
+	err = clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_OPTIONS,
+				    options_size, options, NULL);
+	cl_panic_on(err, "clGetProgramBuildInfo", err);
+	options[options_size] = '\0';
+	hash = __fnv_str(hash, options);
+
+	hash = __fnv(hash, &kernel->__dimentions, sizeof(kernel->__dimentions));
+	hash = __fnv(hash, kernel->__global_size,
+		     sizeof(kernel->__global_size));
+	hash = __fnv(hash, usage, sizeof(*usage));
+	return hash;
+}
+
+/**
+ * __load_tuned_size() finds local size tuned for key on device
+ *
+ * @param local place where local size is stored, zero size means driver
+ * 	chooses local size
+ * @return false if local size was not tuned yet
+ */
+bool __load_tuned_size(cl_device_id dev, uint64_t key, size_t *local)
+{
+	unsigned long long entry;
+	char path[4096];
+	size_t size[3];
+	bool found = false;
+	FILE *file;
+
+	if (!__tune_cache_path(dev, path, sizeof(path))) {
+		return false;
+	}
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	/* the last entry wins, so retuned kernel overrides previous one */
+	while (fscanf(file, "%llx %zu %zu %zu", &entry, &size[0], &size[1],
+		      &size[2]) == 4) {
+		if (entry == key) {
+			memcpy(local, size, sizeof(size));
+			found = true;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+/**
+ * __store_tuned_size() appends local size tuned for key to cache of device.
+ * Entry is a single short line, so concurrent appends do not interleave.
+ * Failures are not fatal, kernel is just tuned again next time
+ */
+void __store_tuned_size(cl_device_id dev, uint64_t key, const size_t *local)
+{
+	char path[4096];
+	FILE *file;
+
+	if (!__tune_cache_path(dev, path, sizeof(path))) {
+		return;
+	}
+	file = fopen(path, "a");
+	if (file == NULL) {
+		return;
+	}
+	fprintf(file, "%016llx %zu %zu %zu\n", (unsigned long long)key,
+		local[0], local[1], local[2]);
+	fclose(file);
+}
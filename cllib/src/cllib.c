@@ -2,49 +2,283 @@
 #include <cllib/cllib.h>
 #include <cllib/common.h>
 
-__must_check cl_platform_id __create_platform(void)
+/**
+ * create_device() returns device of type select_device() ranks the highest by
+ * device_rank_throughput()
+ */
+__must_check device_t create_device(enum device_type type)
 {
-	static cl_platform_id platform;
-	cl_uint num_platforms;
+	return select_device(type, NULL);
+}
 
-	static bool platform_ready = false;
+/**
+ * create_devices() enumerates devices of type on every platform, so frame can
+ * be split across all of them
+ *
+ * @param devices array to store devices to
+ * @param size number of entries in devices array
+ * @return number of devices stored, at least one
+ */
+__must_check unsigned int create_devices(enum device_type type,
+					 device_t *devices, unsigned int size)
+{
+	cl_platform_id *platforms;
+	cl_uint num_platforms;
+	unsigned int count = 0;
 	cl_int err;
 
-	if (platform_ready) {
-		return platform;
-	}
 	err = clGetPlatformIDs(0, NULL, &num_platforms);
 	cl_panic_on(err, "clGetPlatformIDs", err);
-	if (num_platforms == 0) {
-		panic("no platforms avaliable");
-	} else if (num_platforms > 1) {
-		warn("muliple platforms avaliable, chosing first one");
-	}
-	err = clGetPlatformIDs(1, &platform, NULL);
+	panic_on(num_platforms == 0, "no platforms avaliable");
+	platforms = malloc(num_platforms * sizeof(cl_platform_id));
+	panic_on(platforms == NULL, "malloc");
+	err = clGetPlatformIDs(num_platforms, platforms, NULL);
 	cl_panic_on(err, "clGetPlatformIDs", err);
-	return platform;
+
+	for (cl_uint i = 0; i < num_platforms && count < size; ++i) {
+		cl_device_id devs[size - count];
+		cl_uint num_devices;
+
+		err = clGetDeviceIDs(platforms[i], type, size - count, devs,
+				     &num_devices);
+		if (err == CL_DEVICE_NOT_FOUND) {
+			continue;
+		}
+		cl_panic_on(err, "clGetDeviceIDs", err);
+		for (cl_uint j = 0; j < num_devices && count < size; ++j) {
+			devices[count++] = (device_t){ .__device = devs[j] };
+		}
+	}
+	free(platforms);
+	panic_on(count == 0, "no devices avaliable");
+	return count;
 }
 
-__must_check device_t create_device(enum device_type type)
+/**
+ * device_compute_units() returns number of parallel compute units of device,
+ * enough work-groups to fill device is a small multiple of it
+ */
+__must_check unsigned int device_compute_units(device_t device)
 {
-	cl_platform_id platform = __create_platform();
+	cl_uint units;
+	cl_int err;
 
-	cl_device_id dev;
-	cl_uint num_devices;
+	err = clGetDeviceInfo(device.__device, CL_DEVICE_MAX_COMPUTE_UNITS,
+			      sizeof(units), &units, NULL);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+	return units;
+}
 
+static void __device_info_string(cl_device_id dev, cl_device_info param,
+				 char *value, size_t size)
+{
 	cl_int err;
 
-	err = clGetDeviceIDs(platform, type, 0, NULL, &num_devices);
-	cl_panic_on(err, "clGetDeviceIDs", err);
-	if (num_devices == 0) {
-		panic("no devices avaliable");
-	} else if (num_devices > 1) {
-		warn("multiple devices avaliable, chosing first one");
+	err = clGetDeviceInfo(dev, param, size, value, NULL);
+	if (err == CL_INVALID_VALUE) {
+		/* value is longer than buffer, it is only printed */
+		char *full;
+		size_t len;
+
+		err = clGetDeviceInfo(dev, param, 0, NULL, &len);
+		cl_panic_on(err, "clGetDeviceInfo", err);
+		full = malloc(len);
+		panic_on(full == NULL, "malloc");
+		err = clGetDeviceInfo(dev, param, len, full, NULL);
+		cl_panic_on(err, "clGetDeviceInfo", err);
+		snprintf(value, size, "%s", full);
+		free(full);
 	}
-	err = clGetDeviceIDs(platform, type, 1, &dev, NULL);
-	cl_panic_on(err, "clGetDeviceIDs", err);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+}
 
-	return (device_t){ .__device = dev };
+#define __device_info_value(dev, param, value)                           \
+	do {                                                             \
+		cl_int __err = clGetDeviceInfo(dev, param, sizeof(value), \
+					       &(value), NULL);          \
+		cl_panic_on(__err, "clGetDeviceInfo", __err);            \
+	} while (false)
+
+/**
+ * device_info() queries capabilities of device
+ */
+__must_check struct device_info device_info(device_t device)
+{
+	cl_device_id dev = device.__device;
+	struct device_info info;
+	cl_uint float_width;
+	cl_uint int_width;
+	cl_uint clock;
+	cl_bool images;
+
+	__device_info_string(dev, CL_DEVICE_NAME, info.name,
+			     sizeof(info.name));
+	__device_info_string(dev, CL_DEVICE_VENDOR, info.vendor,
+			     sizeof(info.vendor));
+	__device_info_value(dev, CL_DEVICE_TYPE, info.type);
+	info.compute_units = device_compute_units(device);
+	__device_info_value(dev, CL_DEVICE_MAX_CLOCK_FREQUENCY, clock);
+	__device_info_value(dev, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+			    info.max_work_group_size);
+	__device_info_value(dev, CL_DEVICE_GLOBAL_MEM_SIZE,
+			    info.global_mem_size);
+	__device_info_value(dev, CL_DEVICE_LOCAL_MEM_SIZE, info.local_mem_size);
+	__device_info_value(dev, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE,
+			    info.constant_mem_size);
+	__device_info_value(dev, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+			    float_width);
+	__device_info_value(dev, CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT,
+			    int_width);
+	__device_info_value(dev, CL_DEVICE_IMAGE_SUPPORT, images);
+
+	info.max_clock = clock;
+	info.float_vector_width = float_width;
+	info.int_vector_width = int_width;
+	info.image_support = images;
+	info.gl_sharing = device_has_extension(device, "cl_khr_gl_sharing");
+	info.gl_event = device_has_extension(device, "cl_khr_gl_event");
+	return info;
+}
+
+/**
+ * device_has_extension() returns true if device supports OpenCL extension
+ */
+__must_check bool device_has_extension(device_t device, const char *extension)
+{
+	size_t len = strlen(extension);
+	char *extensions;
+	const char *found;
+	bool supported = false;
+	size_t size;
+	cl_int err;
+
+	err = clGetDeviceInfo(device.__device, CL_DEVICE_EXTENSIONS, 0, NULL,
+			      &size);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+	extensions = malloc(size);
+	panic_on(extensions == NULL, "malloc");
+	err = clGetDeviceInfo(device.__device, CL_DEVICE_EXTENSIONS, size,
+			      extensions, NULL);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+
+	/* extensions are separated by spaces, one name may prefix other */
+	for (found = strstr(extensions, extension); found != NULL;
+	     found = strstr(found + len, extension)) {
+		if ((found == extensions || found[-1] == ' ') &&
+		    (found[len] == ' ' || found[len] == '\0')) {
+			supported = true;
+			break;
+		}
+	}
+	free(extensions);
+	return supported;
+}
+
+/**
+ * device_platform() returns platform of device, context with properties must
+ * name it
+ */
+__must_check cl_platform_id device_platform(device_t device)
+{
+	cl_platform_id platform;
+
+	__device_info_value(device.__device, CL_DEVICE_PLATFORM, platform);
+	return platform;
+}
+
+void device_info_dump(const struct device_info *info, FILE *file)
+{
+	fprintf(file,
+		"%s (%s): %u compute units at %u MHz, work-group %zu, "
+		"global %lu MiB, local %lu KiB, constant %lu KiB, "
+		"vector float%u int%u%s%s%s\n",
+		info->name, info->vendor, info->compute_units, info->max_clock,
+		info->max_work_group_size,
+		(unsigned long)(info->global_mem_size >> 20),
+		(unsigned long)(info->local_mem_size >> 10),
+		(unsigned long)(info->constant_mem_size >> 10),
+		info->float_vector_width, info->int_vector_width,
+		info->image_support ? ", images" : "",
+		info->gl_sharing ? ", gl sharing" : "",
+		info->gl_event ? ", gl event" : "");
+}
+
+/**
+ * device_rank_throughput() ranks device by peak rate it issues work at, it is
+ * default rank of select_device()
+ */
+long device_rank_throughput(const struct device_info *info)
+{
+	return (long)info->compute_units * info->max_clock;
+}
+
+/**
+ * __device_override() returns index of device CLLIB_DEVICE environment
+ * variable names, or -1 if it is not set. Variable is either index of device
+ * in order create_devices() returns them or part of device name
+ */
+static int __device_override(const struct device_info *infos,
+			     unsigned int count)
+{
+	const char *env = getenv("CLLIB_DEVICE");
+	char *end;
+	unsigned long index;
+
+	if (env == NULL || *env == '\0') {
+		return -1;
+	}
+	index = strtoul(env, &end, 10);
+	if (*end == '\0') {
+		panic_on(index >= count, "CLLIB_DEVICE index is out of range");
+		return index;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		if (strstr(infos[i].name, env) != NULL) {
+			return i;
+		}
+	}
+	panic("CLLIB_DEVICE matches no device");
+}
+
+/**
+ * select_device() chooses device of type on any platform which rank scores
+ * the highest. CLLIB_DEVICE environment variable overrides the choice with
+ * device index or part of its name
+ *
+ * @param rank scores devices, if NULL, device_rank_throughput() is used
+ */
+__must_check device_t select_device(enum device_type type, device_rank_fn rank)
+{
+	device_t devices[CLLIB_MAX_DEVICES];
+	struct device_info infos[CLLIB_MAX_DEVICES];
+	unsigned int count = create_devices(type, devices, CLLIB_MAX_DEVICES);
+	long best_score = -1;
+	int best = -1;
+
+	if (rank == NULL) {
+		rank = device_rank_throughput;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		infos[i] = device_info(devices[i]);
+	}
+
+	best = __device_override(infos, count);
+	if (best >= 0) {
+		if (rank(&infos[best]) < 0) {
+			warn("CLLIB_DEVICE device is ranked unusable");
+		}
+		return devices[best];
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		long score = rank(&infos[i]);
+
+		if (score > best_score) {
+			best_score = score;
+			best = i;
+		}
+	}
+	panic_on(best < 0, "no suitable devices avaliable");
+	return devices[best];
 }
 
 __always_inline __must_check context_t create_context(device_t device)
@@ -65,20 +299,12 @@ create_context_with_props(device_t device, const context_props *properties)
 	return (context_t){ .__context = context };
 }
 
-__must_check kernel_t create_kernel(device_t device, context_t context,
-				    const char *source, const char *kernel_name,
-				    const char *options)
+static void __build_program(cl_program program, cl_device_id dev,
+			    const char *options)
 {
-	cl_device_id dev = device.__device;
-	cl_context ctx = context.__context;
-	cl_program program;
-	cl_kernel kernel;
-
 	size_t log_size;
 	cl_int err;
 
-	program = clCreateProgramWithSource(ctx, 1, &source, NULL, &err);
-	cl_panic_on(err, "clCreateProgramWithSource", err);
 	err = clBuildProgram(program, 1, &dev, options, NULL, NULL);
 	if (unlikely(err == CL_BUILD_PROGRAM_FAILURE &&
 		     CLLIB_PRINT_PROGRAM_LOG)) {
@@ -97,9 +323,45 @@ __must_check kernel_t create_kernel(device_t device, context_t context,
 		panic("build failure");
 	}
 	cl_panic_on(err, "clBuildProgram", err);
+}
+
+/**
+ * create_kernel() builds program and creates kernel from it. Device binary of
+ * program is cached on disk, so later runs with the same source, options and
+ * driver skip compilation. Cache is stored in CLLIB_CACHE_DIR and can be
+ * disabled with CONFIG_DISABLE_BINARY_CACHE
+ */
+__must_check kernel_t create_kernel(device_t device, context_t context,
+				    const char *source, const char *kernel_name,
+				    const char *options)
+{
+	cl_device_id dev = device.__device;
+	cl_context ctx = context.__context;
+	cl_program program = NULL;
+	cl_kernel kernel;
+	uint64_t key = 0;
+
+	cl_int err;
+
+	if (CLLIB_BINARY_CACHE) {
+		key = __program_cache_key(dev, source, options);
+		program = __load_program_binary(ctx, dev, key, options);
+	}
+	if (program == NULL) {
+		program = clCreateProgramWithSource(ctx, 1, &source, NULL,
+						    &err);
+		cl_panic_on(err, "clCreateProgramWithSource", err);
+		__build_program(program, dev, options);
+		if (CLLIB_BINARY_CACHE) {
+			__store_program_binary(program, key);
+		}
+	}
 
 	kernel = clCreateKernel(program, kernel_name, &err);
 	cl_panic_on(err, "clCreateKernel", err);
+	/* kernels keep program, it is freed with the last of them */
+	err = clReleaseProgram(program);
+	cl_panic_on(err, "clReleaseProgram", err);
 
 	return (kernel_t){ .__kernel = kernel,
 			   .__arg = 0,
@@ -107,18 +369,103 @@ __must_check kernel_t create_kernel(device_t device, context_t context,
 			   .__set_local = false };
 };
 
-__always_inline __must_check queue_t create_queue(context_t context,
-						  device_t device)
+/**
+ * create_program_kernel() creates another kernel from program of already
+ * created kernel, so several kernels of one source are built once
+ */
+__must_check kernel_t create_program_kernel(kernel_t kernel,
+					    const char *kernel_name)
+{
+	cl_program program;
+	cl_kernel created;
+	cl_int err;
+
+	err = clGetKernelInfo(kernel.__kernel, CL_KERNEL_PROGRAM,
+			      sizeof(program), &program, NULL);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	created = clCreateKernel(program, kernel_name, &err);
+	cl_panic_on(err, "clCreateKernel", err);
+
+	return (kernel_t){ .__kernel = created,
+			   .__arg = 0,
+			   .__dimentions = 0,
+			   .__set_local = false };
+}
+
+static __must_check queue_t __create_queue(context_t context, device_t device,
+					   const cl_queue_properties *props)
 {
 	cl_context ctx = context.__context;
 	cl_device_id dev = device.__device;
 	cl_command_queue queue;
 	cl_int err;
 
-	queue = clCreateCommandQueueWithProperties(ctx, dev, NULL, &err);
+	queue = clCreateCommandQueueWithProperties(ctx, dev, props, &err);
 	cl_panic_on(err, "clCreateCommandQueueWithProperties", err);
 
-	return (queue_t){ .__queue = queue };
+	return (queue_t){ .__queue = queue, .__profile = NULL };
+}
+
+__always_inline __must_check queue_t create_queue(context_t context,
+						  device_t device)
+{
+	return __create_queue(context, device, NULL);
+}
+
+/**
+ * create_profiling_queue() creates queue which records device timings of
+ * every command enqueued with cllib. Timings are aggregated per kernel name
+ * and transfer kind and can be read with profile_stats() or profile_dump()
+ */
+__must_check queue_t create_profiling_queue(context_t context, device_t device)
+{
+	const cl_queue_properties props[] = { CL_QUEUE_PROPERTIES,
+					      CL_QUEUE_PROFILING_ENABLE, 0 };
+	queue_t queue = __create_queue(context, device, props);
+
+	queue.__profile = __create_profile();
+	return queue;
+}
+
+/**
+ * release_queue() waits for commands of queue and releases it, statistics of
+ * profiling queue are freed too
+ */
+void release_queue(queue_t queue)
+{
+	cl_int err;
+
+	err = clFinish(queue.__queue);
+	cl_panic_on(err, "clFinish", err);
+	if (queue.__profile != NULL) {
+		__destroy_profile(queue.__profile);
+	}
+	err = clReleaseCommandQueue(queue.__queue);
+	cl_panic_on(err, "clReleaseCommandQueue", err);
+}
+
+/**
+ * release_context() releases context, its objects keep it until they are
+ * released
+ */
+void release_context(context_t context)
+{
+	cl_int err;
+
+	err = clReleaseContext(context.__context);
+	cl_panic_on(err, "clReleaseContext", err);
+}
+
+/**
+ * release_kernel() releases kernel, program of kernel is freed with the last
+ * kernel created from it
+ */
+void release_kernel(kernel_t kernel)
+{
+	cl_int err;
+
+	err = clReleaseKernel(kernel.__kernel);
+	cl_panic_on(err, "clReleaseKernel", err);
 }
 
 __always_inline __must_check buffer_t create_buffer(context_t context,
@@ -170,11 +517,13 @@ __always_inline void fill_buffer(queue_t queue, buffer_t buffer, size_t size,
 {
 	cl_command_queue qw = queue.__queue;
 	cl_mem buff = buffer.__buffer;
+	cl_event event = NULL;
 	cl_int err;
 
 	err = clEnqueueWriteBuffer(qw, buff, blocking_write, 0, size, data, 0,
-				   NULL, NULL);
+				   NULL, __profile_event(queue, &event));
 	cl_panic_on(err, "clEnqueueWriteBuffer", err);
+	__profile_record(queue, "write buffer", event);
 }
 
 __always_inline void dump_buffer(queue_t queue, buffer_t buffer, size_t size,
@@ -182,11 +531,64 @@ __always_inline void dump_buffer(queue_t queue, buffer_t buffer, size_t size,
 {
 	cl_command_queue qw = queue.__queue;
 	cl_mem buff = buffer.__buffer;
+	cl_event event = NULL;
 	cl_int err;
 
 	err = clEnqueueReadBuffer(qw, buff, blocking_read, 0, size, data, 0,
-				  NULL, NULL);
+				  NULL, __profile_event(queue, &event));
+	cl_panic_on(err, "clEnqueueReadBuffer", err);
+	__profile_record(queue, "read buffer", event);
+}
+
+__always_inline void fill_buffer_range(queue_t queue, buffer_t buffer,
+				       size_t offset, size_t size, void *data,
+				       bool blocking_write)
+{
+	cl_command_queue qw = queue.__queue;
+	cl_mem buff = buffer.__buffer;
+	cl_event event = NULL;
+	cl_int err;
+
+	err = clEnqueueWriteBuffer(qw, buff, blocking_write, offset, size, data,
+				   0, NULL, __profile_event(queue, &event));
+	cl_panic_on(err, "clEnqueueWriteBuffer", err);
+	__profile_record(queue, "write buffer range", event);
+}
+
+__always_inline void dump_buffer_range(queue_t queue, buffer_t buffer,
+				       size_t offset, size_t size, void *data,
+				       bool blocking_read)
+{
+	cl_command_queue qw = queue.__queue;
+	cl_mem buff = buffer.__buffer;
+	cl_event event = NULL;
+	cl_int err;
+
+	err = clEnqueueReadBuffer(qw, buff, blocking_read, offset, size, data,
+				  0, NULL, __profile_event(queue, &event));
 	cl_panic_on(err, "clEnqueueReadBuffer", err);
+	__profile_record(queue, "read buffer range", event);
+}
+
+__always_inline void copy_buffer(queue_t queue, buffer_t src, buffer_t dst,
+				 size_t size)
+{
+	cl_command_queue qw = queue.__queue;
+	cl_event event = NULL;
+	cl_int err;
+
+	err = clEnqueueCopyBuffer(qw, src.__buffer, dst.__buffer, 0, 0, size, 0,
+				  NULL, __profile_event(queue, &event));
+	cl_panic_on(err, "clEnqueueCopyBuffer", err);
+	__profile_record(queue, "copy buffer", event);
+}
+
+__always_inline void release_buffer(buffer_t buffer)
+{
+	cl_int err;
+
+	err = clReleaseMemObject(buffer.__buffer);
+	cl_panic_on(err, "clReleaseMemObject", err);
 }
 
 __always_inline void __set_kernel_arg(cl_kernel kernel, unsigned int arg_index,
@@ -228,24 +630,50 @@ __always_inline void __set_kernel_local_size(kernel_t *kernel,
 	kernel->__local_size[2] = depth;
 }
 
+/**
+ * __set_kernel_offset() sets global id of the first work-item, so kernel
+ * runs only over part of its index space
+ */
+__always_inline void __set_kernel_offset(kernel_t *kernel,
+					 unsigned short dimentions, size_t x,
+					 size_t y, size_t z)
+{
+	panic_on(kernel->__dimentions != 0 &&
+			 kernel->__dimentions != dimentions,
+		 "kernel offset and global dimentions mismatch");
+
+	kernel->__dimentions = dimentions;
+	kernel->__set_offset = true;
+	kernel->__global_offset[0] = x;
+	kernel->__global_offset[1] = y;
+	kernel->__global_offset[2] = z;
+}
+
 __always_inline void __run_kernel(queue_t queue, kernel_t *kernel)
 {
 	cl_kernel kr = kernel->__kernel;
 	cl_command_queue qw = queue.__queue;
 
 	size_t *global_size = kernel->__global_size;
+	size_t *global_offset = NULL;
 	size_t *local_size = NULL;
 	cl_uint dim = kernel->__dimentions;
 
+	cl_event event = NULL;
 	cl_int err;
 
 	kernel->__arg = 0;
 	if (kernel->__set_local) {
 		local_size = kernel->__local_size;
 	}
-	err = clEnqueueNDRangeKernel(qw, kr, dim, NULL, global_size, local_size,
-				     0, NULL, NULL);
+	if (kernel->__set_offset) {
+		global_offset = kernel->__global_offset;
+	}
+	err = clEnqueueNDRangeKernel(qw, kr, dim, global_offset, global_size,
+				     local_size, 0, NULL,
+				     __profile_event(queue, &event));
 	cl_panic_on(err, "clEnqueueNDRangeKernel", err);
+	__profile_record_kernel(queue, kr, event);
 }
 
 __always_inline void flush_queue(queue_t queue)
@@ -257,6 +685,32 @@ __always_inline void flush_queue(queue_t queue)
 	cl_panic_on(err, "clFlush", err);
 }
 
+static void CL_CALLBACK __free_callback(cl_event event, cl_int status,
+					 void *data)
+{
+	(void)event;
+	(void)status;
+	free(data);
+}
+
+/**
+ * free_after_queue() frees malloc'ed host memory once every command enqueued
+ * to queue before the call completes. Non-blocking writes may read from the
+ * memory, so caller never waits for them
+ */
+void free_after_queue(queue_t queue, void *data)
+{
+	cl_event marker;
+	cl_int err;
+
+	err = clEnqueueMarkerWithWaitList(queue.__queue, 0, NULL, &marker);
+	cl_panic_on(err, "clEnqueueMarkerWithWaitList", err);
+	err = clSetEventCallback(marker, CL_COMPLETE, __free_callback, data);
+	cl_panic_on(err, "clSetEventCallback", err);
+	err = clReleaseEvent(marker);
+	cl_panic_on(err, "clReleaseEvent", err);
+}
+
 __cold __noreturn void __cl_panic(const char *msg, cl_int error,
 				  const char *file, unsigned long line)
 {
@@ -0,0 +1,178 @@
+#include <cllib/cllib.h>
+#include <cllib/common.h>
+
+/**
+ * __pool_region is freed sub-buffer place, it is reused by next allocation of
+ * the same class
+ */
+struct __pool_region {
+	cl_mem block;
+	size_t offset;
+	struct __pool_region *next;
+};
+
+/**
+ * create_pool() creates empty pool, device memory is allocated by the first
+ * pool_alloc()
+ *
+ * @param block_size size of device allocations sub-buffers are cut from,
+ * 	bigger sub-buffers get allocation of their own
+ */
+__must_check pool_t create_pool(context_t context, device_t device,
+				size_t block_size)
+{
+	pool_t pool = { .__context = context, .__block_size = block_size };
+	cl_uint align_bits;
+	cl_int err;
+
+	err = clGetDeviceInfo(device.__device, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+			      sizeof(align_bits), &align_bits, NULL);
+	cl_panic_on(err, "clGetDeviceInfo", err);
+	pool.__align = align_bits / 8 > 0 ? align_bits / 8 : 1;
+	return pool;
+}
+
+/**
+ * destroy_pool() releases device memory of pool. Sub-buffers still allocated
+ * keep their allocation until they are released
+ */
+void destroy_pool(pool_t *pool)
+{
+	for (unsigned int i = 0; i < POOL_CLASSES; ++i) {
+		while (pool->__free[i] != NULL) {
+			struct __pool_region *region = pool->__free[i];
+
+			pool->__free[i] = region->next;
+			free(region);
+		}
+	}
+	for (unsigned int i = 0; i < pool->__blocks_num; ++i) {
+		cl_int err = clReleaseMemObject(pool->__blocks[i]);
+
+		cl_panic_on(err, "clReleaseMemObject", err);
+	}
+	free(pool->__blocks);
+}
+
+/**
+ * __pool_class() returns class of size, classes are never smaller than base
+ * address alignment, so every sub-buffer origin is aligned
+ */
+static unsigned int __pool_class(const pool_t *pool, size_t size)
+{
+	unsigned int class = 0;
+
+	while (((size_t)1 << class) < size ||
+	       ((size_t)1 << class) < pool->__align) {
+		++class;
+	}
+	panic_on(class >= POOL_CLASSES, "pool allocation is too big");
+	return class;
+}
+
+static cl_mem __pool_block(pool_t *pool, size_t size)
+{
+	cl_mem block;
+	cl_int err;
+
+	if (pool->__blocks_num == pool->__blocks_capacity) {
+		pool->__blocks_capacity = pool->__blocks_capacity * 2 + 4;
+		pool->__blocks = realloc(pool->__blocks,
+					 pool->__blocks_capacity *
+						 sizeof(cl_mem));
+		panic_on(pool->__blocks == NULL, "realloc");
+	}
+	block = clCreateBuffer(pool->__context.__context, CL_MEM_READ_WRITE,
+			       size, NULL, &err);
+	cl_panic_on(err, "clCreateBuffer", err);
+	pool->__blocks[pool->__blocks_num++] = block;
+	pool->__reserved += size;
+	return block;
+}
+
+/**
+ * pool_alloc() returns sub-buffer of at least size bytes. Freed sub-buffer of
+ * the same class is reused if there is one, otherwise it is cut from the last
+ * block or new block is allocated
+ *
+ * @param type access of sub-buffer, any type valid for create_buffer()
+ * @param size bytes of sub-buffer, 0 gets sub-buffer of the smallest class,
+ * 	as OpenCL has no empty sub-buffers
+ */
+__must_check buffer_t pool_alloc(pool_t *pool, enum buffer_type type,
+				 size_t size)
+{
+	unsigned int class = __pool_class(pool, size);
+	size_t class_size = (size_t)1 << class;
+	struct __pool_region *region = pool->__free[class];
+	cl_buffer_region sub;
+	cl_mem block;
+	cl_mem buffer;
+	cl_int err;
+
+	if (region != NULL) {
+		pool->__free[class] = region->next;
+		block = region->block;
+		sub.origin = region->offset;
+		free(region);
+	} else if (class_size > pool->__block_size) {
+		block = __pool_block(pool, class_size);
+		sub.origin = 0;
+	} else {
+		/* rest of full block is left unused */
+		if (pool->__blocks_num == 0 ||
+		    pool->__offset + class_size > pool->__block_size) {
+			__pool_block(pool, pool->__block_size);
+			pool->__offset = 0;
+		}
+		block = pool->__blocks[pool->__blocks_num - 1];
+		sub.origin = pool->__offset;
+		pool->__offset += class_size;
+	}
+	sub.size = size > 0 ? size : class_size;
+
+	buffer = clCreateSubBuffer(block, type, CL_BUFFER_CREATE_TYPE_REGION,
+				   &sub, &err);
+	cl_panic_on(err, "clCreateSubBuffer", err);
+	pool->__in_use += class_size;
+	pool->__peak = pool->__in_use > pool->__peak ? pool->__in_use :
+						     pool->__peak;
+	return (buffer_t){ .__buffer = buffer };
+}
+
+/**
+ * pool_free() releases sub-buffer returned by pool_alloc(), its place is
+ * reused by next allocation of the same class
+ */
+void pool_free(pool_t *pool, buffer_t buffer)
+{
+	struct __pool_region *region = malloc(sizeof(*region));
+	size_t size;
+	cl_int err;
+
+	panic_on(region == NULL, "malloc");
+	err = clGetMemObjectInfo(buffer.__buffer, CL_MEM_ASSOCIATED_MEMOBJECT,
+				 sizeof(region->block), &region->block, NULL);
+	cl_panic_on(err, "clGetMemObjectInfo", err);
+	err = clGetMemObjectInfo(buffer.__buffer, CL_MEM_OFFSET,
+				 sizeof(region->offset), &region->offset, NULL);
+	cl_panic_on(err, "clGetMemObjectInfo", err);
+	err = clGetMemObjectInfo(buffer.__buffer, CL_MEM_SIZE, sizeof(size),
+				 &size, NULL);
+	cl_panic_on(err, "clGetMemObjectInfo", err);
+	panic_on(region->block == NULL, "buffer is not allocated by pool");
+
+	unsigned int class = __pool_class(pool, size);
+
+	region->next = pool->__free[class];
+	pool->__free[class] = region;
+	pool->__in_use -= (size_t)1 << class;
+	release_buffer(buffer);
+}
+
+struct pool_stats pool_stats(const pool_t *pool)
+{
+	return (struct pool_stats){ .used = pool->__in_use,
+				    .peak = pool->__peak,
+				    .reserved = pool->__reserved };
+}
@@ -0,0 +1,291 @@
+#include <cllib/cllib.h>
+#include <cllib/common.h>
+
+/* number of commands which can be in flight before recording waits for them */
+#define PROFILE_PENDING 64
+#define PROFILE_NAME_SIZE 64
+
+struct __profile_entry {
+	char name[PROFILE_NAME_SIZE];
+	cl_ulong *samples;
+	unsigned long count;
+	unsigned long capacity;
+	cl_ulong min;
+	cl_ulong max;
+	double sum;
+	double wait_sum;
+};
+
+struct __profile_pending {
+	cl_event event;
+	unsigned int entry;
+};
+
+struct __profile {
+	struct __profile_entry *entries;
+	unsigned int entries_num;
+	unsigned int entries_capacity;
+	struct __profile_pending pending[PROFILE_PENDING];
+	unsigned int pending_num;
+};
+
+__must_check struct __profile *__create_profile(void)
+{
+	struct __profile *profile = calloc(1, sizeof(struct __profile));
+
+	panic_on(profile == NULL, "calloc");
+	return profile;
+}
+
+static unsigned int __profile_entry(struct __profile *profile,
+				    const char *name)
+{
+	struct __profile_entry *entry;
+
+	for (unsigned int i = 0; i < profile->entries_num; ++i) {
+		if (strncmp(profile->entries[i].name, name,
+			    PROFILE_NAME_SIZE - 1) == 0) {
+			return i;
+		}
+	}
+	if (profile->entries_num == profile->entries_capacity) {
+		profile->entries_capacity = profile->entries_capacity * 2 + 4;
+		profile->entries = realloc(profile->entries,
+					   profile->entries_capacity *
+						   sizeof(*profile->entries));
+		panic_on(profile->entries == NULL, "realloc");
+	}
+	entry = &profile->entries[profile->entries_num];
+	memset(entry, 0, sizeof(*entry));
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+	entry->min = (cl_ulong)-1;
+	return profile->entries_num++;
+}
+
+static void __profile_sample(struct __profile_entry *entry, cl_ulong time,
+			     cl_ulong wait)
+{
+	if (entry->count == entry->capacity) {
+		entry->capacity = entry->capacity * 2 + 64;
+		entry->samples = realloc(entry->samples,
+					 entry->capacity * sizeof(cl_ulong));
+		panic_on(entry->samples == NULL, "realloc");
+	}
+	entry->samples[entry->count++] = time;
+	entry->min = time < entry->min ? time : entry->min;
+	entry->max = time > entry->max ? time : entry->max;
+	entry->sum += time;
+	entry->wait_sum += wait;
+}
+
+/**
+ * __profile_collect() moves timings of finished commands to statistics and
+ * releases their events
+ *
+ * @param wait if true, waits for every pending command, otherwise only
+ * 	already finished commands are collected
+ */
+static void __profile_collect(struct __profile *profile, bool wait)
+{
+	unsigned int left = 0;
+	cl_int err;
+
+	for (unsigned int i = 0; i < profile->pending_num; ++i) {
+		struct __profile_pending pending = profile->pending[i];
+		cl_ulong queued, start, end;
+		cl_int status;
+
+		if (wait) {
+			/* failed commands are reported by status below */
+			clWaitForEvents(1, &pending.event);
+		}
+		err = clGetEventInfo(pending.event,
+				     CL_EVENT_COMMAND_EXECUTION_STATUS,
+				     sizeof(status), &status, NULL);
+		cl_panic_on(err, "clGetEventInfo", err);
+		if (status > CL_COMPLETE) {
+			profile->pending[left++] = pending;
+			continue;
+		}
+
+		if (status == CL_COMPLETE) {
+			err = clGetEventProfilingInfo(
+				pending.event, CL_PROFILING_COMMAND_QUEUED,
+				sizeof(queued), &queued, NULL);
+			cl_panic_on(err, "clGetEventProfilingInfo", err);
+			err = clGetEventProfilingInfo(
+				pending.event, CL_PROFILING_COMMAND_START,
+				sizeof(start), &start, NULL);
+			cl_panic_on(err, "clGetEventProfilingInfo", err);
+			err = clGetEventProfilingInfo(pending.event,
+						      CL_PROFILING_COMMAND_END,
+						      sizeof(end), &end, NULL);
+			cl_panic_on(err, "clGetEventProfilingInfo", err);
+			__profile_sample(&profile->entries[pending.entry],
+					 end - start, start - queued);
+		}
+		err = clReleaseEvent(pending.event);
+		cl_panic_on(err, "clReleaseEvent", err);
+	}
+	profile->pending_num = left;
+}
+
+/**
+ * __destroy_profile() waits for pending commands and frees statistics
+ */
+void __destroy_profile(struct __profile *profile)
+{
+	__profile_collect(profile, true);
+	for (unsigned int i = 0; i < profile->entries_num; ++i) {
+		free(profile->entries[i].samples);
+	}
+	free(profile->entries);
+	free(profile);
+}
+
+/**
+ * __profile_record() adds command to statistics of `name`. Ownership of event
+ * is taken, event is released after its timings are read. Does nothing if
+ * queue is not profiled
+ */
+void __profile_record(queue_t queue, const char *name, cl_event event)
+{
+	struct __profile *profile = queue.__profile;
+
+	if (profile == NULL) {
+		return;
+	}
+	if (profile->pending_num == PROFILE_PENDING) {
+		__profile_collect(profile, false);
+	}
+	if (profile->pending_num == PROFILE_PENDING) {
+		__profile_collect(profile, true);
+	}
+	profile->pending[profile->pending_num++] = (struct __profile_pending){
+		.event = event, .entry = __profile_entry(profile, name)
+	};
+}
+
+void __profile_record_kernel(queue_t queue, cl_kernel kernel, cl_event event)
+{
+	size_t size;
+	cl_int err;
+
+	if (queue.__profile == NULL) {
+		return;
+	}
+	err = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	char name[size];
+	err = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, name,
+			      NULL);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	__profile_record(queue, name, event);
+}
+
+/**
+ * profile_event() adds command enqueued outside of cllib, like GL objects
+ * acquire, to profiling statistics of queue. Event is retained, so caller
+ * still owns it
+ *
+ * @param queue profiling queue where command was enqueued
+ * @param name name under which command timings are aggregated
+ * @param event event returned by enqueue call
+ */
+void profile_event(queue_t queue, const char *name, cl_event event)
+{
+	cl_int err;
+
+	if (queue.__profile == NULL) {
+		return;
+	}
+	err = clRetainEvent(event);
+	cl_panic_on(err, "clRetainEvent", err);
+	__profile_record(queue, name, event);
+}
+
+static int __compare_samples(const void *a, const void *b)
+{
+	cl_ulong x = *(const cl_ulong *)a;
+	cl_ulong y = *(const cl_ulong *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * profile_stats() waits for all recorded commands of queue and returns their
+ * statistics, one entry per kernel or transfer kind. Times are in
+ * milliseconds
+ *
+ * @param queue profiling queue
+ * @param stats array to store statistics to, valid until next profile_reset()
+ * @param size number of entries in stats array
+ * @return number of entries available, which may be greater than size
+ */
+unsigned int profile_stats(queue_t queue, struct profile_stats *stats,
+			   unsigned int size)
+{
+	struct __profile *profile = queue.__profile;
+
+	if (profile == NULL) {
+		return 0;
+	}
+	__profile_collect(profile, true);
+
+	for (unsigned int i = 0; i < profile->entries_num && i < size; ++i) {
+		struct __profile_entry *entry = &profile->entries[i];
+		unsigned long p99 = 0;
+
+		stats[i] = (struct profile_stats){ .name = entry->name,
+						   .count = entry->count };
+		if (entry->count == 0) {
+			continue;
+		}
+		qsort(entry->samples, entry->count, sizeof(cl_ulong),
+		      __compare_samples);
+		p99 = (entry->count * 99 + 99) / 100 - 1;
+
+		stats[i].min = entry->min * 1e-6;
+		stats[i].max = entry->max * 1e-6;
+		stats[i].mean = entry->sum / entry->count * 1e-6;
+		stats[i].p99 = entry->samples[p99] * 1e-6;
+		stats[i].wait = entry->wait_sum / entry->count * 1e-6;
+	}
+	return profile->entries_num;
+}
+
+/**
+ * profile_dump() prints statistics of all recorded commands of queue
+ */
+void profile_dump(queue_t queue, FILE *file)
+{
+	unsigned int num = profile_stats(queue, NULL, 0);
+	struct profile_stats stats[num > 0 ? num : 1];
+
+	profile_stats(queue, stats, num);
+	fprintf(file, "%-24s %8s %10s %10s %10s %10s %10s\n", "command",
+		"count", "min ms", "mean ms", "p99 ms", "max ms", "wait ms");
+	for (unsigned int i = 0; i < num; ++i) {
+		fprintf(file, "%-24s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+			stats[i].name, stats[i].count, stats[i].min,
+			stats[i].mean, stats[i].p99, stats[i].max,
+			stats[i].wait);
+	}
+}
+
+/**
+ * profile_reset() drops statistics collected so far
+ */
+void profile_reset(queue_t queue)
+{
+	struct __profile *profile = queue.__profile;
+
+	if (profile == NULL) {
+		return;
+	}
+	__profile_collect(profile, true);
+	for (unsigned int i = 0; i < profile->entries_num; ++i) {
+		free(profile->entries[i].samples);
+	}
+	profile->entries_num = 0;
+}
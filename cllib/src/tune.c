@@ -0,0 +1,179 @@
+#include <float.h>
+#include <time.h>
+
+#include <cllib/cllib.h>
+#include <cllib/common.h>
+
+/* most local sizes benchmarked for one kernel */
+#define TUNE_MAX_CANDIDATES 128
+/* timed launches per local size, the fastest one counts */
+#define TUNE_RUNS 3
+
+/**
+ * kernel_usage() queries work-group limits and memory usage of kernel built
+ * for device
+ */
+__must_check struct kernel_usage kernel_usage(kernel_t kernel, device_t device)
+{
+	struct kernel_usage usage;
+	cl_int err;
+
+	err = clGetKernelWorkGroupInfo(kernel.__kernel, device.__device,
+				       CL_KERNEL_WORK_GROUP_SIZE,
+				       sizeof(usage.work_group_size),
+				       &usage.work_group_size, NULL);
+	cl_panic_on(err, "clGetKernelWorkGroupInfo", err);
+	err = clGetKernelWorkGroupInfo(
+		kernel.__kernel, device.__device,
+		CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+		sizeof(usage.preferred_multiple), &usage.preferred_multiple,
+		NULL);
+	cl_panic_on(err, "clGetKernelWorkGroupInfo", err);
+	err = clGetKernelWorkGroupInfo(kernel.__kernel, device.__device,
+				       CL_KERNEL_PRIVATE_MEM_SIZE,
+				       sizeof(usage.private_mem_size),
+				       &usage.private_mem_size, NULL);
+	cl_panic_on(err, "clGetKernelWorkGroupInfo", err);
+	err = clGetKernelWorkGroupInfo(kernel.__kernel, device.__device,
+				       CL_KERNEL_LOCAL_MEM_SIZE,
+				       sizeof(usage.local_mem_size),
+				       &usage.local_mem_size, NULL);
+	cl_panic_on(err, "clGetKernelWorkGroupInfo", err);
+	return usage;
+}
+
+static double __seconds(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/**
+ * __time_kernel() returns the shortest time of TUNE_RUNS launches of kernel
+ * after warm-up launch
+ */
+static double __time_kernel(queue_t queue, kernel_t *kernel)
+{
+	double best = DBL_MAX;
+	cl_int err;
+
+	for (unsigned int i = 0; i <= TUNE_RUNS; ++i) {
+		double start = __seconds();
+		double time;
+
+		__run_kernel(queue, kernel);
+		err = clFinish(queue.__queue);
+		cl_panic_on(err, "clFinish", err);
+		time = __seconds() - start;
+		if (i > 0 && time < best) {
+			best = time;
+		}
+	}
+	return best;
+}
+
+/**
+ * __tune_candidates() lists power of two local sizes which fit work-group,
+ * are multiple of preferred multiple and divide global size, as OpenCL 1.2
+ * requires
+ *
+ * @return number of candidates
+ */
+static unsigned int __tune_candidates(const kernel_t *kernel,
+				      const struct kernel_usage *usage,
+				      size_t candidates[][3])
+{
+	const size_t *global = kernel->__global_size;
+	size_t max_y = kernel->__dimentions >= 2 ? usage->work_group_size : 1;
+	size_t multiple = usage->preferred_multiple > 0 ?
+				  usage->preferred_multiple :
+				  1;
+	unsigned int count = 0;
+
+	for (size_t x = 1; x <= usage->work_group_size; x *= 2) {
+		for (size_t y = 1; y <= max_y; y *= 2) {
+			size_t size = x * y;
+
+			if (size > usage->work_group_size ||
+			    size % multiple != 0 || global[0] % x != 0 ||
+			    global[1] % y != 0) {
+				continue;
+			}
+			if (count == TUNE_MAX_CANDIDATES) {
+				return count;
+			}
+			candidates[count][0] = x;
+			candidates[count][1] = y;
+			candidates[count][2] = 1;
+			++count;
+		}
+	}
+	return count;
+}
+
+/**
+ * __tune_kernel() sets local size kernel runs the fastest with. At first use
+ * local sizes listed by __tune_candidates() and driver default one are
+ * benchmarked with current arguments of kernel, so arguments must be set and
+ * kernel must be safe to run several times. Winner is stored in cache of
+ * device and reused by later runs. Memory usage of kernel is reported, so
+ * occupancy problems are visible
+ */
+void __tune_kernel(queue_t queue, device_t device, kernel_t *kernel)
+{
+	struct kernel_usage usage = kernel_usage(*kernel, device);
+	uint64_t key = __tune_cache_key(kernel, device.__device, &usage);
+	size_t candidates[TUNE_MAX_CANDIDATES][3];
+	size_t best[3] = { 0, 0, 0 };
+	bool cached;
+	char name[256];
+	cl_int err;
+
+	panic_on(kernel->__dimentions == 3, "3d kernels are not tuned");
+	cached = __load_tuned_size(device.__device, key, best);
+	if (!cached) {
+		unsigned int count = __tune_candidates(kernel, &usage,
+						       candidates);
+		double best_time;
+
+		kernel->__set_local = false;
+		best_time = __time_kernel(queue, kernel);
+		for (unsigned int i = 0; i < count; ++i) {
+			double time;
+
+			__set_kernel_local_size(kernel, kernel->__dimentions,
+						candidates[i][0],
+						candidates[i][1], 1);
+			time = __time_kernel(queue, kernel);
+			if (time < best_time) {
+				best_time = time;
+				memcpy(best, candidates[i], sizeof(best));
+			}
+		}
+		__store_tuned_size(device.__device, key, best);
+	}
+
+	/* zero size is driver default, it was the fastest */
+	kernel->__set_local = false;
+	if (best[0] != 0) {
+		__set_kernel_local_size(kernel, kernel->__dimentions, best[0],
+					best[1], best[2]);
+	}
+
+	err = clGetKernelInfo(kernel->__kernel, CL_KERNEL_FUNCTION_NAME,
+			      sizeof(name), name, NULL);
+	cl_panic_on(err, "clGetKernelInfo", err);
+	if (best[0] != 0) {
+		printf("%s: local size %zux%zu", name, best[0], best[1]);
+	} else {
+		printf("%s: default local size", name);
+	}
+	printf("%s, work-group at most %zu, multiple of %zu, private %lu B per "
+	       "work-item, local %lu B per work-group\n",
+	       cached ? " (cached)" : "", usage.work_group_size,
+	       usage.preferred_multiple,
+	       (unsigned long)usage.private_mem_size,
+	       (unsigned long)usage.local_mem_size);
+}
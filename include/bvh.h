@@ -0,0 +1,287 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __clcpp__
+#include <common.h>
+#endif
+
+/* spheres num for which splitting is considered only if it is cheaper by SAH */
+#define BVH_LEAF_SIZE 4
+#define BVH_BINS 16
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECT_COST 1.0f
+
+typedef struct {
+	struct BVHNode *__nodes;
+	unsigned int __size;
+} bvh_t;
+
+struct __bvh_box {
+	float min[3];
+	float max[3];
+};
+
+struct __bvh_builder {
+	struct BVHNode *nodes;
+	unsigned int used;
+	unsigned int *index;
+	float (*centroid)[3];
+	struct __bvh_box *bounds;
+	unsigned int leaf_size;
+};
+
+static __always_inline void __bvh_box_init(struct __bvh_box *box)
+{
+	for (int a = 0; a < 3; ++a) {
+		box->min[a] = FLT_MAX;
+		box->max[a] = -FLT_MAX;
+	}
+}
+
+static __always_inline void __bvh_box_grow(struct __bvh_box *box,
+					   const struct __bvh_box *other)
+{
+	for (int a = 0; a < 3; ++a) {
+		if (other->min[a] < box->min[a]) {
+			box->min[a] = other->min[a];
+		}
+		if (other->max[a] > box->max[a]) {
+			box->max[a] = other->max[a];
+		}
+	}
+}
+
+static __always_inline float __bvh_box_area(const struct __bvh_box *box)
+{
+	float x = box->max[0] - box->min[0];
+	float y = box->max[1] - box->min[1];
+	float z = box->max[2] - box->min[2];
+
+	if (x < 0 || y < 0 || z < 0) {
+		return 0;
+	}
+	return 2 * (x * y + y * z + z * x);
+}
+
+static void __bvh_make_leaf(struct BVHNode *node, unsigned int first,
+			    unsigned int count)
+{
+	node->leftFirst = first;
+	node->count = count;
+}
+
+/**
+ * __bvh_split() finds best split of node spheres along longest axis of their
+ * centroid bounds using binned surface area heuristic
+ *
+ * @return position of first sphere of right child in builder index array or
+ * 	`first` if node should not be split
+ */
+static unsigned int __bvh_split(struct __bvh_builder *builder,
+				const struct __bvh_box *box, unsigned int first,
+				unsigned int count)
+{
+	struct __bvh_box centroids;
+	struct __bvh_box bins[BVH_BINS];
+	unsigned int bin_count[BVH_BINS] = { 0 };
+	float right_area[BVH_BINS];
+	unsigned int right_count[BVH_BINS];
+	struct __bvh_box acc;
+	float best_cost = FLT_MAX;
+	int best_bin = -1;
+	int axis = 0;
+
+	__bvh_box_init(&centroids);
+	for (unsigned int i = first; i < first + count; ++i) {
+		float *c = builder->centroid[builder->index[i]];
+		struct __bvh_box point = { { c[0], c[1], c[2] },
+					   { c[0], c[1], c[2] } };
+		__bvh_box_grow(&centroids, &point);
+	}
+	for (int a = 1; a < 3; ++a) {
+		if (centroids.max[a] - centroids.min[a] >
+		    centroids.max[axis] - centroids.min[axis]) {
+			axis = a;
+		}
+	}
+	float lo = centroids.min[axis];
+	float extent = centroids.max[axis] - lo;
+	if (extent <= 0) {
+		return first;
+	}
+
+	float scale = BVH_BINS / extent;
+	for (int b = 0; b < BVH_BINS; ++b) {
+		__bvh_box_init(&bins[b]);
+	}
+	for (unsigned int i = first; i < first + count; ++i) {
+		unsigned int id = builder->index[i];
+		int b = (int)((builder->centroid[id][axis] - lo) * scale);
+		b = b < BVH_BINS ? b : BVH_BINS - 1;
+
+		++bin_count[b];
+		__bvh_box_grow(&bins[b], &builder->bounds[id]);
+	}
+
+	__bvh_box_init(&acc);
+	unsigned int acc_count = 0;
+	for (int b = BVH_BINS - 1; b > 0; --b) {
+		__bvh_box_grow(&acc, &bins[b]);
+		acc_count += bin_count[b];
+		right_area[b] = __bvh_box_area(&acc);
+		right_count[b] = acc_count;
+	}
+
+	__bvh_box_init(&acc);
+	acc_count = 0;
+	for (int b = 0; b < BVH_BINS - 1; ++b) {
+		__bvh_box_grow(&acc, &bins[b]);
+		acc_count += bin_count[b];
+		if (acc_count == 0 || right_count[b + 1] == 0) {
+			continue;
+		}
+		float cost = __bvh_box_area(&acc) * acc_count +
+			     right_area[b + 1] * right_count[b + 1];
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_bin = b;
+		}
+	}
+	if (best_bin == -1) {
+		return first;
+	}
+
+	float leaf_cost = __bvh_box_area(box) * count * BVH_INTERSECT_COST;
+	best_cost = __bvh_box_area(box) * BVH_TRAVERSAL_COST +
+		    best_cost * BVH_INTERSECT_COST;
+	if (count <= builder->leaf_size && best_cost >= leaf_cost) {
+		return first;
+	}
+
+	unsigned int i = first;
+	unsigned int j = first + count;
+	while (i < j) {
+		unsigned int id = builder->index[i];
+		int b = (int)((builder->centroid[id][axis] - lo) * scale);
+		b = b < BVH_BINS ? b : BVH_BINS - 1;
+
+		if (b <= best_bin) {
+			++i;
+		} else {
+			builder->index[i] = builder->index[--j];
+			builder->index[j] = id;
+		}
+	}
+	return i;
+}
+
+static void __bvh_build(struct __bvh_builder *builder, unsigned int node_id,
+			unsigned int first, unsigned int count,
+			unsigned int depth)
+{
+	struct BVHNode *node = &builder->nodes[node_id];
+	struct __bvh_box box;
+	unsigned int split;
+
+	__bvh_box_init(&box);
+	for (unsigned int i = first; i < first + count; ++i) {
+		__bvh_box_grow(&box, &builder->bounds[builder->index[i]]);
+	}
+	node->boxMin = FLOAT3(box.min[0], box.min[1], box.min[2]);
+	node->boxMax = FLOAT3(box.max[0], box.max[1], box.max[2]);
+
+	if (count <= 1 || depth + 1 >= BVH_STACK_SIZE) {
+		__bvh_make_leaf(node, first, count);
+		return;
+	}
+	split = __bvh_split(builder, &box, first, count);
+	if (split == first) {
+		__bvh_make_leaf(node, first, count);
+		return;
+	}
+
+	unsigned int left = builder->used;
+	builder->used += 2;
+	node->leftFirst = left;
+	node->count = 0;
+	__bvh_build(builder, left, first, split - first, depth + 1);
+	__bvh_build(builder, left + 1, split, first + count - split,
+		    depth + 1);
+}
+
+/**
+ * create_bvh() builds bounding volume hierarchy over scene spheres using
+ * binned SAH. Spheres are reordered inplace, so spheres of every leaf are
+ * stored contiguously
+ *
+ * @param spheres scene spheres, reordered by the function
+ * @param spheres_num number of spheres in scene
+ * @param leaf_size maximum number of spheres in leaf for which SAH decides
+ * 	whether to split it
+ * @param order if not NULL, initial index of sphere moved to position i is
+ * 	stored to order[i]
+ * @return flattened hierarchy, root node has index 0
+ */
+static __must_check bvh_t create_bvh(struct Sphere *spheres,
+				     unsigned int spheres_num,
+				     unsigned int leaf_size,
+				     unsigned int *order)
+{
+	struct __bvh_builder builder;
+	struct Sphere *ordered;
+	unsigned int size = spheres_num > 0 ? spheres_num : 1;
+
+	builder.nodes = (struct BVHNode *)calloc(2 * size - 1,
+						 sizeof(struct BVHNode));
+	builder.index = (unsigned int *)malloc(size * sizeof(unsigned int));
+	builder.centroid = (float(*)[3])malloc(size * sizeof(float[3]));
+	builder.bounds = (struct __bvh_box *)malloc(size *
+						    sizeof(struct __bvh_box));
+	ordered = (struct Sphere *)malloc(size * sizeof(struct Sphere));
+	panic_on(builder.nodes == NULL || builder.index == NULL ||
+			 builder.centroid == NULL || builder.bounds == NULL ||
+			 ordered == NULL,
+		 "malloc");
+	builder.used = 1;
+	builder.leaf_size = leaf_size;
+
+	for (unsigned int i = 0; i < spheres_num; ++i) {
+		const float c[3] = { spheres[i].position.x,
+				     spheres[i].position.y,
+				     spheres[i].position.z };
+		float r = spheres[i].radius;
+
+		builder.index[i] = i;
+		for (int a = 0; a < 3; ++a) {
+			builder.centroid[i][a] = c[a];
+			builder.bounds[i].min[a] = c[a] - r;
+			builder.bounds[i].max[a] = c[a] + r;
+		}
+	}
+	__bvh_build(&builder, 0, 0, spheres_num, 0);
+
+	for (unsigned int i = 0; i < spheres_num; ++i) {
+		ordered[i] = spheres[builder.index[i]];
+	}
+	memcpy(spheres, ordered, spheres_num * sizeof(struct Sphere));
+	if (order != NULL) {
+		memcpy(order, builder.index, spheres_num * sizeof(unsigned int));
+	}
+
+	free(ordered);
+	free(builder.bounds);
+	free(builder.centroid);
+	free(builder.index);
+	return (bvh_t){ .__nodes = builder.nodes, .__size = builder.used };
+}
+
+static __always_inline void destroy_bvh(bvh_t bvh)
+{
+	free(bvh.__nodes);
+}
+
+#endif /* BVH_H */
@@ -142,13 +142,22 @@ static GLuint __create_ibo()
 	return ibo;
 }
 
+#define CLGL_MAX_TEXTURES 4
+
 typedef struct {
 	GLuint __program;
-	GLuint __texture;
+	GLuint __textures[CLGL_MAX_TEXTURES];
+	unsigned int __textures_num;
 	GLuint __vao;
 } shader_t;
 
-static __inline shader_t create_shader(unsigned int width, unsigned int height)
+/**
+ * create_shader() creates program drawing fullscreen quad and `textures`
+ * textures to draw on it, so kernel can write one texture while another is
+ * displayed
+ */
+static __inline shader_t create_shader(unsigned int width, unsigned int height,
+				       unsigned int textures)
 {
 	if (!gladLoadGL()) {
 		panic("gladLoadGL");
@@ -156,8 +165,10 @@ static __inline shader_t create_shader(unsigned int width, unsigned int height)
 	printf("OpenGL %d.%d\n", GLVersion.major, GLVersion.minor);
 
 	// opengl
+	panic_on(textures == 0 || textures > CLGL_MAX_TEXTURES,
+		 "invalid textures number");
+
 	GLuint program = __init_shaders();
-	GLuint texture = __create_texture(width, height);
 	GLuint vbo = __create_buffer(sizeof(vertices), vertices);
 	GLuint tbo = __create_buffer(sizeof(texcords), texcords);
 	GLuint ibo = __create_ibo();
@@ -178,16 +189,20 @@ static __inline shader_t create_shader(unsigned int width, unsigned int height)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 	glBindVertexArray(0);
 
-	return (shader_t){ .__program = program,
-			   .__texture = texture,
-			   .__vao = vao };
+	shader_t shader = { .__program = program,
+			    .__textures_num = textures,
+			    .__vao = vao };
+	for (unsigned int i = 0; i < textures; ++i) {
+		shader.__textures[i] = __create_texture(width, height);
+	}
+	return shader;
 }
 
 static inline buffer_t create_image(context_t context, shader_t shader,
-				      enum buffer_type type)
+				      unsigned int index, enum buffer_type type)
 {
 	cl_context ctx = context.__context;
-	GLuint texture = shader.__texture;
+	GLuint texture = shader.__textures[index];
 	cl_mem buffer;
 	cl_int err;
 
@@ -206,12 +221,77 @@ static inline context_t create_gl_context(device_t device, GLFWwindow *window)
 		CL_GLX_DISPLAY_KHR,
 		(cl_context_properties)glfwGetX11Display(),
 		CL_CONTEXT_PLATFORM,
-		(cl_context_properties)__create_platform(),
+		(cl_context_properties)device_platform(device),
 		0
 	};
 	return create_context_with_props(device, props);
 }
 
+typedef cl_event (*__gl_sync_event_fn)(cl_context context, cl_GLsync sync,
+					cl_int *errcode_ret);
+
+/**
+ * gl_sync_t orders OpenCL commands after OpenGL ones. With cl_khr_gl_event
+ * GL fence is turned into CL event, so only device waits for GL, otherwise
+ * host waits with glFinish()
+ */
+typedef struct {
+	cl_context __context;
+	__gl_sync_event_fn __sync_event;
+} gl_sync_t;
+
+static inline gl_sync_t create_gl_sync(device_t device, context_t context)
+{
+	gl_sync_t sync = { .__context = context.__context,
+			   .__sync_event = NULL };
+
+	if (device_has_extension(device, "cl_khr_gl_event")) {
+		sync.__sync_event = (__gl_sync_event_fn)
+			clGetExtensionFunctionAddressForPlatform(
+				device_platform(device),
+				"clCreateEventFromGLsyncKHR");
+	}
+	if (sync.__sync_event == NULL) {
+		warn("cl_khr_gl_event is not supported, using glFinish");
+	}
+	return sync;
+}
+
+/**
+ * gl_sync_fence() marks point after all GL commands issued so far
+ *
+ * @param fence GL fence which should be deleted by gl_sync_release() after
+ * 	returned event is complete
+ * @return event to wait on before using GL objects in OpenCL or NULL if host
+ * 	already waited for GL
+ */
+static inline cl_event gl_sync_fence(gl_sync_t *sync, GLsync *fence)
+{
+	cl_event event;
+	cl_int err;
+
+	*fence = NULL;
+	if (sync->__sync_event == NULL) {
+		glFinish();
+		return NULL;
+	}
+	*fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	event = sync->__sync_event(sync->__context, (cl_GLsync)*fence, &err);
+	cl_panic_on(err, "clCreateEventFromGLsyncKHR", err);
+	return event;
+}
+
+static inline void gl_sync_release(cl_event event, GLsync fence)
+{
+	if (event != NULL) {
+		clReleaseEvent(event);
+	}
+	if (fence != NULL) {
+		glDeleteSync(fence);
+	}
+}
+
 #if 0
 static inline context_t create_gl_context(device_t device)
 {
@@ -0,0 +1,34 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <cllib/cllib.h>
+
+#ifndef FLOAT3
+typedef cl_float3 float3;
+#define FLOAT3(X, Y, Z)(float3){ .x = X, .y = Y, .z = Z }
+#endif
+#include "source/struct.cl"
+
+/**
+ * denoiser_t runs kernels of source/denoise.cl, which filter accumulated image
+ * guided by pixel features runKernel() writes. Filter iterations ping-pong
+ * between two buffers it owns, result is left in one of them
+ */
+typedef struct {
+	kernel_t __init;
+	kernel_t __filter;
+
+	buffer_t __pixels[2];
+
+	unsigned int __iterations;
+} denoiser_t;
+
+denoiser_t create_denoiser(context_t context, kernel_t kernel,
+			   unsigned int width, unsigned int height,
+			   unsigned int iterations);
+void destroy_denoiser(denoiser_t *denoiser);
+void set_denoiser_args(denoiser_t *denoiser, buffer_t accum, buffer_t moments,
+		       buffer_t features);
+buffer_t run_denoiser(queue_t queue, denoiser_t *denoiser);
+
+#endif /* DENOISE_H */
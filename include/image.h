@@ -0,0 +1,19 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <common.h>
+
+enum image_format {
+	/* binary 8-bit rgb, colors are clamped to [0, 1] */
+	image_ppm,
+	/* binary 32-bit float rgb */
+	image_pfm,
+	/* uncompressed scanline OpenEXR with 32-bit float rgb channels */
+	image_exr,
+};
+
+bool image_format_from_path(const char *path, enum image_format *format);
+void write_image(const char *path, enum image_format format, const float *rgba,
+		 unsigned int width, unsigned int height);
+
+#endif /* IMAGE_H */
@@ -12,12 +12,16 @@
 void sincosf(float x, float *sin, float *cos);
 #define sincos sincosf
 
+#ifndef PI
 #define PI M_PI
+#endif
 
+#ifndef __clcpp__
 __always_inline float dot(float3 a, float3 b)
 {
 	return a.x * b.x + a.y * b.y + a.z * b.z;
 }
+#endif /* __clcpp__ */
 
 __always_inline float3 cross(float3 a, float3 b){
 	return FLOAT3(a.y * b.z - a.z * b.y,
@@ -25,6 +29,7 @@ __always_inline float3 cross(float3 a, float3 b){
 		      a.x * b.y - a.y * b.x);
 }
 
+#ifndef __clcpp__
 __always_inline float length(float3 vec)
 {
 	return sqrt(dot(vec, vec));
@@ -35,6 +40,12 @@ __always_inline float3 normalize(float3 vec)
 	float l = 1 / length(vec);
 	return FLOAT3(vec.x * l, vec.y * l, vec.z * l);
 }
+#endif /* __clcpp__ */
+
+__always_inline bool vec_equal(const float3 a, const float3 b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
 
 __always_inline void vec_iadd(float3 *vector, const float3 add)
 {
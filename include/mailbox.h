@@ -0,0 +1,34 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include <common.h>
+
+/**
+ * mailbox_t passes snapshots of state from one writer thread to one reader
+ * thread without locks. It is triple buffer: writer fills its own slot and
+ * swaps it with shared one, reader takes shared slot in exchange for its own
+ * one only if it holds newer snapshot. Neither thread ever waits for other
+ * and reader always sees the latest complete snapshot
+ */
+typedef struct {
+	char *__slots;
+	size_t __size;
+
+	/* slot owned by writer */
+	unsigned int __write;
+	/* slot owned by reader */
+	unsigned int __read;
+	/* slot owned by nobody, MAILBOX_FRESH is set until reader takes it */
+	atomic_uint __shared;
+} mailbox_t;
+
+mailbox_t create_mailbox(size_t size);
+void destroy_mailbox(mailbox_t *mailbox);
+void *mailbox_slot(mailbox_t *mailbox);
+void mailbox_publish(mailbox_t *mailbox);
+const void *mailbox_latest(mailbox_t *mailbox);
+
+#endif /* MAILBOX_H */
@@ -0,0 +1,42 @@
+#ifndef REPROJECT_H
+#define REPROJECT_H
+
+#include <cllib/cllib.h>
+
+#ifndef FLOAT3
+typedef cl_float3 float3;
+#define FLOAT3(X, Y, Z)(float3){ .x = X, .y = Y, .z = Z }
+#endif
+#include "source/struct.cl"
+
+/**
+ * reprojection_t runs reprojectKernel() of source/reproject.cl, which keeps
+ * accumulated samples when camera moves. It owns copies of accumulation
+ * buffer, moments and pixel features made before the move
+ */
+typedef struct {
+	kernel_t __reproject;
+
+	buffer_t __accum;
+	buffer_t __moments;
+	buffer_t __features;
+
+	buffer_t __history;
+	buffer_t __history_moments;
+	buffer_t __history_features;
+
+	size_t __pixels;
+} reprojection_t;
+
+reprojection_t create_reprojection(context_t context, kernel_t kernel,
+				   unsigned int width, unsigned int height);
+void destroy_reprojection(reprojection_t *reprojection);
+void set_reprojection_args(reprojection_t *reprojection, buffer_t accum,
+			   buffer_t moments, buffer_t features);
+void save_reprojection_history(queue_t queue, reprojection_t *reprojection,
+			       float3 prev_position,
+			       struct RotateMatrix prev_matrix,
+			       float3 position, struct RotateMatrix matrix);
+void run_reprojection(queue_t queue, reprojection_t *reprojection);
+
+#endif /* REPROJECT_H */
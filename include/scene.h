@@ -0,0 +1,89 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cllib/cllib.h>
+
+#ifndef FLOAT3
+typedef cl_float3 float3;
+#define FLOAT3(X, Y, Z)(float3){ .x = X, .y = Y, .z = Z }
+#endif
+#include "source/struct.cl"
+
+/* range of host array elements changed by edit, not uploaded yet */
+struct __scene_range {
+	unsigned int first;
+	unsigned int count;
+};
+
+struct __scene_dirty {
+	struct __scene_range *ranges;
+	unsigned int size;
+	unsigned int capacity;
+};
+
+/**
+ * scene_t keeps scene spheres and their bvh both on host and device. Spheres
+ * are stored in bvh order, sphere ids returned by scene_add_sphere() stay valid
+ * until sphere is removed. Edits upload only modified spheres and nodes, device
+ * buffers are grown when needed, so kernel rebuild is never required. Slots of
+ * emissive spheres are kept in light list, which kernels sample directly.
+ * Changes of edit are copied to staging memory and written without waiting,
+ * so edit never waits for frames already enqueued to scene queue
+ */
+typedef struct {
+	context_t __context;
+	/* NULL if scene buffers are not pooled */
+	pool_t *__pool;
+	queue_t __queue;
+
+	struct Sphere *__spheres;
+	unsigned int *__slot_id;
+	unsigned int *__leaf;
+	unsigned int __size;
+	unsigned int __capacity;
+	unsigned int __alive;
+
+	unsigned int *__id_slot;
+	unsigned int __ids;
+	unsigned int __ids_capacity;
+
+	struct BVHNode *__nodes;
+	int *__parent;
+	unsigned int __nodes_size;
+	unsigned int __nodes_capacity;
+
+	unsigned int *__lights;
+	/* place of slot in light list, SCENE_NO_SPHERE if slot is not light */
+	unsigned int *__light_of;
+	unsigned int __lights_size;
+	unsigned int __lights_capacity;
+
+	buffer_t __spheres_buffer;
+	buffer_t __nodes_buffer;
+	buffer_t __lights_buffer;
+
+	struct __scene_dirty __dirty_spheres;
+	struct __scene_dirty __dirty_nodes;
+	struct __scene_dirty __dirty_lights;
+} scene_t;
+
+#define SCENE_NO_SPHERE ((unsigned int)-1)
+
+/* sun direction of demo scene, kernels are built with it */
+#define SUN_DIRECTION normalize(FLOAT3(-1, 0.5, -0.3))
+
+scene_t create_scene(context_t context, queue_t queue, unsigned int capacity);
+scene_t create_pooled_scene(pool_t *pool, queue_t queue,
+			    unsigned int capacity);
+void destroy_scene(scene_t *scene);
+unsigned int scene_add_sphere(scene_t *scene, struct Sphere sphere);
+void scene_update_sphere(scene_t *scene, unsigned int id, struct Sphere sphere);
+void scene_remove_sphere(scene_t *scene, unsigned int id);
+void scene_rebuild(scene_t *scene);
+void scene_add_demo(scene_t *scene);
+void set_scene_args(kernel_t *kernel, scene_t *scene, unsigned int spheres_pos,
+		    unsigned int nodes_pos, unsigned int num_pos);
+void set_scene_light_args(kernel_t *kernel, scene_t *scene,
+			  unsigned int lights_pos, unsigned int num_pos);
+
+#endif /* SCENE_H */
@@ -0,0 +1,68 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include <cllib/cllib.h>
+#include <scene.h>
+
+/* most devices frame is split across */
+#define SPLIT_MAX_DEVICES 8
+
+/**
+ * split_device is one of devices frame is split across. It traces its band of
+ * rows into its own accumulation buffer, samples of every pixel are kept by
+ * device which traces the pixel
+ */
+struct split_device {
+	device_t device;
+	context_t context;
+	queue_t queue;
+	kernel_t kernel;
+	kernel_t error;
+	scene_t scene;
+
+	buffer_t accum;
+	buffer_t moments;
+	buffer_t mask;
+
+	/* band is granules [start, end) */
+	unsigned int start;
+	unsigned int end;
+	/* granules traced per millisecond, averaged over frames */
+	double speed;
+};
+
+/**
+ * split_t splits every frame of runKernel() into bands of rows, a band per
+ * device. Bands are resized every frame from measured device times, so all
+ * devices finish at about the same time. Rows which change device carry their
+ * accumulated samples with them. Band sizes are multiples of adaptive tile
+ * rows, so tile mask is split the same way
+ */
+typedef struct {
+	struct split_device *__devices;
+	unsigned int __count;
+
+	unsigned int __width;
+	unsigned int __height;
+	unsigned int __granules;
+	unsigned int __tiles_x;
+
+	/* host copies of buffers, rows move between devices through them */
+	cl_float4 *__accum;
+	cl_float *__moments;
+	char *__tiles;
+} split_t;
+
+split_t create_split(const device_t *devices, unsigned int count,
+		     unsigned int width, unsigned int height,
+		     const char *source, const char *options,
+		     void (*fill_scene)(scene_t *scene));
+void destroy_split(split_t *split);
+void set_split_args(split_t *split, float3 position, struct RotateMatrix matrix,
+		    cl_uint max_depth, float error);
+void run_split(split_t *split, cl_uint frame);
+unsigned int update_split_mask(split_t *split);
+const cl_float4 *gather_split(split_t *split);
+void split_dump(split_t *split, FILE *file);
+
+#endif /* SPLIT_H */
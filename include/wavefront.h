@@ -0,0 +1,43 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <cllib/cllib.h>
+#include <scene.h>
+
+/**
+ * wavefront_t runs kernels of source/wavefront.cl, which trace paths stage by
+ * stage instead of whole path per work-item as runKernel() does. It owns path
+ * pool and queues, result is added to accumulation buffer the same way
+ * runKernel() adds it
+ */
+typedef struct {
+	kernel_t __generate;
+	kernel_t __extend;
+	kernel_t __shade;
+	kernel_t __miss;
+	kernel_t __accumulate;
+
+	buffer_t __paths;
+	buffer_t __counters;
+	buffer_t __ray_queue;
+	buffer_t __hit_queue;
+	buffer_t __miss_queue;
+
+	unsigned int __rays_per_pixel;
+	unsigned int __max_depth;
+	cl_uint *__zero_counters;
+} wavefront_t;
+
+wavefront_t create_wavefront(context_t context, kernel_t kernel,
+			     unsigned int width, unsigned int height,
+			     unsigned int rays_per_pixel,
+			     unsigned int max_depth);
+void destroy_wavefront(wavefront_t *wavefront);
+void set_wavefront_args(wavefront_t *wavefront, scene_t *scene,
+			buffer_t accum, buffer_t moments, buffer_t tile_mask);
+void set_wavefront_camera(wavefront_t *wavefront, float3 position,
+			  struct RotateMatrix matrix);
+void run_wavefront(queue_t queue, wavefront_t *wavefront, cl_uint frame,
+		   bool reset);
+
+#endif /* WAVEFRONT_H */
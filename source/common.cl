@@ -39,7 +39,12 @@
 
 # include <struct.cl>
 
-typedef __constant const struct Sphere sphere_t;
+# ifdef __clcpp__
+#  include <packet.hpp>
+# endif /* __clcpp__ */
+
+typedef __global const struct Sphere sphere_t;
+typedef __global const struct BVHNode bvh_node_t;
 
 __always_inline __must_check float square(float x)
 {
@@ -0,0 +1,183 @@
+#ifndef DENOISE_CL
+#define DENOISE_CL
+
+#include <path_tracer.cl>
+
+EXTERN_C
+
+/*
+ * Denoiser is edge-avoiding a-trous wavelet filter of Dammertz et al.,
+ * "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination
+ * Filtering", HPG 2010, with luminance weight guided by variance as in SVGF
+ * of Schied et al., HPG 2017. Pixel is filtered with 5x5 B3 spline kernel,
+ * taps of iteration i are 2^i pixels apart, so a few iterations cover large
+ * footprint. Tap weight drops when its normal, depth, albedo or luminance
+ * differ from pixel ones, so edges and already converged pixels are kept:
+ *
+ *   denoiseInitKernel  estimates variance of accumulated pixel luminance
+ *   denoiseKernel      filters color and its variance once
+ *
+ * Color is stored in xyz and variance of its luminance in w of filtered
+ * pixels
+ */
+
+/* dot of tap and pixel normals is raised to it */
+#define DENOISE_SIGMA_NORMAL 128.0f
+/* depth difference relative to depth and tap distance in pixels */
+#define DENOISE_SIGMA_DEPTH 0.1f
+#define DENOISE_SIGMA_ALBEDO 0.1f
+/* luminance difference in standard deviations of pixel luminance */
+#define DENOISE_SIGMA_LUMINANCE 4.0f
+/* variance of pixel with fewer samples is estimated from its neighbours */
+#define DENOISE_MIN_HISTORY 4
+
+__always_inline float3 pixelColor(float4 pixel)
+{
+	return FLOAT3(pixel.x, pixel.y, pixel.z);
+}
+
+/**
+ * featureWeight() returns how much tap may contribute to pixel judging by
+ * their geometry, 1 for the same surface and close to 0 across edges
+ *
+ * @param pixel features of filtered pixel
+ * @param tap features of tap
+ * @param distance distance between pixel and tap in pixels
+ */
+__always_inline float featureWeight(const struct PixelFeatures *pixel,
+				    const struct PixelFeatures *tap,
+				    float distance)
+{
+	float3 albedo = pixel->albedo - tap->albedo;
+	float normal = pow(fmax(dot(pixel->normal, tap->normal), 0.0f),
+			   DENOISE_SIGMA_NORMAL);
+	float depth = fabs(pixel->depth - tap->depth) /
+		      (DENOISE_SIGMA_DEPTH * pixel->depth * distance + EPS);
+
+	return normal * exp(-depth - dot(albedo, albedo) /
+					     square(DENOISE_SIGMA_ALBEDO));
+}
+
+/**
+ * denoiseInitKernel() copies accumulated color to output and stores variance
+ * of its luminance in w. Variance comes from second moments of pixel, if it
+ * has DENOISE_MIN_HISTORY samples, otherwise it is spread of luminance of
+ * 5x5 neighbours on the same surface
+ */
+__kernel void denoiseInitKernel(__global const float4 *accum,
+				__global const float *moments,
+				__global const struct PixelFeatures *features,
+				__global float4 *output)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int i = y * SCREEN_WIDTH + x;
+	const struct PixelFeatures center = features[i];
+	float4 pixel = accum[i];
+	float mean = luminance(pixelColor(pixel));
+	float variance;
+
+	if (pixel.w >= DENOISE_MIN_HISTORY) {
+		variance = fmax(moments[i] - mean * mean, 0.0f) / pixel.w;
+	} else {
+		float sum = 0;
+		float sum2 = 0;
+		float weights = 0;
+
+		for (int dy = -2; dy <= 2; ++dy) {
+			for (int dx = -2; dx <= 2; ++dx) {
+				int tx = min(max(x + dx, 0), SCREEN_WIDTH - 1);
+				int ty = min(max(y + dy, 0), SCREEN_HEIGHT - 1);
+				int j = ty * SCREEN_WIDTH + tx;
+				const struct PixelFeatures tap = features[j];
+				float l = luminance(pixelColor(accum[j]));
+				float w = j == i ? 1 :
+					  featureWeight(&center, &tap,
+							sqrt((float)(dx * dx +
+								     dy * dy)));
+
+				sum += w * l;
+				sum2 += w * l * l;
+				weights += w;
+			}
+		}
+		sum /= weights;
+		variance = fmax(sum2 / weights - sum * sum, 0.0f);
+	}
+	output[i] = FLOAT4(pixel.x, pixel.y, pixel.z, variance);
+}
+
+/**
+ * denoiseKernel() runs filter iteration, whose taps are step pixels apart.
+ * Variance of filtered luminance is propagated, so next iterations trust
+ * filtered pixels more
+ *
+ * @param input pixels filtered by previous iteration or denoiseInitKernel()
+ * @param output filtered pixels, must not be input
+ * @param features pixel features
+ * @param step distance between taps, 2^i for iteration i
+ */
+__kernel void denoiseKernel(__global const float4 *input,
+			    __global float4 *output,
+			    __global const struct PixelFeatures *features,
+			    int step)
+{
+	const float spline[3] = { 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int i = y * SCREEN_WIDTH + x;
+	const struct PixelFeatures center = features[i];
+	float4 pixel = input[i];
+	float3 color = pixelColor(pixel);
+	float l = luminance(color);
+	float deviation = 0;
+	float weights = square(spline[0]);
+	float variance = square(weights) * pixel.w;
+
+	// variance of luminance is prefiltered, so single outlier is not kept
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			int tx = min(max(x + dx, 0), SCREEN_WIDTH - 1);
+			int ty = min(max(y + dy, 0), SCREEN_HEIGHT - 1);
+
+			deviation += input[ty * SCREEN_WIDTH + tx].w /
+				     (4 << (abs(dx) + abs(dy)));
+		}
+	}
+	deviation = DENOISE_SIGMA_LUMINANCE * sqrt(deviation) + EPS;
+
+	color = color * weights;
+	for (int dy = -2; dy <= 2; ++dy) {
+		for (int dx = -2; dx <= 2; ++dx) {
+			int tx = x + dx * step;
+			int ty = y + dy * step;
+
+			if ((dx == 0 && dy == 0) || tx < 0 ||
+			    tx >= SCREEN_WIDTH || ty < 0 ||
+			    ty >= SCREEN_HEIGHT) {
+				continue;
+			}
+
+			int j = ty * SCREEN_WIDTH + tx;
+			const struct PixelFeatures tap = features[j];
+			float4 q = input[j];
+			float distance = step * sqrt((float)(dx * dx +
+							     dy * dy));
+			float w = spline[abs(dx)] * spline[abs(dy)] *
+				  featureWeight(&center, &tap, distance) *
+				  exp(-fabs(l - luminance(pixelColor(q))) /
+				      deviation);
+
+			color += pixelColor(q) * w;
+			variance += square(w) * q.w;
+			weights += w;
+		}
+	}
+	color *= 1 / weights;
+	output[i] = FLOAT4(color.x, color.y, color.z,
+			   variance / square(weights));
+}
+
+EXTERN_C_END
+
+#endif /* DENOISE_CL */
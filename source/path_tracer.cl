@@ -7,7 +7,41 @@
 
 EXTERN_C
 
-#define TRACE_BOUNCE_COUNT 5
+#define ADAPTIVE_TILES_X \
+	((SCREEN_WIDTH + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE)
+#define PERSISTENT_TILES_X \
+	((SCREEN_WIDTH + PERSISTENT_TILE_SIZE - 1) / PERSISTENT_TILE_SIZE)
+#define PERSISTENT_TILES_Y \
+	((SCREEN_HEIGHT + PERSISTENT_TILE_SIZE - 1) / PERSISTENT_TILE_SIZE)
+/* luminance added to mean, so noise of almost black pixels is not amplified */
+#define ADAPTIVE_ERROR_FLOOR 0.05f
+/*
+ * sun shines from directions within cone around SUN_DIRECTION. Lobe of sun
+ * falls to 5% of SUN_MAX_RADIANCE at cone border, so every sun sample of
+ * sampleLights() carries light, 1% of sun power lies outside and is dropped
+ */
+#define SUN_CONE_COS 0.94f
+/*
+ * sun lobe is clamped to it alone, sky is added unclamped, so sun disc is
+ * brighter than SUN_MAX_RADIANCE by sky behind it
+ */
+#define SUN_MAX_RADIANCE 4.0f
+/* bounces every path makes before russian roulette may terminate it */
+#define ROULETTE_MIN_DEPTH 3
+/* survival probability cap, so paths of white mirrors are terminated too */
+#define ROULETTE_MAX_SURVIVAL 0.95f
+
+/**
+ * Scene groups kernel arguments describing scene geometry and its lights.
+ * lights are indices of emissive spheres
+ */
+struct Scene {
+	sphere_t *spheres;
+	bvh_node_t *nodes;
+	unsigned int spheresNum;
+	__global const unsigned int *lights;
+	unsigned int lightsNum;
+};
 
 /**
  * rotateVector() function applies rotation to vector using precomputed rotation
@@ -49,13 +83,92 @@ __always_inline void setPixelColor(__write_only image2d_t canvas,
 	write_imagef(canvas, coords, fcolor);
 }
 
-__always_inline float3 getPixelColor(__read_only image2d_t canvas,
-				     unsigned short x, unsigned short y)
+__always_inline float luminance(float3 color)
 {
-	int2 coords = INT2(x, SCREEN_HEIGHT - y - 1);
-	float4 fcolor = read_imagef(canvas, coords);
+	return dot(color, FLOAT3(0.2126f, 0.7152f, 0.0722f));
+}
 
-	return FLOAT3(fcolor.x, fcolor.y, fcolor.z);
+/**
+ * accumulateColor() adds pixel color sample to running mean of pixel colors
+ * stored in accumulation buffer. Number of accumulated samples is kept in w
+ * component of pixel. Running mean of squared sample luminance is kept in
+ * moments buffer, so variance of pixel can be estimated
+ *
+ * @param accum accumulation buffer with a pixel per work-item
+ * @param moments second moments of pixels luminance
+ * @param x coordinate in accumulation buffer
+ * @param y coordinate in accumulation buffer
+ * @param color new color sample
+ * @param reset if true, accumulated mean is dropped and replaced with sample
+ */
+__always_inline void accumulateColor(__global float4 *accum,
+				     __global float *moments, unsigned short x,
+				     unsigned short y, float3 color,
+				     bool reset)
+{
+	__global float4 *pixel = &accum[y * SCREEN_WIDTH + x];
+	__global float *moment = &moments[y * SCREEN_WIDTH + x];
+	float4 prev = *pixel;
+	float count = reset ? 0 : prev.w;
+	float l2 = square(luminance(color));
+
+	if (count > 0) {
+		float ratio = (float)1.0 / (count + 1);
+		float3 mean = FLOAT3(prev.x, prev.y, prev.z);
+
+		color = mean * (1 - ratio) + color * ratio;
+		l2 = *moment * (1 - ratio) + l2 * ratio;
+	}
+	*pixel = FLOAT4(color.x, color.y, color.z, count + 1);
+	*moment = l2;
+}
+
+/**
+ * accumulateFeatures() adds features of pixel sample to running mean of pixel
+ * features, weighted as accumulateColor() weights colors. It must be called
+ * before accumulateColor() updates number of samples of pixel
+ *
+ * @param features buffer of pixel features
+ * @param accum accumulation buffer, number of pixel samples is read from it
+ * @param sample features of new sample
+ * @param reset if true, accumulated mean is dropped and replaced with sample
+ */
+__always_inline void accumulateFeatures(__global struct PixelFeatures *features,
+					__global const float4 *accum,
+					unsigned short x, unsigned short y,
+					struct PixelFeatures sample, bool reset)
+{
+	__global struct PixelFeatures *pixel = &features[y * SCREEN_WIDTH + x];
+	float count = reset ? 0 : accum[y * SCREEN_WIDTH + x].w;
+
+	if (count > 0) {
+		float ratio = (float)1.0 / (count + 1);
+
+		sample.normal = pixel->normal * (1 - ratio) +
+				sample.normal * ratio;
+		sample.albedo = pixel->albedo * (1 - ratio) +
+				sample.albedo * ratio;
+		sample.depth = pixel->depth * (1 - ratio) +
+			       sample.depth * ratio;
+	}
+	*pixel = sample;
+}
+
+/**
+ * pixelError() estimates relative standard error of accumulated pixel
+ * luminance from its sample variance
+ */
+__always_inline float pixelError(float4 pixel, float moment)
+{
+	float count = pixel.w;
+	float mean = luminance(FLOAT3(pixel.x, pixel.y, pixel.z));
+	float variance;
+
+	if (count < 2) {
+		return 1e30f;
+	}
+	variance = fmax(moment - mean * mean, 0.0f) * count / (count - 1);
+	return sqrt(variance / count) / (mean + ADAPTIVE_ERROR_FLOOR);
 }
 
 /**
@@ -64,10 +177,10 @@ __always_inline float3 getPixelColor(__read_only image2d_t canvas,
  * directed to (0, 0, 1) direction.
  *
  * @param ray place where to store resulted ray
- * @param x position of pixel on the screen
- * @param y position of pixel on the screen
+ * @param x position on the screen, pixel x covers [x, x + 1)
+ * @param y position on the screen, pixel y covers [y, y + 1)
  */
-void createViewVector(struct Ray *__restrict ray, short x, short y,
+void createViewVector(struct Ray *__restrict ray, float x, float y,
 		      float3 position,
 		      const struct RotateMatrix *__restrict matrix)
 {
@@ -125,42 +238,184 @@ bool intersectSphere(float *__restrict hitDistance,
 }
 
 /**
- * intersectAllSpheres() finds closest intersection to spheres in scene with ray
+ * intersectBox() computes distance to bounding box of bvh node using slab test
  *
+ * @param ray the ray with which the intersection is calculated
+ * @param invDir componentwise inverted direction of the ray
+ * @param node bvh node which box is tested
+ * @param maxDistance boxes further then this distance are treated as missed
+ * @return distance to the box or INFINITY if box is missed
+ */
+__always_inline float intersectBox(const struct Ray *__restrict ray,
+				   float3 invDir, bvh_node_t *__restrict node,
+				   float maxDistance)
+{
+	float tx1 = (node->boxMin.x - ray->origin.x) * invDir.x;
+	float tx2 = (node->boxMax.x - ray->origin.x) * invDir.x;
+	float ty1 = (node->boxMin.y - ray->origin.y) * invDir.y;
+	float ty2 = (node->boxMax.y - ray->origin.y) * invDir.y;
+	float tz1 = (node->boxMin.z - ray->origin.z) * invDir.z;
+	float tz2 = (node->boxMax.z - ray->origin.z) * invDir.z;
+
+	float tmin = max(max(min(tx1, tx2), min(ty1, ty2)), min(tz1, tz2));
+	float tmax = min(min(max(tx1, tx2), max(ty1, ty2)), max(tz1, tz2));
+
+	if (tmax >= tmin && tmax > 0 && tmin < maxDistance) {
+		return tmin;
+	}
+	return INFINITY;
+}
+
+/**
+ * intersectLeaf() finds closest intersection of ray with spheres of bvh leaf
+ *
+ * @param closestHit distance to closest hit found so far, updated inplace
+ * @param closestHitId index of closest sphere, updated inplace
  * @param viewVector the ray with which the intersection is calculated
- * @param hitInfo place where resulter hit info is stored
- * @param spheres array of inspecting spheres
+ * @param spheres array of scene spheres
+ * @param node leaf node
  */
-void intersectAllSpheres(const struct Ray *__restrict viewVector,
-			 struct HitInfo *__restrict hitInfo,
-			 sphere_t *__restrict spheres)
+__always_inline void intersectLeaf(float *__restrict closestHit,
+				   int *__restrict closestHitId,
+				   const struct Ray *__restrict viewVector,
+				   sphere_t *__restrict spheres,
+				   bvh_node_t *__restrict node)
 {
-	float closestHit = INFINITY;
+#if defined(__clcpp__) && CLCPP_PACKET_WIDTH > 1
+	int id = intersectSpheresPacket<CLCPP_PACKET_WIDTH>(
+		closestHit, viewVector, spheres, node->leftFirst, node->count);
+	if (id != -1) {
+		*closestHitId = id;
+	}
+#else
 	float hitDistance;
-	int closestHitId = -1;
-	sphere_t *closestSphere;
 
-	for (int i = 0; i < SPHERES_NUM; ++i) {
+	for (int i = node->leftFirst; i < node->leftFirst + node->count; ++i) {
 		if (intersectSphere(&hitDistance, viewVector, &spheres[i])) {
-			if (hitDistance < closestHit) {
-				closestHit = hitDistance;
-				closestHitId = i;
+			if (hitDistance < *closestHit) {
+				*closestHit = hitDistance;
+				*closestHitId = i;
 			}
 		}
 	}
-	if (closestHitId == -1) {
-		hitInfo->didHit = false;
-		return;
+#endif /* CLCPP_PACKET_WIDTH */
+}
+
+/**
+ * closestSphere() finds closest intersection to spheres in scene with ray
+ * traversing bounding volume hierarchy of the scene. Closer child is visited
+ * first, further one is saved to fixed size stack
+ *
+ * @param viewVector the ray with which the intersection is calculated
+ * @param hitDistance place where distance to closest sphere is stored
+ * @param scene scene spheres and their bvh, root is stored in nodes[0]
+ * @return index of closest sphere or -1 if ray hits nothing
+ */
+int closestSphere(const struct Ray *__restrict viewVector,
+		  float *__restrict hitDistance,
+		  const struct Scene *__restrict scene)
+{
+	sphere_t *spheres = scene->spheres;
+	bvh_node_t *nodes = scene->nodes;
+	float closestHit = INFINITY;
+	int closestHitId = -1;
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeId = 0;
+	float3 invDir = FLOAT3(1 / viewVector->direction.x,
+			       1 / viewVector->direction.y,
+			       1 / viewVector->direction.z);
+
+	if (scene->spheresNum == 0 ||
+	    intersectBox(viewVector, invDir, &nodes[0], closestHit) ==
+		    INFINITY) {
+		return -1;
 	}
-	closestSphere = &spheres[closestHitId];
+	for (;;) {
+		bvh_node_t *node = &nodes[nodeId];
+
+		if (node->count > 0) {
+			intersectLeaf(&closestHit, &closestHitId, viewVector,
+				      spheres, node);
+			if (stackSize == 0) {
+				break;
+			}
+			nodeId = stack[--stackSize];
+			continue;
+		}
+
+		int near = node->leftFirst;
+		int far = node->leftFirst + 1;
+		float nearDistance = intersectBox(viewVector, invDir,
+						  &nodes[near], closestHit);
+		float farDistance = intersectBox(viewVector, invDir,
+						 &nodes[far], closestHit);
+		if (farDistance < nearDistance) {
+			int tmpId = near;
+			float tmpDistance = nearDistance;
+
+			near = far;
+			far = tmpId;
+			nearDistance = farDistance;
+			farDistance = tmpDistance;
+		}
+		if (nearDistance == INFINITY) {
+			if (stackSize == 0) {
+				break;
+			}
+			nodeId = stack[--stackSize];
+			continue;
+		}
+		nodeId = near;
+		if (farDistance != INFINITY) {
+			stack[stackSize++] = far;
+		}
+	}
+
+	*hitDistance = closestHit;
+	return closestHitId;
+}
+
+/**
+ * setHitInfo() fills hit info of ray which hits sphere at given distance
+ */
+__always_inline void setHitInfo(struct HitInfo *__restrict hitInfo,
+				const struct Ray *__restrict viewVector,
+				sphere_t *__restrict sphere, float hitDistance)
+{
 	hitInfo->didHit = true;
-	hitInfo->hitColor = closestSphere->color;
+	hitInfo->hitColor = sphere->color;
 	hitInfo->hitPoint =
-		viewVector->origin + viewVector->direction * closestHit;
-	hitInfo->normal = hitInfo->hitPoint - closestSphere->position;
+		viewVector->origin + viewVector->direction * hitDistance;
+	hitInfo->normal = hitInfo->hitPoint - sphere->position;
 	hitInfo->normal = normalize(hitInfo->normal); // ! divide by radius
-	hitInfo->emissionStrength = closestSphere->emissionStrength;
-	hitInfo->reflective = closestSphere->reflective;
+	hitInfo->emissionStrength = sphere->emissionStrength;
+	hitInfo->reflective = sphere->reflective;
+	hitInfo->specular = sphere->specular;
+}
+
+/**
+ * intersectAllSpheres() finds closest intersection to spheres in scene with ray
+ *
+ * @param viewVector the ray with which the intersection is calculated
+ * @param hitInfo place where resulter hit info is stored
+ * @param scene scene spheres and their bvh, root is stored in nodes[0]
+ * @return index of hit sphere or -1 if ray hits nothing
+ */
+int intersectAllSpheres(const struct Ray *__restrict viewVector,
+			struct HitInfo *__restrict hitInfo,
+			const struct Scene *__restrict scene)
+{
+	float hitDistance;
+	int id = closestSphere(viewVector, &hitDistance, scene);
+
+	if (id == -1) {
+		hitInfo->didHit = false;
+		return -1;
+	}
+	setHitInfo(hitInfo, viewVector, &scene->spheres[id], hitDistance);
+	return id;
 }
 
 float3 skyBoxColor(struct Ray *__restrict viewVector)
@@ -190,94 +445,416 @@ float3 skyBoxColor(struct Ray *__restrict viewVector)
 	return lerp(beg, end, y);
 }
 
-float3 sunLight(struct Ray *__restrict viewVector)
+/**
+ * sunLight() returns light of sun coming from direction. Sun is bright narrow
+ * lobe, which is cut to SUN_CONE_COS cone, so it can be sampled directly
+ */
+float3 sunLight(float3 direction)
 {
-	float sunPower = dot(SUN_DIRECTION, viewVector->direction);
-	float3 sun;
-	if (sunPower < 0) {
-		sun = BLACK;
-	} else {
-		sun = sunPower * WHITE;
-		sun = pow(sun, 100) * 1e2f;
+	float sunPower = dot(SUN_DIRECTION, direction);
+
+	if (sunPower < SUN_CONE_COS) {
+		return BLACK;
+	}
+	return WHITE * fmin(pow(sunPower, 100.0f) * 1e2f, SUN_MAX_RADIANCE);
+}
+
+/**
+ * powerHeuristic() returns multiple importance sampling weight of sample taken
+ * with density pdf, when otherPdf is density of other technique for the same
+ * sample
+ */
+__always_inline float powerHeuristic(float pdf, float otherPdf)
+{
+	float pdf2 = square(pdf);
+
+	return pdf2 / (pdf2 + square(otherPdf));
+}
+
+/**
+ * environmentLight() returns light coming to ray which leaves the scene. Sun
+ * is sampled by sampleLights() too, so its light is weighted against it,
+ * unless ray direction was not sampled from material
+ *
+ * @param lastPdf density ray direction was sampled with, 0 for camera and
+ * 	mirror rays
+ */
+__always_inline float3 environmentLight(struct Ray *__restrict viewVector,
+					float lastPdf)
+{
+	float3 sun = sunLight(viewVector->direction);
+	float3 sky = skyBoxColor(viewVector);
+
+	if (lastPdf > 0) {
+		sun *= powerHeuristic(lastPdf, conePdf(SUN_CONE_COS));
+	}
+	// sky is not clamped with sun, sampleLights() sees sun without sky
+	return sun + sky;
+}
+
+/**
+ * sphereConeCos() returns cosine of half-angle of cone sphere is seen in from
+ * point
+ */
+__always_inline float sphereConeCos(float3 point, sphere_t *__restrict sphere)
+{
+	float3 toCenter = sphere->position - point;
+	float sin2 = square(sphere->radius) / dot(toCenter, toCenter);
+
+	return sqrt(fmax(1 - sin2, 0.0f));
+}
+
+/**
+ * sphereLightPdf() returns density sampleLights() samples direction from point
+ * to emissive sphere with, probability to choose the sphere included
+ */
+__always_inline float sphereLightPdf(float3 point, sphere_t *__restrict sphere,
+				     unsigned int lightsNum)
+{
+	float cosMax = sphereConeCos(point, sphere);
+
+	if (lightsNum == 0 || cosMax >= 1) {
+		return 0;
 	}
+	return conePdf(cosMax) / lightsNum;
+}
 
-	return sun;
+/**
+ * glossyAlpha() returns GGX roughness of glossy lobe of surface, the more
+ * reflective surface is the narrower is the lobe
+ */
+__always_inline float glossyAlpha(const struct HitInfo *__restrict hitInfo)
+{
+	return fmax(square(1 - hitInfo->reflective), 1e-3f);
+}
+
+/**
+ * sampleMaterial() samples direction of non-mirror bounce. Material is mixture
+ * of diffuse lobe around normal and glossy GGX lobe around mirror direction,
+ * weighted by reflective
+ *
+ * @param hitInfo the surface hit
+ * @param specularDir mirror direction of incoming ray
+ * @param rng random stream of path
+ * @return direction with density materialPdf()
+ */
+__always_inline float3 sampleMaterial(const struct HitInfo *__restrict hitInfo,
+				      float3 specularDir,
+				      struct RandomState *__restrict rng)
+{
+	if (nextRandomFloat(rng) < hitInfo->reflective) {
+		return randomGGXLobe(specularDir, glossyAlpha(hitInfo), rng);
+	}
+	return randomCosineHemiSphere(hitInfo->normal, rng);
 }
 
+/**
+ * materialPdf() returns density of sampleMaterial() for direction
+ */
+__always_inline float materialPdf(const struct HitInfo *__restrict hitInfo,
+				  float3 specularDir, float3 dir)
+{
+	float r = hitInfo->reflective;
+
+	return (1 - r) * cosineHemiSpherePdf(hitInfo->normal, dir) +
+	       r * ggxLobePdf(specularDir, glossyAlpha(hitInfo), dir);
+}
+
+/**
+ * materialEval() returns reflected fraction of light coming from direction
+ * multiplied by cosine of its angle to normal. Both lobes are normalized, so
+ * it is surface color times materialPdf() for directions above surface
+ */
+__always_inline float3 materialEval(const struct HitInfo *__restrict hitInfo,
+				    float3 specularDir, float3 dir)
+{
+	if (dot(dir, hitInfo->normal) <= 0) {
+		return BLACK;
+	}
+	return hitInfo->hitColor * materialPdf(hitInfo, specularDir, dir);
+}
+
+/**
+ * lightContribution() returns light coming from direction sampled by
+ * sampleLights() and reflected by surface, weighted against material sampling
+ *
+ * @param radiance light coming from direction
+ * @param lightPdf density direction was sampled with
+ */
+__always_inline float3
+lightContribution(const struct HitInfo *__restrict hitInfo, float3 specularDir,
+		  float3 dir, float3 radiance, float lightPdf)
+{
+	float pdf = materialPdf(hitInfo, specularDir, dir);
+	float3 eval = materialEval(hitInfo, specularDir, dir);
+
+	return vec_mul(eval, radiance) *
+	       (powerHeuristic(lightPdf, pdf) / lightPdf);
+}
+
+/**
+ * sampleLights() estimates light reaching surface directly from sun and from
+ * one emissive sphere chosen uniformly from scene lights. Direction to each
+ * light is sampled in cone the light is seen in and tested with shadow ray
+ *
+ * @param hitInfo the surface hit
+ * @param specularDir mirror direction of incoming ray
+ * @param scene scene spheres, their bvh and lights
+ * @param rng random stream of path
+ * @return light reflected by surface, not attenuated by path
+ */
+float3 sampleLights(const struct HitInfo *__restrict hitInfo,
+		    float3 specularDir, const struct Scene *__restrict scene,
+		    struct RandomState *__restrict rng)
+{
+	float3 light = BLACK;
+	struct Ray shadow;
+	float hitDistance;
+
+	shadow.origin = hitInfo->hitPoint;
+	shadow.direction = randomCone(SUN_DIRECTION, SUN_CONE_COS, rng);
+	if (dot(shadow.direction, hitInfo->normal) > 0 &&
+	    closestSphere(&shadow, &hitDistance, scene) == -1) {
+		light += lightContribution(hitInfo, specularDir,
+					   shadow.direction,
+					   sunLight(shadow.direction),
+					   conePdf(SUN_CONE_COS));
+	}
+	if (scene->lightsNum == 0) {
+		return light;
+	}
+
+	unsigned int i = min((unsigned int)(nextRandomFloat(rng) *
+					    scene->lightsNum),
+			     scene->lightsNum - 1);
+	int id = scene->lights[i];
+	sphere_t *sphere = &scene->spheres[id];
+	float cosMax = sphereConeCos(hitInfo->hitPoint, sphere);
+
+	if (cosMax >= 1) {
+		return light;
+	}
+	shadow.direction = randomCone(
+		normalize(sphere->position - hitInfo->hitPoint), cosMax, rng);
+	if (dot(shadow.direction, hitInfo->normal) > 0 &&
+	    closestSphere(&shadow, &hitDistance, scene) == id) {
+		light += lightContribution(
+			hitInfo, specularDir, shadow.direction,
+			sphere->color * sphere->emissionStrength,
+			conePdf(cosMax) / scene->lightsNum);
+	}
+	return light;
+}
+
+/**
+ * scatterRay() adds light emitted by hit surface to incoming light and
+ * continues ray from hit point in mirror direction or in direction sampled
+ * from surface material. Lights are sampled directly at non-mirror bounces,
+ * so emission hit by sampled ray is weighted against light sampling
+ *
+ * @param incomingLight light gathered by path so far, updated inplace
+ * @param rayColor attenuation of light along path, updated inplace
+ * @param lastPdf density ray direction was sampled with, 0 for camera and
+ * 	mirror rays, updated inplace
+ * @param viewVector ray which hit the surface, replaced with scattered ray
+ * @param hitInfo the surface hit
+ * @param sphere the sphere hit
+ * @param scene scene spheres, their bvh and lights
+ * @param rng random stream of path
+ * @return false if path is absorbed and should be terminated
+ */
+__always_inline bool scatterRay(float3 *__restrict incomingLight,
+				float3 *__restrict rayColor,
+				float *__restrict lastPdf,
+				struct Ray *__restrict viewVector,
+				const struct HitInfo *__restrict hitInfo,
+				sphere_t *__restrict sphere,
+				const struct Scene *__restrict scene,
+				struct RandomState *__restrict rng)
+{
+	float3 specularDir = reflectRay(-viewVector->direction, hitInfo->normal);
+	float3 emittedLight = hitInfo->hitColor * hitInfo->emissionStrength;
+
+	if (*lastPdf > 0 && hitInfo->emissionStrength > 0) {
+		emittedLight *= powerHeuristic(
+			*lastPdf, sphereLightPdf(viewVector->origin, sphere,
+						 scene->lightsNum));
+	}
+	viewVector->origin = hitInfo->hitPoint;
+	*incomingLight += vec_mul(emittedLight, *rayColor);
+
+	if (hitInfo->specular >= nextRandomFloat(rng)) {
+		viewVector->direction = specularDir;
+		*lastPdf = 0;
+		return true;
+	}
+	*incomingLight +=
+		vec_mul(sampleLights(hitInfo, specularDir, scene, rng),
+			*rayColor);
+
+	float3 dir = sampleMaterial(hitInfo, specularDir, rng);
+	float pdf = materialPdf(hitInfo, specularDir, dir);
+	float3 eval = materialEval(hitInfo, specularDir, dir);
+
+	if (pdf <= 0 || dot(dir, hitInfo->normal) <= 0) {
+		return false;
+	}
+	viewVector->direction = dir;
+	*rayColor = vec_mul(*rayColor, eval * (1 / pdf));
+	*lastPdf = pdf;
+	return true;
+}
+
+/**
+ * russianRoulette() randomly terminates path with probability growing as its
+ * attenuation falls. Surviving paths are amplified, so estimate stays unbiased
+ *
+ * @param rayColor attenuation of light along path, updated inplace
+ * @param depth number of surfaces hit by path
+ * @param rng random stream of path
+ * @return false if path is terminated
+ */
+__always_inline bool russianRoulette(float3 *__restrict rayColor,
+				     unsigned int depth,
+				     struct RandomState *__restrict rng)
+{
+	float survival;
+
+	if (depth < ROULETTE_MIN_DEPTH) {
+		return true;
+	}
+	survival = fmin(fmax(fmax(rayColor->x, rayColor->y), rayColor->z),
+			ROULETTE_MAX_SURVIVAL);
+	if (nextRandomFloat(rng) >= survival) {
+		return false;
+	}
+	*rayColor *= 1 / survival;
+	return true;
+}
+
+/**
+ * createSampleRay() creates camera ray through random point of pixel, first
+ * dimension of sample is used for it
+ */
+__always_inline void
+createSampleRay(struct Ray *__restrict ray, short x, short y, float3 position,
+		const struct RotateMatrix *__restrict matrix,
+		struct RandomState *__restrict rng)
+{
+	float jitter[2];
+
+	nextRandomFloat2D(rng, jitter);
+	createViewVector(ray, x + jitter[0], y + jitter[1], position, matrix);
+}
+
+/**
+ * addFeatures() adds features of the first hit of camera ray to features
+ *
+ * @param hitInfo the first hit, NULL if ray hits nothing
+ */
+__always_inline void addFeatures(struct PixelFeatures *__restrict features,
+				 const struct Ray *__restrict viewVector,
+				 const struct HitInfo *__restrict hitInfo)
+{
+	if (hitInfo == NULL) {
+		features->depth += FEATURES_MISS_DEPTH;
+		return;
+	}
+	features->normal += hitInfo->normal;
+	features->albedo += hitInfo->hitColor;
+	features->depth += length(hitInfo->hitPoint - viewVector->origin);
+}
+
+/**
+ * tracePath() adds light coming along path started by viewVector to
+ * incomingLight. Path is terminated by russian roulette or with environment
+ * light after maxDepth + 1 surfaces are hit. If features is not NULL, features
+ * of the first hit are added to it
+ */
 void tracePath(float3 *__restrict incomingLight,
-	       struct Ray *__restrict viewVector, sphere_t *__restrict spheres,
-	       unsigned int *seed)
+	       struct Ray *__restrict viewVector,
+	       const struct Scene *__restrict scene, unsigned int maxDepth,
+	       struct PixelFeatures *__restrict features,
+	       struct RandomState *__restrict rng)
 {
 	float3 rayColor = FLOAT3(1, 1, 1);
+	float lastPdf = 0;
 	struct HitInfo hitInfo;
-	int i;
+	unsigned int i;
 
-	for (i = 1; i <= TRACE_BOUNCE_COUNT + 1; ++i) {
-		intersectAllSpheres(viewVector, &hitInfo, spheres);
-		if (!hitInfo.didHit) {
+	for (i = 1; i <= maxDepth + 1; ++i) {
+		int id = intersectAllSpheres(viewVector, &hitInfo, scene);
+
+		if (i == 1 && features != NULL) {
+			addFeatures(features, viewVector,
+				    id == -1 ? NULL : &hitInfo);
+		}
+		if (id == -1) {
 			break;
 		}
-		viewVector->origin = hitInfo.hitPoint;
-		float3 diffuseDir = normalize(randomHemiSphere(hitInfo.normal, seed) + hitInfo.normal * 0.5f);
-		float3 specularDir = reflectRay(-viewVector->direction, hitInfo.normal);
-
-		float3 emittedLight = hitInfo.hitColor * hitInfo.emissionStrength;
-
-		if (hitInfo.specular >= nextRandomFloat(seed)) {
-			viewVector->direction = specularDir;
-			*incomingLight += emittedLight;
-		} else {
-			viewVector->direction = normalize(lerp(diffuseDir, specularDir, hitInfo.reflective));
-			*incomingLight += vec_mul(emittedLight, rayColor);
-			rayColor = vec_mul(rayColor, hitInfo.hitColor);
+		if (!scatterRay(incomingLight, &rayColor, &lastPdf, viewVector,
+				&hitInfo, &scene->spheres[id], scene, rng) ||
+		    !russianRoulette(&rayColor, i, rng)) {
+			return;
 		}
-
-
-		// ! dont run last two lines in the last iteration of loop
 	}
 
-
-	float3 sun = sunLight(viewVector);
-	float3 sky = skyBoxColor(viewVector);
-	*incomingLight += vec_mul(fmin(4.0f, sun + sky), rayColor);
-
+	*incomingLight += vec_mul(environmentLight(viewVector, lastPdf),
+				  rayColor);
 }
 
-__always_inline void pathTracer(__write_only image2d_t canvas,
-				__read_only image2d_t c2,
-				sphere_t *__restrict spheres, float3 position,
+__always_inline void pathTracer(__global float4 *accum,
+				__global float *moments,
+				__global const char *tileMask,
+				__global struct PixelFeatures *features,
+				const struct Scene *__restrict scene,
+				float3 position,
 				const struct RotateMatrix *matrix,
 				__local float3 *rayBuffer, bool resetCanvas,
-				unsigned int frameNumber)
+				unsigned int frameNumber, unsigned int maxDepth,
+				short x, short y)
 {
 	struct Ray viewVector;
-	const short x = get_global_id(0);
-	const short y = get_global_id(1);
 	const short l = get_local_id(2);
 	float3 pixelColor = FLOAT3(0, 0, 0);
-	float3 prevColor;
-	unsigned int seed = (y * 2048) + x + frameNumber * 37421;
-	//unsigned int seed = (((l * 512) + y) * 2048 + x) frameNumber;
+	struct PixelFeatures pixelFeatures = { FLOAT3(0, 0, 0),
+					       FLOAT3(0, 0, 0), 0 };
+	struct PixelFeatures *sampleFeatures =
+		features != NULL ? &pixelFeatures : NULL;
+	// frames are numbered from 1
+	const unsigned int firstSample = (frameNumber - 1) * RAYS_PER_PIXEL;
+	struct RandomState rng;
+
+	if (tileMask != NULL &&
+	    !tileMask[(y / ADAPTIVE_TILE_SIZE) * ADAPTIVE_TILES_X +
+		      x / ADAPTIVE_TILE_SIZE]) {
+		return;
+	}
 
 #if 1
 	(void)rayBuffer;
+	(void)l;
 
 	for (int i = 0; i < RAYS_PER_PIXEL; ++i) {
-		createViewVector(&viewVector, x, y, position, matrix);
-		tracePath(&pixelColor, &viewVector, spheres, &seed);
+		initRandom(&rng, x, y, firstSample + i);
+		createSampleRay(&viewVector, x, y, position, matrix, &rng);
+		tracePath(&pixelColor, &viewVector, scene, maxDepth,
+			  sampleFeatures, &rng);
 	}
 	pixelColor *= (float)1.0 / (float)RAYS_PER_PIXEL;
-
-	if (!resetCanvas) {
-		prevColor = getPixelColor(c2, x, y);
-		float ratio = (float)1.0 / (float)frameNumber;
-		pixelColor = prevColor * (1 - ratio) + pixelColor * ratio;
+	if (features != NULL) {
+		pixelFeatures.normal *= (float)1.0 / (float)RAYS_PER_PIXEL;
+		pixelFeatures.albedo *= (float)1.0 / (float)RAYS_PER_PIXEL;
+		pixelFeatures.depth *= (float)1.0 / (float)RAYS_PER_PIXEL;
+		accumulateFeatures(features, accum, x, y, pixelFeatures,
+				   resetCanvas);
 	}
-	setPixelColor(canvas, x, y, pixelColor);
+	accumulateColor(accum, moments, x, y, pixelColor, resetCanvas);
 
 #else
-	createViewVector(&viewVector, x, y, position, matrix);
-	tracePath(&pixelColor, &viewVector, spheres, &seed);
+	initRandom(&rng, x, y, firstSample + l);
+	createSampleRay(&viewVector, x, y, position, matrix, &rng);
+	tracePath(&pixelColor, &viewVector, scene, maxDepth, NULL, &rng);
 	rayBuffer[l] = pixelColor;
 	barrier(CLK_LOCAL_MEM_FENCE);
 
@@ -286,7 +863,7 @@ __always_inline void pathTracer(__write_only image2d_t canvas,
 			pixelColor += rayBuffer[i];
 		}
 		pixelColor *= (float)1.0 / (float)RAYS_PER_PIXEL;
-		setPixelColor(canvas, x, y, pixelColor);
+		accumulateColor(accum, moments, x, y, pixelColor, resetCanvas);
 	}
 #endif
 }
@@ -314,15 +891,126 @@ testKernel(__write_only image2d_t canvas, __constant struct Sphere *spheres,
 	setPixelColor(canvas, x, y, vec.direction);
 }
 
-__kernel void runKernel(__write_only image2d_t canvas,
-			__constant struct Sphere *spheres, float3 position,
+/**
+ * runKernel() traces RAYS_PER_PIXEL paths for pixel and adds their mean to
+ * accumulation buffer. Display texture is written by resolveKernel(). If
+ * tileMask is not NULL, pixels of converged tiles are skipped. lights are
+ * indices of lightsNum emissive spheres, they are sampled directly. Paths
+ * make at most maxDepth bounces. If features is not NULL, features of the
+ * first hit are accumulated to it for denoiser
+ */
+__kernel void runKernel(__global float4 *accum,
+			__global const struct Sphere *spheres, float3 position,
 			struct RotateMatrix matrix, int resetCanvas,
-			__read_only image2d_t c2, unsigned int frameNumber)
+			unsigned int frameNumber,
+			__global const struct BVHNode *nodes,
+			unsigned int spheresNum, __global float *moments,
+			__global const char *tileMask,
+			__global const unsigned int *lights,
+			unsigned int lightsNum, unsigned int maxDepth,
+			__global struct PixelFeatures *features)
+{
+	__local float3 rayBuffer[RAYS_PER_PIXEL];
+	struct Scene scene = { spheres, nodes, spheresNum, lights, lightsNum };
+
+	pathTracer(accum, moments, tileMask, features, &scene, position,
+		   &matrix, rayBuffer, resetCanvas, frameNumber, maxDepth,
+		   get_global_id(0), get_global_id(1));
+}
+
+/* clcpp has no work-groups sharing local memory */
+#ifndef __clcpp__
+/**
+ * persistentKernel() is runKernel() scheduled by kernel itself. Only enough
+ * work-groups to fill device are run, each of them takes PERSISTENT_TILE_SIZE
+ * square pixel tiles from tileCounter until all tiles of frame are taken, so
+ * expensive tiles do not leave compute units idle at the end of frame.
+ * Work-group must have a work-item per tile pixel and tileCounter must be
+ * zeroed before every launch
+ */
+__kernel void persistentKernel(__global float4 *accum,
+			       __global const struct Sphere *spheres,
+			       float3 position, struct RotateMatrix matrix,
+			       int resetCanvas, unsigned int frameNumber,
+			       __global const struct BVHNode *nodes,
+			       unsigned int spheresNum, __global float *moments,
+			       __global const char *tileMask,
+			       __global const unsigned int *lights,
+			       unsigned int lightsNum, unsigned int maxDepth,
+			       __global struct PixelFeatures *features,
+			       volatile __global unsigned int *tileCounter)
 {
 	__local float3 rayBuffer[RAYS_PER_PIXEL];
+	__local unsigned int sharedTile;
+	struct Scene scene = { spheres, nodes, spheresNum, lights, lightsNum };
+	const unsigned int l = get_local_id(0);
+
+	for (;;) {
+		if (l == 0) {
+			sharedTile = atomic_inc(tileCounter);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		unsigned int tile = sharedTile;
+		// nobody takes next tile until every work-item read this one
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (tile >= PERSISTENT_TILES_X * PERSISTENT_TILES_Y) {
+			break;
+		}
+
+		short x = (tile % PERSISTENT_TILES_X) * PERSISTENT_TILE_SIZE +
+			  l % PERSISTENT_TILE_SIZE;
+		short y = (tile / PERSISTENT_TILES_X) * PERSISTENT_TILE_SIZE +
+			  l / PERSISTENT_TILE_SIZE;
+		if (x < SCREEN_WIDTH && y < SCREEN_HEIGHT) {
+			pathTracer(accum, moments, tileMask, features, &scene,
+				   position, &matrix, rayBuffer, resetCanvas,
+				   frameNumber, maxDepth, x, y);
+		}
+	}
+}
+#endif /* __clcpp__ */
+
+/**
+ * tileErrorKernel() marks tile as converged when relative error of every its
+ * pixel is below threshold. Work-item per ADAPTIVE_TILE_SIZE square tile is
+ * run, converged tiles are never marked active again
+ */
+__kernel void tileErrorKernel(__global const float4 *accum,
+			      __global const float *moments,
+			      __global char *tileMask, float threshold)
+{
+	const int tx = get_global_id(0);
+	const int ty = get_global_id(1);
+	__global char *active = &tileMask[ty * ADAPTIVE_TILES_X + tx];
+	float error = 0;
+
+	if (!*active) {
+		return;
+	}
+	for (int y = ty * ADAPTIVE_TILE_SIZE;
+	     y < min((ty + 1) * ADAPTIVE_TILE_SIZE, SCREEN_HEIGHT); ++y) {
+		for (int x = tx * ADAPTIVE_TILE_SIZE;
+		     x < min((tx + 1) * ADAPTIVE_TILE_SIZE, SCREEN_WIDTH);
+		     ++x) {
+			int i = y * SCREEN_WIDTH + x;
+
+			error = fmax(error, pixelError(accum[i], moments[i]));
+		}
+	}
+	*active = error > threshold;
+}
+
+/**
+ * resolveKernel() writes accumulated pixel colors to display texture
+ */
+__kernel void resolveKernel(__write_only image2d_t canvas,
+			    __global const float4 *accum)
+{
+	const short x = get_global_id(0);
+	const short y = get_global_id(1);
+	float4 color = accum[y * SCREEN_WIDTH + x];
 
-	pathTracer(canvas, c2, spheres, position, &matrix, rayBuffer,
-		   resetCanvas, frameNumber);
+	setPixelColor(canvas, x, y, FLOAT3(color.x, color.y, color.z));
 }
 
 EXTERN_C_END
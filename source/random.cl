@@ -6,116 +6,462 @@
 
 EXTERN_C
 
-#ifndef RAND_MAX
-#define RAND_MAX UINT_MAX
-#endif /* RAND_MAX */
-#define RAND_HALF (UINT_MAX / 2)
 #define PI 3.14159265358979323846
+/* 2^-24, float of 24 high random bits is exactly representable */
+#define RANDOM_FLOAT_UNIT (1.0f / 16777216.0f)
+
+/* sampler nextSample2D() draws from, one of SAMPLER_* of struct.cl */
+#ifndef SAMPLER
+#define SAMPLER SAMPLER_SOBOL
+#endif
+
+/* R2 sequence generators 1 / g and 1 / g^2 as 32 bit fixed point numbers,
+ * g = 1.3247... is plastic number */
+#define R2_A1 3242174889u
+#define R2_A2 2447445414u
 
 /**
- * nextRandomInt() generates integer number sequence in uniform distribution
+ * pcg4d() is a counter-based hash of 4 integers to 4 uniformly distributed
+ * integers, every output bit depends on every input bit. It is PCG4D hash of
+ * Jarzynski and Olano, "Hash Functions for GPU Rendering", JCGT 2020
  *
- * @param prev previous generated number. In first function call prev can be
- * 	used as seen
- * @return next random integer using previous generatee number
+ * @param v hash input, replaced with hash output
+ */
+__always_inline static void pcg4d(unsigned int v[4])
+{
+	for (int i = 0; i < 4; ++i) {
+		v[i] = v[i] * 1664525u + 1013904223u;
+	}
+	v[0] += v[1] * v[3];
+	v[1] += v[2] * v[0];
+	v[2] += v[0] * v[1];
+	v[3] += v[1] * v[2];
+	for (int i = 0; i < 4; ++i) {
+		v[i] ^= v[i] >> 16;
+	}
+	v[0] += v[1] * v[3];
+	v[1] += v[2] * v[0];
+	v[2] += v[0] * v[1];
+	v[3] += v[1] * v[2];
+}
+
+/**
+ * reverseBits() reverses order of bits of integer
+ */
+__always_inline static unsigned int reverseBits(unsigned int x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+/**
+ * owenScramble() applies nested uniform scramble to 32 bit fixed point number
+ * in [0, 1): every bit is flipped depending on seed and on all higher bits.
+ * Applied to integer, it shuffles its lower bits within aligned power of two
+ * blocks. It is hash based scramble of Burley, "Practical Hash-based Owen
+ * Scrambling", JCGT 2020
+ */
+__always_inline static unsigned int owenScramble(unsigned int x,
+						 unsigned int seed)
+{
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+/**
+ * sobol2D() returns point of first two dimensions of Sobol sequence as 32 bit
+ * fixed point numbers. Every aligned power of two block of points is
+ * stratified in both dimensions and in their product
+ */
+__always_inline static void sobol2D(unsigned int index, unsigned int out[2])
+{
+	unsigned int v = 1u << 31;
+
+	out[0] = reverseBits(index);
+	out[1] = 0;
+	for (; index != 0; index >>= 1, v ^= v >> 1) {
+		if (index & 1) {
+			out[1] ^= v;
+		}
+	}
+}
+
+/**
+ * whiteNoiseSample2D() returns independent uniformly distributed integers of
+ * dimension of pixel sample
+ */
+__always_inline static void whiteNoiseSample2D(unsigned int pixel,
+					       unsigned int sample,
+					       unsigned int dimension,
+					       unsigned int out[2])
+{
+	unsigned int v[4] = { pixel, sample, dimension, SAMPLER_WHITE_NOISE };
+
+	pcg4d(v);
+	out[0] = v[0];
+	out[1] = v[1];
+}
+
+/**
+ * sobolSample2D() returns point of dimension of pixel sample from Owen
+ * scrambled Sobol sequence. Every dimension of every pixel is the same
+ * two-dimensional sequence with independent shuffle and scramble, so
+ * dimensions are not correlated
+ */
+__always_inline static void sobolSample2D(unsigned int pixel,
+					  unsigned int sample,
+					  unsigned int dimension,
+					  unsigned int out[2])
+{
+	unsigned int seed[4] = { pixel, 0, dimension, SAMPLER_SOBOL };
+
+	pcg4d(seed);
+	sobol2D(owenScramble(sample, seed[0]), out);
+	out[0] = owenScramble(out[0], seed[1]);
+	out[1] = owenScramble(out[1], seed[2]);
+}
+
+/**
+ * blueNoiseSample2D() returns point of dimension of pixel sample. The first
+ * dimension, which places sample in pixel, is drawn from Owen scrambled Sobol
+ * sequence shared by all pixels and shifted modulo one by R2 dither of pixel,
+ * so neighbouring pixels cover pixel footprint with complementary samples and
+ * error is distributed over screen as blue noise. It is dithered sampling of
+ * Georgiev and Fajardo, "Blue-noise Dithered Sampling", SIGGRAPH 2016 Talks.
+ * Integrands of neighbouring pixels differ after the first bounce, sequence
+ * shared by them only correlates their error there, so other dimensions are
+ * taken from sobolSample2D()
+ */
+__always_inline static void blueNoiseSample2D(unsigned int pixel,
+					      unsigned int sample,
+					      unsigned int dimension,
+					      unsigned int out[2])
+{
+	unsigned int seed[4] = { 0, 0, 0, SAMPLER_BLUE_NOISE };
+	unsigned int x = pixel & 0xffff;
+	unsigned int y = pixel >> 16;
+
+	if (dimension != 0) {
+		sobolSample2D(pixel, sample, dimension, out);
+		return;
+	}
+	pcg4d(seed);
+	sobol2D(owenScramble(sample, seed[0]), out);
+	out[0] = owenScramble(out[0], seed[1]) + x * R2_A1 + y * R2_A2;
+	out[1] = owenScramble(out[1], seed[2]) + x * R2_A2 + y * R2_A1;
+}
+
+/**
+ * initRandom() sets random stream to the beginning of sample of pixel. Streams
+ * of different pixels and samples are independent, numbers are not carried
+ * between them, so any of them can be generated on any device
  *
- * TODO: validate distribution
+ * @param rng random stream
+ * @param x pixel column
+ * @param y pixel row
+ * @param sample number of pixel sample counted over all frames, samplers are
+ * 	best stratified if it starts from 0
  */
-__always_inline __must_check static unsigned int
-nextRandomInt(unsigned int prev)
+__always_inline static void initRandom(struct RandomState *__restrict rng,
+				       unsigned int x, unsigned int y,
+				       unsigned int sample)
 {
-	prev *= (prev + 195439) * (prev + 124395) * (prev + 845921);
-	return prev;
-	//return (prev * 0x5DEECE66D + 0xB);
+	rng->pixel = y << 16 | (x & 0xffff);
+	rng->sample = sample;
+	rng->dimension = 0;
 }
 
 /**
- * nextRandomFloat() generates float number sequence in uniform distribution
- * in range [0, 1]
+ * nextRandomInts() generates 4 independent uniformly distributed integers and
+ * moves stream to the next dimension. Numbers are white noise whatever
+ * sampler is used
  *
- * @param seed used to generate next random number. Seed is modifyed after
- * 	every call of the function. In first function call *seed value need
- * 	to be set to random value to get different sequence each time
- * @return next random float in range [0, 1] from previous seed value
+ * @param rng random stream
+ * @param out place where generated numbers are stored
+ */
+__always_inline static void nextRandomInts(struct RandomState *__restrict rng,
+					   unsigned int out[4])
+{
+	out[0] = rng->pixel;
+	out[1] = rng->sample;
+	out[2] = rng->dimension++;
+	out[3] = 0;
+	pcg4d(out);
+}
+
+/**
+ * nextSample2D() generates next two dimensions of sample with SAMPLER and
+ * moves stream to the next dimension. All sampling of path goes through it
  *
- * TODO: validate distribution
+ * @param rng random stream
+ * @param out place where two uniformly distributed integers are stored
  */
-__always_inline __must_check static float
-nextRandomFloat(unsigned int *__restrict seed)
+__always_inline static void nextSample2D(struct RandomState *__restrict rng,
+					 unsigned int out[2])
 {
-	*seed = nextRandomInt(*seed);
-	return (float)(*seed) / (float)RAND_MAX;
+#if SAMPLER == SAMPLER_SOBOL
+	sobolSample2D(rng->pixel, rng->sample, rng->dimension, out);
+#elif SAMPLER == SAMPLER_BLUE_NOISE
+	blueNoiseSample2D(rng->pixel, rng->sample, rng->dimension, out);
+#else
+	whiteNoiseSample2D(rng->pixel, rng->sample, rng->dimension, out);
+#endif
+	rng->dimension++;
 }
 
 /**
- * nextRandomFloatNormal() generates float number sequence in normal
- * distribution with mean = 0 and std = 1.0
+ * nextRandomInt() generates integer number in uniform distribution
  *
- * @param seed used to generate next random number in sequence
- * @return next normal distributed float number from previous seed value
+ * @param rng random stream, moved to the next dimension
+ * @return next random integer of stream
+ */
+__always_inline __must_check static unsigned int
+nextRandomInt(struct RandomState *__restrict rng)
+{
+	unsigned int v[4];
+
+	nextRandomInts(rng, v);
+	return v[0];
+}
+
+__always_inline __must_check static float randomUnit(unsigned int value)
+{
+	return (float)(value >> 8) * RANDOM_FLOAT_UNIT;
+}
+
+/**
+ * nextRandomFloat() generates float number in uniform distribution in range
+ * [0, 1)
+ *
+ * @param rng random stream, moved to the next dimension
+ * @return next random float in range [0, 1)
  */
 __always_inline __must_check static float
-nextRandomFloatNormal(unsigned int *__restrict seed)
+nextRandomFloat(struct RandomState *__restrict rng)
 {
-	float theta = 2 * PI * nextRandomFloat(seed);
-	float rho = sqrt(-2 * log(nextRandomFloat(seed)));
-	return rho * cos(theta);
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	return randomUnit(v[0]);
 }
 
 /**
- * nextRandomFloatNeg() generates float number sequence in uniform distribution
- * in range [-1, 1]. Function works like a `nextRandomFloat` function
+ * nextRandomFloat2D() generates two dimensions of sample in range [0, 1), like
+ * subpixel position
  *
- * @param seed used to generate next random number in sequence
- * @return next random float in range [-1, 1] from previous seed value
+ * @param rng random stream, moved to the next dimension
+ * @param out place where generated numbers are stored
+ */
+__always_inline static void
+nextRandomFloat2D(struct RandomState *__restrict rng, float out[2])
+{
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	out[0] = randomUnit(v[0]);
+	out[1] = randomUnit(v[1]);
+}
+
+/**
+ * nextRandomFloatNormal() generates float number in normal distribution with
+ * mean = 0 and std = 1.0 using Box-Muller transform
  *
- * TODO: validate distribution
+ * @param rng random stream, moved to the next dimension
+ * @return next normal distributed float number
  */
 __always_inline __must_check static float
-nextRandomFloatNeg(unsigned int *__restrict seed)
+nextRandomFloatNormal(struct RandomState *__restrict rng)
 {
-	*seed = nextRandomInt(*seed);
-	return (float)(*seed) / (float)RAND_HALF - (float)1;
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	float theta = 2 * PI * randomUnit(v[0]);
+	float rho = sqrt(-2 * log(1 - randomUnit(v[1])));
+	return rho * cos(theta);
 }
 
 /**
- * randomDirection() generates 3-dimentional vector randomly directed in
- * sphere of radius 1. Distribution of direction is close to uniform, but with
- * small irregularites due to mapping vector from random cube to sphere.
+ * nextRandomFloatNeg() generates float number in uniform distribution in range
+ * [-1, 1)
  *
- * @param seed used to generate numbers in random number sequence
- *
- * TODO: validate distribution
- * ! update description
+ * @param rng random stream, moved to the next dimension
+ * @return next random float in range [-1, 1)
+ */
+__always_inline __must_check static float
+nextRandomFloatNeg(struct RandomState *__restrict rng)
+{
+	return nextRandomFloat(rng) * 2 - 1;
+}
+
+/**
+ * orthonormalBasis() builds tangent and bitangent of unit normal, so they form
+ * right-handed orthonormal basis with it. Uses branchless construction of Duff
+ * et al., "Building an Orthonormal Basis, Revisited", JCGT 2017
+ */
+__always_inline static void orthonormalBasis(float3 normal,
+					     float3 *__restrict tangent,
+					     float3 *__restrict bitangent)
+{
+	float sign = normal.z >= 0 ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + normal.z);
+	float b = normal.x * normal.y * a;
+
+	*tangent = FLOAT3(1.0f + sign * normal.x * normal.x * a, sign * b,
+			  -sign * normal.x);
+	*bitangent = FLOAT3(b, sign + normal.y * normal.y * a, -normal.y);
+}
+
+/**
+ * localToWorld() turns direction given by cosine of its angle with axis and
+ * azimuth around axis into world space vector
  */
-__inline static float3 randomDirection(unsigned int *__restrict seed)
+__always_inline static float3 localToWorld(float3 axis, float cosTheta,
+					   float phi)
 {
-	float3 dir = FLOAT3(nextRandomFloatNeg(seed),
-			    nextRandomFloatNeg(seed),
-			    nextRandomFloatNeg(seed));
-	return normalize(dir);
+	float sinTheta = sqrt(fmax(0.0f, 1 - cosTheta * cosTheta));
+	float3 tangent;
+	float3 bitangent;
+
+	orthonormalBasis(axis, &tangent, &bitangent);
+	return tangent * (sinTheta * cos(phi)) +
+	       bitangent * (sinTheta * sin(phi)) + axis * cosTheta;
 }
 
 /**
- * randomHemiSphere() generates 3-dimentional vector randomly directed in
- * hemisphere of radious 1. Hemisphere is oriented using normal vector, so
- * generated vector will be at an angle less then pi / 2 to the normal
+ * randomDirection() generates unit vector uniformly distributed on sphere
  *
- * @param normal orientation of hemisphere direction
- * @param seed used to generate numbers in random number sequence
+ * @param rng random stream, moved to the next dimension
+ * @return direction with density uniformSpherePdf()
+ */
+__inline static float3 randomDirection(struct RandomState *__restrict rng)
+{
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	float z = 1 - 2 * randomUnit(v[0]);
+	float phi = 2 * PI * randomUnit(v[1]);
+	float r = sqrt(fmax(0.0f, 1 - z * z));
+	return FLOAT3(r * cos(phi), r * sin(phi), z);
+}
+
+__always_inline __must_check static float uniformSpherePdf(void)
+{
+	return 1 / (4 * PI);
+}
+
+/**
+ * randomHemiSphere() generates unit vector uniformly distributed on hemisphere
+ * oriented with normal, so it is at an angle less then pi / 2 to the normal
  *
- * TODO: validate distribution
- * ! update description
+ * @param normal unit orientation of hemisphere
+ * @param rng random stream, moved to the next dimension
+ * @return direction with density uniformHemiSpherePdf()
  */
 __inline static float3 randomHemiSphere(const float3 normal,
-				      unsigned int *__restrict seed)
+					struct RandomState *__restrict rng)
 {
-	float3 dir = randomDirection(seed);
+	float3 dir = randomDirection(rng);
 	if (dot(dir, normal) < 0)
 		dir = -dir;
 	return dir;
 }
 
+__always_inline __must_check static float uniformHemiSpherePdf(void)
+{
+	return 1 / (2 * PI);
+}
+
+/**
+ * randomCosineHemiSphere() generates unit vector on hemisphere oriented with
+ * normal with density proportional to cosine of angle to normal. Diffuse
+ * surface reflects light in this distribution, so sampling it makes weight of
+ * diffuse bounce equal to surface color
+ *
+ * @param normal unit orientation of hemisphere
+ * @param rng random stream, moved to the next dimension
+ * @return direction with density cosineHemiSpherePdf()
+ */
+__inline static float3
+randomCosineHemiSphere(const float3 normal, struct RandomState *__restrict rng)
+{
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	return localToWorld(normal, sqrt(1 - randomUnit(v[0])),
+			    2 * PI * randomUnit(v[1]));
+}
+
+__always_inline __must_check static float cosineHemiSpherePdf(float3 normal,
+							      float3 dir)
+{
+	return fmax(0.0f, dot(normal, dir)) / PI;
+}
+
+/**
+ * randomGGXLobe() generates unit vector distributed around axis as GGX
+ * (Trowbridge-Reitz) normal distribution, D(theta) * cos(theta). Lobe is
+ * narrow for small alpha and turns to cosine lobe for alpha = 1
+ *
+ * @param axis unit direction lobe is centered around, like mirror direction
+ * @param alpha roughness of lobe in (0, 1]
+ * @param rng random stream, moved to the next dimension
+ * @return direction with density ggxLobePdf()
+ */
+__inline static float3 randomGGXLobe(const float3 axis, float alpha,
+				     struct RandomState *__restrict rng)
+{
+	unsigned int v[2];
+	float a2 = alpha * alpha;
+
+	nextSample2D(rng, v);
+	float u = randomUnit(v[0]);
+	float cos2 = (1 - u) / (1 + (a2 - 1) * u);
+	return localToWorld(axis, sqrt(cos2), 2 * PI * randomUnit(v[1]));
+}
+
+__always_inline __must_check static float ggxLobePdf(float3 axis, float alpha,
+						     float3 dir)
+{
+	float a2 = alpha * alpha;
+	float c = dot(axis, dir);
+	float d = (a2 - 1) * c * c + 1;
+
+	return c > 0 ? a2 * c / (PI * d * d) : 0.0f;
+}
+
+/**
+ * randomCone() generates unit vector uniformly distributed in cone around
+ * axis. Lights seen from point as a disc, like sun or a sphere, are sampled
+ * with it
+ *
+ * @param axis unit direction cone is centered around
+ * @param cosMax cosine of cone half-angle
+ * @param rng random stream, moved to the next dimension
+ * @return direction with density conePdf()
+ */
+__inline static float3 randomCone(const float3 axis, float cosMax,
+				  struct RandomState *__restrict rng)
+{
+	unsigned int v[2];
+
+	nextSample2D(rng, v);
+	return localToWorld(axis, 1 - randomUnit(v[0]) * (1 - cosMax),
+			    2 * PI * randomUnit(v[1]));
+}
+
+__always_inline __must_check static float conePdf(float cosMax)
+{
+	return 1 / (2 * PI * (1 - cosMax));
+}
+
 EXTERN_C_END
 
 #endif /* RANDOM_CL */
\ No newline at end of file
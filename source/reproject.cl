@@ -0,0 +1,177 @@
+#ifndef REPROJECT_CL
+#define REPROJECT_CL
+
+#include <path_tracer.cl>
+
+EXTERN_C
+
+/*
+ * Reprojection keeps samples accumulated before camera moved. Frame after
+ * the move is traced with reset canvas, then reprojectKernel() finds where
+ * the first hit of every pixel was seen by previous camera and merges
+ * accumulated history found there. History pixel is used only if it saw the
+ * same surface, so history of disoccluded pixels is dropped
+ */
+
+/* history depth may differ from expected one by this part of it */
+#define REPROJECT_DEPTH_TOLERANCE 0.05f
+/* cosine between pixel and history normals must not be lower */
+#define REPROJECT_NORMAL_COS 0.9f
+/* history of pixel covered by less bilinear weight is dropped */
+#define REPROJECT_MIN_WEIGHT 0.1f
+/*
+ * most samples reprojected history counts for, so blur of resampling and
+ * shading seen from other direction fade out after a few frames
+ */
+#define REPROJECT_MAX_HISTORY 32.0f
+
+/**
+ * isMiss() returns true if most of pixel samples hit nothing
+ */
+__always_inline bool isMiss(float depth)
+{
+	return depth > FEATURES_MISS_DEPTH / 2;
+}
+
+/**
+ * projectVector() finds position on screen where vector from camera is seen,
+ * it is inverse of createViewVector()
+ *
+ * @param vector vector from camera position
+ * @param matrix rotation matrix of camera
+ * @param x place where horizontal position is stored
+ * @param y place where vertical position is stored
+ * @return false if vector points behind camera
+ */
+__always_inline bool projectVector(float3 vector,
+				   const struct RotateMatrix *__restrict matrix,
+				   float *x, float *y)
+{
+	// inverse of rotation matrix is its transpose
+	float3 v = matrix->row1 * vector.x + matrix->row2 * vector.y +
+		   matrix->row3 * vector.z;
+
+	if (v.z < EPS) {
+		return false;
+	}
+	*x = v.x / v.z * SCREEN_HEIGHT + SCREEN_WIDTH / 2;
+	*y = v.y / v.z * SCREEN_HEIGHT + SCREEN_HEIGHT / 2;
+	return true;
+}
+
+/**
+ * historyMatches() checks if history pixel saw the same surface pixel sees
+ *
+ * @param pixel features of pixel
+ * @param history features of history pixel
+ * @param depth distance of pixel first hit from previous camera
+ */
+__always_inline bool historyMatches(const struct PixelFeatures *pixel,
+				    const struct PixelFeatures *history,
+				    float depth)
+{
+	if (isMiss(pixel->depth) || isMiss(history->depth)) {
+		return isMiss(pixel->depth) && isMiss(history->depth);
+	}
+	return fabs(history->depth - depth) <=
+		       REPROJECT_DEPTH_TOLERANCE * depth &&
+	       dot(pixel->normal, history->normal) >= REPROJECT_NORMAL_COS;
+}
+
+/**
+ * reprojectKernel() merges history accumulated by previous camera into pixel
+ * traced by current one. History is bilinearly interpolated from pixels which
+ * saw the same surface. Accumulation buffer, moments and features must hold
+ * frame traced with reset canvas after camera moved
+ *
+ * @param history accumulation buffer of previous camera
+ * @param historyMoments moments of previous camera
+ * @param historyFeatures pixel features of previous camera
+ */
+__kernel void
+reprojectKernel(__global float4 *accum, __global float *moments,
+		__global const struct PixelFeatures *features,
+		__global const float4 *history,
+		__global const float *historyMoments,
+		__global const struct PixelFeatures *historyFeatures,
+		float3 position, struct RotateMatrix matrix,
+		float3 prevPosition, struct RotateMatrix prevMatrix)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int i = y * SCREEN_WIDTH + x;
+	const struct PixelFeatures pixel = features[i];
+	float3 color = FLOAT3(0, 0, 0);
+	float moment = 0;
+	float count = 0;
+	float weights = 0;
+	struct Ray ray;
+	float3 vector;
+	float hx;
+	float hy;
+
+	createViewVector(&ray, x + 0.5f, y + 0.5f, position, &matrix);
+	// environment is infinitely far, only camera rotation moves it
+	if (isMiss(pixel.depth)) {
+		vector = ray.direction;
+	} else {
+		vector = ray.origin + ray.direction * pixel.depth -
+			 prevPosition;
+	}
+	if (!projectVector(vector, &prevMatrix, &hx, &hy)) {
+		return;
+	}
+
+	// pixel centers are at half-integer positions
+	hx -= 0.5f;
+	hy -= 0.5f;
+	int x0 = floor(hx);
+	int y0 = floor(hy);
+	float fx = hx - x0;
+	float fy = hy - y0;
+	float depth = length(vector);
+
+	for (int tap = 0; tap < 4; ++tap) {
+		int tx = x0 + (tap & 1);
+		int ty = y0 + (tap >> 1);
+		float w = ((tap & 1) ? fx : 1 - fx) *
+			  ((tap >> 1) ? fy : 1 - fy);
+
+		if (tx < 0 || tx >= SCREEN_WIDTH || ty < 0 ||
+		    ty >= SCREEN_HEIGHT) {
+			continue;
+		}
+
+		int j = ty * SCREEN_WIDTH + tx;
+		const struct PixelFeatures tapFeatures = historyFeatures[j];
+		float4 h = history[j];
+
+		if (!historyMatches(&pixel, &tapFeatures, depth)) {
+			continue;
+		}
+		color += FLOAT3(h.x, h.y, h.z) * w;
+		moment += historyMoments[j] * w;
+		count += h.w * w;
+		weights += w;
+	}
+	if (weights < REPROJECT_MIN_WEIGHT) {
+		return;
+	}
+
+	float4 current = accum[i];
+	float total;
+
+	color *= 1 / weights;
+	moment /= weights;
+	count = min(count / weights, REPROJECT_MAX_HISTORY);
+	total = count + current.w;
+	color = (color * count +
+		 FLOAT3(current.x, current.y, current.z) * current.w) *
+		(1 / total);
+	accum[i] = FLOAT4(color.x, color.y, color.z, total);
+	moments[i] = (moment * count + moments[i] * current.w) / total;
+}
+
+EXTERN_C_END
+
+#endif /* REPROJECT_CL */
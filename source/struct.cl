@@ -32,6 +32,91 @@ struct Sphere {
 	float specular;
 };
 
+/**
+ * BVHNode is a node of flattened bounding volume hierarchy over scene spheres.
+ * Children of inner node are stored next to each other, so only index of left
+ * child is saved. Spheres of leaf node are stored contiguously in scene array
+ */
+struct BVHNode {
+	float3 boxMin;
+	float3 boxMax;
+	int leftFirst; // left child index for inner node, first sphere for leaf
+	int count; // number of spheres in leaf or 0 for inner node
+};
+
+/**
+ * RandomState is position in counter-based random stream. Numbers are
+ * function of the position, so the state is never carried from one sample to
+ * another
+ */
+struct RandomState {
+	unsigned int pixel; // y << 16 | x
+	unsigned int sample; // sample of pixel counted over all frames
+	unsigned int dimension; // incremented by every generated number
+};
+
+/**
+ * PathState is a path traced by wavefront kernels. Ray, attenuation and light
+ * gathered so far are kept between kernel launches. Closest hit found by
+ * extend stage is stored for shade stage
+ */
+struct PathState {
+	struct Ray ray;
+	float3 rayColor;
+	float3 incomingLight;
+	float hitDistance;
+	int hitSphere;
+	float lastPdf; // density ray was sampled with, 0 for camera/mirror ray
+	struct RandomState rng;
+};
+
+/**
+ * PixelFeatures are normal, albedo and distance of the first surface camera
+ * rays of pixel hit, averaged over pixel samples as color is. Denoiser tells
+ * edges from noise with them. Ray which hits nothing has zero normal and
+ * albedo and FEATURES_MISS_DEPTH distance
+ */
+struct PixelFeatures {
+	float3 normal;
+	float3 albedo;
+	float depth;
+};
+
+/* distance of the first hit of ray which hits nothing */
+# define FEATURES_MISS_DEPTH 1e4f
+
+/* bvh builder never makes hierarchy deeper then traversal stack size */
+# define BVH_STACK_SIZE 32
+
+/* side of square tile work-group of persistentKernel() takes at once */
+# define PERSISTENT_TILE_SIZE 8
+
+/*
+ * wavefront queue counters, a set of them per bounce. Host sizes counters
+ * buffer from runtime bounce limit times WAVEFRONT_QUEUES and reads ray
+ * counters back, so they are shared with it
+ */
+# define WAVEFRONT_RAYS 0
+# define WAVEFRONT_HITS 1
+# define WAVEFRONT_MISSES 2
+# define WAVEFRONT_QUEUES 3
+
+/*
+ * samplers nextSample2D() may draw sample dimensions from, SAMPLER selects one
+ * of them when program is built:
+ *
+ *   SAMPLER_WHITE_NOISE  independent hash of stream position
+ *   SAMPLER_SOBOL        Owen scrambled Sobol sequence, scrambled per pixel
+ *   SAMPLER_BLUE_NOISE   place in pixel is taken from Sobol sequence shared
+ *                        by pixels and shifted by blue noise dither of pixel
+ */
+# define SAMPLER_WHITE_NOISE 0
+# define SAMPLER_SOBOL 1
+# define SAMPLER_BLUE_NOISE 2
+
+/* side of square screen tile adaptive sampling decides convergence for */
+# define ADAPTIVE_TILE_SIZE 16
+
 # define RED FLOAT3(1, 0, 0)
 # define GREEN FLOAT3(0, 1, 0)
 # define BLUE FLOAT3(0, 0, 1)
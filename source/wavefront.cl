@@ -0,0 +1,239 @@
+#ifndef WAVEFRONT_CL
+#define WAVEFRONT_CL
+
+#include <path_tracer.cl>
+
+EXTERN_C
+
+/*
+ * Wavefront path tracer splits tracePath() in stages run as separate kernels.
+ * Paths live in global memory, a path per pixel. Stages pass indices of paths
+ * to each other through queues, every stage appends only paths which are
+ * still alive, so terminated paths are compacted out and next stage work-items
+ * are all busy. Queues are filled with atomic counter, a set of counters per
+ * bounce up to maxDepth is used, so none of them is reset between stages:
+ *
+ *   generateKernel  creates camera ray of pixel -> rays[0]
+ *   extendKernel    finds closest hit of rays[b] -> hits[b] or misses[b]
+ *   shadeKernel     scatters hits[b] -> rays[b + 1], last bounce -> misses[b]
+ *   missKernel      adds environment light of misses[b]
+ *   accumulateKernel adds mean of RAYS_PER_PIXEL paths to accumulation buffer
+ *
+ * Host reads ray queue size of bounce back and runs stages of the bounce over
+ * that many work-items. Hit and miss queues of bounce are never longer, so
+ * work-items past size of their queue return immediately
+ */
+
+#define WAVEFRONT_PATHS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+typedef volatile __global unsigned int counter_t;
+
+__always_inline unsigned int queueSize(counter_t *counters,
+				       unsigned int bounce, unsigned int queue)
+{
+	return counters[bounce * WAVEFRONT_QUEUES + queue];
+}
+
+/**
+ * queuePush() appends path to queue of given bounce
+ *
+ * @param queue queue array
+ * @param counters queue counters
+ * @param bounce bounce of queue
+ * @param type one of WAVEFRONT_RAYS, WAVEFRONT_HITS or WAVEFRONT_MISSES
+ * @param path index of path
+ */
+__always_inline void queuePush(__global unsigned int *queue,
+			       counter_t *counters, unsigned int bounce,
+			       unsigned int type, unsigned int path)
+{
+	queue[atomic_inc(&counters[bounce * WAVEFRONT_QUEUES + type])] = path;
+}
+
+/**
+ * rayQueue() returns queue of rays traced at bounce. Rays of two consecutive
+ * bounces are stored in different halves of rays buffer, so shade stage can
+ * fill next queue while current one is still read
+ */
+__always_inline __global unsigned int *rayQueue(__global unsigned int *rays,
+						unsigned int bounce)
+{
+	return &rays[(bounce & 1) * WAVEFRONT_PATHS];
+}
+
+/**
+ * generateKernel() creates camera ray of sample of pixel. Gathered light is
+ * reset before first of RAYS_PER_PIXEL samples only. Pixels of converged
+ * tiles are not queued, if tileMask is not NULL
+ */
+__kernel void generateKernel(__global struct PathState *paths,
+			     counter_t *counters, __global unsigned int *rays,
+			     float3 position, struct RotateMatrix matrix,
+			     unsigned int frameNumber, unsigned int sample,
+			     __global const char *tileMask)
+{
+	const unsigned int x = get_global_id(0);
+	const unsigned int y = get_global_id(1);
+	const unsigned int id = y * SCREEN_WIDTH + x;
+	__global struct PathState *path = &paths[id];
+	struct RandomState rng;
+	struct Ray ray;
+
+	if (tileMask != NULL &&
+	    !tileMask[(y / ADAPTIVE_TILE_SIZE) * ADAPTIVE_TILES_X +
+		      x / ADAPTIVE_TILE_SIZE]) {
+		return;
+	}
+	if (sample == 0) {
+		path->incomingLight = FLOAT3(0, 0, 0);
+	}
+	initRandom(&rng, x, y, (frameNumber - 1) * RAYS_PER_PIXEL + sample);
+	createSampleRay(&ray, x, y, position, &matrix, &rng);
+	path->ray = ray;
+	path->rng = rng;
+	path->rayColor = FLOAT3(1, 1, 1);
+	path->lastPdf = 0;
+	queuePush(rayQueue(rays, 0), counters, 0, WAVEFRONT_RAYS, id);
+}
+
+/**
+ * extendKernel() finds closest sphere hit by queued ray and moves path to hit
+ * or miss queue
+ */
+__kernel void extendKernel(__global struct PathState *paths,
+			   counter_t *counters, __global unsigned int *rays,
+			   __global unsigned int *hits,
+			   __global unsigned int *misses,
+			   __global const struct Sphere *spheres,
+			   __global const struct BVHNode *nodes,
+			   unsigned int spheresNum, unsigned int bounce)
+{
+	const unsigned int i = get_global_id(0);
+	struct Scene scene = { spheres, nodes, spheresNum, NULL, 0 };
+	unsigned int id;
+	struct Ray ray;
+	float hitDistance;
+	int sphere;
+
+	if (i >= queueSize(counters, bounce, WAVEFRONT_RAYS)) {
+		return;
+	}
+	id = rayQueue(rays, bounce)[i];
+	ray = paths[id].ray;
+	sphere = closestSphere(&ray, &hitDistance, &scene);
+	if (sphere == -1) {
+		queuePush(misses, counters, bounce, WAVEFRONT_MISSES, id);
+		return;
+	}
+	paths[id].hitDistance = hitDistance;
+	paths[id].hitSphere = sphere;
+	queuePush(hits, counters, bounce, WAVEFRONT_HITS, id);
+}
+
+/**
+ * shadeKernel() gathers light emitted by hit sphere and by lights sampled
+ * directly and scatters ray. Shadow rays of light sampling are traced right
+ * here. Absorbed path and path terminated by russian roulette are dropped,
+ * path which reached maxDepth + 1 hits is terminated with environment light,
+ * as tracePath() does
+ */
+__kernel void shadeKernel(__global struct PathState *paths,
+			  counter_t *counters, __global unsigned int *rays,
+			  __global const unsigned int *hits,
+			  __global unsigned int *misses,
+			  __global const struct Sphere *spheres,
+			  __global const struct BVHNode *nodes,
+			  unsigned int spheresNum, unsigned int bounce,
+			  __global const unsigned int *lights,
+			  unsigned int lightsNum, unsigned int maxDepth)
+{
+	const unsigned int i = get_global_id(0);
+	struct Scene scene = { spheres, nodes, spheresNum, lights, lightsNum };
+	__global struct PathState *path;
+	struct HitInfo hitInfo;
+	float3 incomingLight;
+	float3 rayColor;
+	float lastPdf;
+	struct RandomState rng;
+	unsigned int id;
+	struct Ray ray;
+
+	if (i >= queueSize(counters, bounce, WAVEFRONT_HITS)) {
+		return;
+	}
+	id = hits[i];
+	path = &paths[id];
+	ray = path->ray;
+	incomingLight = path->incomingLight;
+	rayColor = path->rayColor;
+	lastPdf = path->lastPdf;
+	rng = path->rng;
+
+	setHitInfo(&hitInfo, &ray, &scene.spheres[path->hitSphere],
+		   path->hitDistance);
+	bool alive = scatterRay(&incomingLight, &rayColor, &lastPdf, &ray,
+				&hitInfo, &scene.spheres[path->hitSphere],
+				&scene, &rng) &&
+		     russianRoulette(&rayColor, bounce + 1, &rng);
+
+	path->ray = ray;
+	path->incomingLight = incomingLight;
+	path->rayColor = rayColor;
+	path->lastPdf = lastPdf;
+	path->rng = rng;
+	if (!alive) {
+		return;
+	}
+	if (bounce == maxDepth) {
+		queuePush(misses, counters, bounce, WAVEFRONT_MISSES, id);
+	} else {
+		queuePush(rayQueue(rays, bounce + 1), counters, bounce + 1,
+			  WAVEFRONT_RAYS, id);
+	}
+}
+
+/**
+ * missKernel() terminates path with light of environment in ray direction
+ */
+__kernel void missKernel(__global struct PathState *paths,
+			 counter_t *counters,
+			 __global const unsigned int *misses,
+			 unsigned int bounce)
+{
+	const unsigned int i = get_global_id(0);
+	__global struct PathState *path;
+	struct Ray ray;
+
+	if (i >= queueSize(counters, bounce, WAVEFRONT_MISSES)) {
+		return;
+	}
+	path = &paths[misses[i]];
+	ray = path->ray;
+	path->incomingLight += vec_mul(environmentLight(&ray, path->lastPdf),
+				       path->rayColor);
+}
+
+/**
+ * accumulateKernel() adds mean of light gathered by RAYS_PER_PIXEL paths of
+ * pixel to accumulation buffer, same way runKernel() does
+ */
+__kernel void accumulateKernel(__global const struct PathState *paths,
+			       __global float4 *accum, __global float *moments,
+			       __global const char *tileMask, int resetCanvas)
+{
+	const unsigned int x = get_global_id(0);
+	const unsigned int y = get_global_id(1);
+	float3 pixelColor = paths[y * SCREEN_WIDTH + x].incomingLight;
+
+	if (tileMask != NULL &&
+	    !tileMask[(y / ADAPTIVE_TILE_SIZE) * ADAPTIVE_TILES_X +
+		      x / ADAPTIVE_TILE_SIZE]) {
+		return;
+	}
+	pixelColor *= (float)1.0 / (float)RAYS_PER_PIXEL;
+	accumulateColor(accum, moments, x, y, pixelColor, resetCanvas);
+}
+
+EXTERN_C_END
+
+#endif /* WAVEFRONT_CL */
@@ -9,11 +9,28 @@
 #define __global
 #define __kernel
 #define __constant
+#define __local
 #define write_only
+#define read_only
+#define __write_only
+#define __read_only
+
+#define CLK_LOCAL_MEM_FENCE 0
+#define CLK_GLOBAL_MEM_FENCE 0
 
 #define FLOAT3(x, y, z) (float3){x, y, z}
-#define FLOAT4(x, y, z, w) (float4){x, y, z, w};
-#define INT2(x, y) (int2){x, y};
+#define FLOAT4(x, y, z, w) (float4){x, y, z, w}
+#define INT2(x, y) (int2){x, y}
+
+#ifndef panic_on
+#define panic_on(expr, msg)                                    \
+	do {                                                   \
+		if (expr) {                                    \
+			std::cerr << "panic: " << msg << '\n'; \
+			std::abort();                          \
+		}                                              \
+	} while (false)
+#endif /* panic_on */
 
 typedef unsigned int *image2d_t;
 
@@ -21,13 +38,22 @@ using std::max;
 using std::min;
 using std::sqrt;
 using std::abs;
-
+using std::cos;
+using std::sin;
+using std::log;
+
+/**
+ * __dimention_manager holds work-item ids of currently executed kernel
+ * instance. Every host thread has its own copy, so kernels can be executed
+ * from several threads at once (see executor.hpp)
+ */
 struct __dimention_manager {
 	int x;
 	int y;
+	int l;
 };
 
-inline __dimention_manager __dim{ 0, 0 };
+inline thread_local __dimention_manager __dim{ 0, 0, 0 };
 
 __inline unsigned int get_global_id(unsigned int dim)
 {
@@ -40,6 +66,25 @@ __inline unsigned int get_global_id(unsigned int dim)
 	}
 }
 
+__inline unsigned int get_local_id(unsigned int dim)
+{
+	if (dim <= 2) {
+		return __dim.l;
+	} else {
+		std::abort();
+	}
+}
+
+__inline void barrier(int flags)
+{
+	(void)flags;
+}
+
+__inline unsigned int atomic_inc(volatile unsigned int *p)
+{
+	return __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+}
+
 struct float3 {
 	float x;
 	float y;
@@ -75,12 +120,17 @@ struct float3 {
 		x *= f, y *= f, z *= f;
 	}
 
-	float3 mul(float3 f)
+	float3 mul(float3 f) const
 	{
 		return { x * f.x, y * f.y, z * f.z };
 	}
 };
 
+__inline float3 operator*(float f, float3 v)
+{
+	return v * f;
+}
+
 struct float4 {
 	float x;
 	float y;
@@ -113,6 +163,16 @@ __inline float3 vec_mul_arch(float3 a, float3 b)
 	return a.mul(b);
 }
 
+__inline float3 pow(float3 v, float p)
+{
+	return { std::pow(v.x, p), std::pow(v.y, p), std::pow(v.z, p) };
+}
+
+__inline float3 fmin(float f, float3 v)
+{
+	return { std::fmin(f, v.x), std::fmin(f, v.y), std::fmin(f, v.z) };
+}
+
 __inline void write_imagef(image2d_t canvas, const int2 coords, const float4 fcolor)
 {
 	unsigned int blue = (int)(fcolor.z * 255);
@@ -126,4 +186,13 @@ __inline void write_imagef(image2d_t canvas, const int2 coords, const float4 fco
 	canvas[coords.y * SCREEN_WIDTH + coords.x] = red | green | blue;
 }
 
+__inline float4 read_imagef(image2d_t canvas, const int2 coords)
+{
+	unsigned int color = canvas[coords.y * SCREEN_WIDTH + coords.x];
+
+	return { (float)((color >> 16) & 0xFF) / 255.0f,
+		 (float)((color >> 8) & 0xFF) / 255.0f,
+		 (float)(color & 0xFF) / 255.0f, 1.0f };
+}
+
 #endif /* CLCPP_HPP */
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <denoise.h>
+
+/**
+ * create_denoiser() creates filter kernels and buffers for image of given
+ * size
+ *
+ * @param kernel any kernel of program built from source/denoise.cl, with
+ * 	SCREEN_WIDTH and SCREEN_HEIGHT equal to width and height
+ * @param iterations number of filter iterations, taps of the last one are
+ * 	2^(iterations - 1) pixels apart
+ */
+denoiser_t create_denoiser(context_t context, kernel_t kernel,
+			   unsigned int width, unsigned int height,
+			   unsigned int iterations)
+{
+	size_t pixels = (size_t)width * height;
+	denoiser_t denoiser = {
+		.__init = create_program_kernel(kernel, "denoiseInitKernel"),
+		.__filter = create_program_kernel(kernel, "denoiseKernel"),
+		.__pixels = {
+			create_buffer(context, read_write | no_access,
+				      pixels * sizeof(cl_float4)),
+			create_buffer(context, read_write | no_access,
+				      pixels * sizeof(cl_float4)),
+		},
+		.__iterations = iterations,
+	};
+
+	set_kernel_arg_at(denoiser.__init, denoiser.__pixels[0], 3);
+	set_kernel_size_2d(denoiser.__init, width, height);
+	set_kernel_size_2d(denoiser.__filter, width, height);
+	return denoiser;
+}
+
+void destroy_denoiser(denoiser_t *denoiser)
+{
+	release_buffer(denoiser->__pixels[0]);
+	release_buffer(denoiser->__pixels[1]);
+	release_kernel(denoiser->__init);
+	release_kernel(denoiser->__filter);
+}
+
+/**
+ * set_denoiser_args() binds accumulated image to be filtered and its features
+ *
+ * @param accum accumulation buffer of runKernel()
+ * @param moments second moments of pixels luminance
+ * @param features pixel features runKernel() writes
+ */
+void set_denoiser_args(denoiser_t *denoiser, buffer_t accum, buffer_t moments,
+		       buffer_t features)
+{
+	set_kernel_arg_at(denoiser->__init, accum, 0);
+	set_kernel_arg_at(denoiser->__init, moments, 1);
+	set_kernel_arg_at(denoiser->__init, features, 2);
+	set_kernel_arg_at(denoiser->__filter, features, 2);
+}
+
+/**
+ * run_denoiser() enqueues filtering of accumulated image, nothing waits for
+ * device
+ *
+ * @return buffer filtered image is left in, color of pixel is in xyz of its
+ * 	float4
+ */
+buffer_t run_denoiser(queue_t queue, denoiser_t *denoiser)
+{
+	run_kernel(queue, denoiser->__init);
+	for (unsigned int i = 0; i < denoiser->__iterations; ++i) {
+		cl_int step = 1 << i;
+
+		set_kernel_arg_at(denoiser->__filter, denoiser->__pixels[i & 1],
+				  0);
+		set_kernel_arg_at(denoiser->__filter,
+				  denoiser->__pixels[(i + 1) & 1], 1);
+		set_kernel_arg_at(denoiser->__filter, step, 3);
+		run_kernel(queue, denoiser->__filter);
+	}
+	return denoiser->__pixels[denoiser->__iterations & 1];
+}
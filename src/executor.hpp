@@ -0,0 +1,218 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <clcpp.hpp>
+
+#ifndef EXECUTOR_TILE_SIZE
+#define EXECUTOR_TILE_SIZE 16
+#endif
+
+/**
+ * executor_threads() returns number of worker threads used by CPU backend.
+ * Can be overriden with CLCPP_THREADS environment variable
+ */
+__inline unsigned int executor_threads(void)
+{
+	const char *env = std::getenv("CLCPP_THREADS");
+	unsigned int threads = 0;
+
+	if (env != nullptr) {
+		threads = std::strtoul(env, nullptr, 10);
+	}
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	return max(threads, 1u);
+}
+
+/**
+ * tile_pool executes 2-dimentional NDRange of clcpp kernel on host threads.
+ * NDRange is split in EXECUTOR_TILE_SIZE square tiles, which are distributed
+ * between worker queues in contiguous blocks. Worker which ran out of tiles
+ * steals them from the front of other workers queues. Every worker sets its
+ * own thread-local work-item ids before calling kernel, so kernel code sees
+ * the same get_global_id() values as in serial execution
+ */
+class tile_pool {
+public:
+	typedef std::function<void()> kernel_fn;
+	typedef std::function<void(size_t done, size_t total)> progress_fn;
+
+	explicit tile_pool(unsigned int threads)
+		: __queues(threads)
+		, __fn(nullptr)
+		, __generation(0)
+		, __remaining(0)
+		, __exit(false)
+	{
+		for (unsigned int i = 0; i < threads; ++i) {
+			__threads.emplace_back(&tile_pool::__worker, this, i);
+		}
+	}
+
+	~tile_pool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(__lock);
+			__exit = true;
+		}
+		__start.notify_all();
+		for (std::thread &thread : __threads) {
+			thread.join();
+		}
+	}
+
+	tile_pool(const tile_pool &) = delete;
+	tile_pool &operator=(const tile_pool &) = delete;
+
+	/**
+	 * run_2d() executes kernel for every work-item in [0, width) x
+	 * [0, height) range and returns when all of them are done
+	 *
+	 * @param width global size of NDRange in dimention 0
+	 * @param height global size of NDRange in dimention 1
+	 * @param kernel functor called once per work-item
+	 * @param progress optional callback periodically called from the
+	 * 	calling thread with number of finished tiles
+	 */
+	void run_2d(unsigned int width, unsigned int height,
+		    const kernel_fn &kernel,
+		    const progress_fn &progress = nullptr)
+	{
+		std::vector<__tile> tiles;
+		size_t workers = __queues.size();
+
+		for (unsigned int y = 0; y < height; y += EXECUTOR_TILE_SIZE) {
+			for (unsigned int x = 0; x < width;
+			     x += EXECUTOR_TILE_SIZE) {
+				tiles.push_back(
+					{ x, y, min(x + EXECUTOR_TILE_SIZE, width),
+					  min(y + EXECUTOR_TILE_SIZE, height) });
+			}
+		}
+		if (tiles.empty()) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> guard(__lock);
+		__fn = &kernel;
+		__remaining = tiles.size();
+		for (size_t i = 0; i < workers; ++i) {
+			size_t begin = tiles.size() * i / workers;
+			size_t end = tiles.size() * (i + 1) / workers;
+			std::lock_guard<std::mutex> queue_guard(__queues[i].lock);
+
+			__queues[i].tiles.assign(tiles.begin() + begin,
+						 tiles.begin() + end);
+		}
+		++__generation;
+		__start.notify_all();
+
+		while (!__done.wait_for(guard, std::chrono::milliseconds(100),
+					[this] { return __remaining == 0; })) {
+			if (progress) {
+				progress(tiles.size() - __remaining,
+					 tiles.size());
+			}
+		}
+		__fn = nullptr;
+	}
+
+private:
+	struct __tile {
+		unsigned int x0;
+		unsigned int y0;
+		unsigned int x1;
+		unsigned int y1;
+	};
+
+	struct __queue {
+		std::mutex lock;
+		std::deque<__tile> tiles;
+	};
+
+	bool __pop(size_t id, __tile &tile)
+	{
+		std::lock_guard<std::mutex> guard(__queues[id].lock);
+
+		if (__queues[id].tiles.empty()) {
+			return false;
+		}
+		tile = __queues[id].tiles.back();
+		__queues[id].tiles.pop_back();
+		return true;
+	}
+
+	bool __steal(size_t id, __tile &tile)
+	{
+		for (size_t i = 1; i < __queues.size(); ++i) {
+			__queue &victim = __queues[(id + i) % __queues.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+
+			if (!victim.tiles.empty()) {
+				tile = victim.tiles.front();
+				victim.tiles.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void __execute(const __tile &tile)
+	{
+		for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+			for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+				__dim = { (int)x, (int)y, 0 };
+				(*__fn)();
+			}
+		}
+	}
+
+	void __worker(size_t id)
+	{
+		unsigned long seen = 0;
+		__tile tile;
+
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(__lock);
+				__start.wait(guard, [&] {
+					return __exit || __generation != seen;
+				});
+				if (__exit) {
+					return;
+				}
+				seen = __generation;
+			}
+			while (__pop(id, tile) || __steal(id, tile)) {
+				__execute(tile);
+				if (--__remaining == 0) {
+					std::lock_guard<std::mutex> guard(__lock);
+					__done.notify_all();
+				}
+			}
+		}
+	}
+
+	std::vector<__queue> __queues;
+	std::vector<std::thread> __threads;
+	std::mutex __lock;
+	std::condition_variable __start;
+	std::condition_variable __done;
+	const kernel_fn *__fn;
+	unsigned long __generation;
+	std::atomic<size_t> __remaining;
+	bool __exit;
+};
+
+#endif /* EXECUTOR_HPP */
@@ -0,0 +1,181 @@
+#include <stdint.h>
+
+#include <image.h>
+
+/**
+ * image_format_from_path() chooses image format by file extension
+ *
+ * @return false if extension is not one of .ppm, .pfm or .exr
+ */
+bool image_format_from_path(const char *path, enum image_format *format)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (ext == NULL) {
+		return false;
+	}
+	if (strcmp(ext, ".ppm") == 0) {
+		*format = image_ppm;
+	} else if (strcmp(ext, ".pfm") == 0) {
+		*format = image_pfm;
+	} else if (strcmp(ext, ".exr") == 0) {
+		*format = image_exr;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static __always_inline const float *__pixel(const float *rgba,
+					    unsigned int width,
+					    unsigned int height, unsigned int x,
+					    unsigned int row)
+{
+	/* rows are stored bottom to top, as kernel writes them */
+	return &rgba[((height - row - 1) * width + x) * 4];
+}
+
+static void __write_ppm(FILE *file, const float *rgba, unsigned int width,
+			unsigned int height)
+{
+	unsigned char line[width * 3];
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	for (unsigned int y = 0; y < height; ++y) {
+		for (unsigned int x = 0; x < width; ++x) {
+			const float *pixel = __pixel(rgba, width, height, x, y);
+
+			for (int c = 0; c < 3; ++c) {
+				float value = pixel[c] < 0 ? 0 :
+					      pixel[c] > 1 ? 1 :
+							     pixel[c];
+
+				line[x * 3 + c] = (unsigned char)(value * 255 +
+								  0.5f);
+			}
+		}
+		panic_on(fwrite(line, sizeof(line), 1, file) != 1, "fwrite");
+	}
+}
+
+static void __write_pfm(FILE *file, const float *rgba, unsigned int width,
+			unsigned int height)
+{
+	float line[width * 3];
+
+	/* negative scale marks little-endian data, rows go bottom to top */
+	fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+	for (unsigned int y = 0; y < height; ++y) {
+		for (unsigned int x = 0; x < width; ++x) {
+			memcpy(&line[x * 3], &rgba[(y * width + x) * 4],
+			       3 * sizeof(float));
+		}
+		panic_on(fwrite(line, sizeof(line), 1, file) != 1, "fwrite");
+	}
+}
+
+static void __exr_attr(FILE *file, const char *name, const char *type,
+		       const void *value, uint32_t size)
+{
+	fwrite(name, strlen(name) + 1, 1, file);
+	fwrite(type, strlen(type) + 1, 1, file);
+	fwrite(&size, sizeof(size), 1, file);
+	fwrite(value, size, 1, file);
+}
+
+/**
+ * __write_exr() writes single-part scanline OpenEXR file without compression,
+ * one scanline per block. Only attributes required by the format are written.
+ * Multi-byte values are written in host order, which is little-endian on all
+ * supported hosts
+ */
+static void __write_exr(FILE *file, const float *rgba, unsigned int width,
+			unsigned int height)
+{
+	const uint32_t magic = 20000630;
+	const uint32_t version = 2;
+	const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+	const float aspect = 1;
+	const float center[2] = { 0, 0 };
+	const unsigned char zero = 0;
+	/* name, pixel type float, pLinear and reserved, x and y sampling */
+	unsigned char channels[3 * 18 + 1];
+	const uint32_t line_size = width * 3 * sizeof(float);
+	float line[width];
+	uint64_t offset;
+
+	for (int c = 0; c < 3; ++c) {
+		unsigned char *channel = &channels[c * 18];
+		const int32_t info[4] = { 2, 0, 1, 1 };
+
+		/* channels are sorted by name */
+		channel[0] = "BGR"[c];
+		channel[1] = '\0';
+		memcpy(&channel[2], info, sizeof(info));
+	}
+	channels[3 * 18] = '\0';
+
+	fwrite(&magic, sizeof(magic), 1, file);
+	fwrite(&version, sizeof(version), 1, file);
+	__exr_attr(file, "channels", "chlist", channels, sizeof(channels));
+	__exr_attr(file, "compression", "compression", &zero, 1);
+	__exr_attr(file, "dataWindow", "box2i", window, sizeof(window));
+	__exr_attr(file, "displayWindow", "box2i", window, sizeof(window));
+	__exr_attr(file, "lineOrder", "lineOrder", &zero, 1);
+	__exr_attr(file, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+	__exr_attr(file, "screenWindowCenter", "v2f", center, sizeof(center));
+	__exr_attr(file, "screenWindowWidth", "float", &aspect,
+		   sizeof(aspect));
+	fwrite(&zero, 1, 1, file);
+
+	offset = ftell(file) + height * sizeof(uint64_t);
+	for (unsigned int y = 0; y < height; ++y) {
+		fwrite(&offset, sizeof(offset), 1, file);
+		offset += 2 * sizeof(int32_t) + line_size;
+	}
+
+	for (unsigned int y = 0; y < height; ++y) {
+		const int32_t row = y;
+
+		fwrite(&row, sizeof(row), 1, file);
+		fwrite(&line_size, sizeof(line_size), 1, file);
+		for (int c = 2; c >= 0; --c) {
+			for (unsigned int x = 0; x < width; ++x) {
+				line[x] = __pixel(rgba, width, height, x,
+						  y)[c];
+			}
+			panic_on(fwrite(line, sizeof(line), 1, file) != 1,
+				 "fwrite");
+		}
+	}
+}
+
+/**
+ * write_image() saves rgb part of image to file
+ *
+ * @param path path of created file
+ * @param format file format
+ * @param rgba pixels with 4 floats per pixel, rows are stored from bottom to
+ * 	top
+ * @param width image width
+ * @param height image height
+ */
+void write_image(const char *path, enum image_format format, const float *rgba,
+		 unsigned int width, unsigned int height)
+{
+	FILE *file = fopen(path, "wb");
+
+	panic_on(file == NULL, "fopen");
+	switch (format) {
+	case image_ppm:
+		__write_ppm(file, rgba, width, height);
+		break;
+	case image_pfm:
+		__write_pfm(file, rgba, width, height);
+		break;
+	case image_exr:
+		__write_exr(file, rgba, width, height);
+		break;
+	}
+	panic_on(fclose(file) != 0, "fclose");
+}
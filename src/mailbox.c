@@ -0,0 +1,70 @@
+#include <mailbox.h>
+
+#define MAILBOX_SLOTS 3
+/* shared slot index is ORed with it when writer publishes slot */
+#define MAILBOX_FRESH 4u
+
+/**
+ * create_mailbox() creates mailbox of zeroed snapshots
+ *
+ * @param size size of snapshot in bytes
+ */
+mailbox_t create_mailbox(size_t size)
+{
+	mailbox_t mailbox = {
+		.__slots = calloc(MAILBOX_SLOTS, size),
+		.__size = size,
+		.__write = 0,
+		.__read = 1,
+	};
+
+	panic_on(mailbox.__slots == NULL, "calloc");
+	atomic_init(&mailbox.__shared, 2);
+	return mailbox;
+}
+
+void destroy_mailbox(mailbox_t *mailbox)
+{
+	free(mailbox->__slots);
+}
+
+/**
+ * mailbox_slot() returns slot writer fills next snapshot in. Its content is
+ * stale, snapshot must be written whole
+ */
+void *mailbox_slot(mailbox_t *mailbox)
+{
+	return mailbox->__slots + mailbox->__write * mailbox->__size;
+}
+
+/**
+ * mailbox_publish() makes snapshot written to mailbox_slot() the latest one,
+ * snapshot published before is dropped if reader has not taken it
+ */
+void mailbox_publish(mailbox_t *mailbox)
+{
+	unsigned int prev = atomic_exchange_explicit(&mailbox->__shared,
+						     mailbox->__write |
+							     MAILBOX_FRESH,
+						     memory_order_acq_rel);
+
+	mailbox->__write = prev & ~MAILBOX_FRESH;
+}
+
+/**
+ * mailbox_latest() returns the latest published snapshot. It stays valid until
+ * next call, if nothing was published since previous call, the same snapshot
+ * is returned again
+ */
+const void *mailbox_latest(mailbox_t *mailbox)
+{
+	if (atomic_load_explicit(&mailbox->__shared, memory_order_relaxed) &
+	    MAILBOX_FRESH) {
+		unsigned int prev = atomic_exchange_explicit(
+			&mailbox->__shared, mailbox->__read,
+			memory_order_acq_rel);
+
+		mailbox->__read = prev & ~MAILBOX_FRESH;
+	}
+	return mailbox->__slots + mailbox->__read * mailbox->__size;
+}
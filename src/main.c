@@ -2,21 +2,69 @@
 #include <winlib/winlib.h>
 #include <cllib/cllib.h>
 #include <clgl.h>
+#include <pthread.h>
 #include <time.h>
 
 typedef cl_float3 float3;
 #define FLOAT3(X, Y, Z)(float3){ .x = X, .y = Y, .z = Z }
 #include "source/struct.cl"
 
+#include <denoise.h>
 #include <linalg.h>
+#include <mailbox.h>
+#include <reproject.h>
+#include <scene.h>
 
 #define MULTIRAY false
-#define TRACER_MOVE_STEP 0.1
-#define TRACER_LOOK_STEP (PI / 200.0)
+/*
+ * rate input is sampled and camera is moved at in Hz, it does not depend on
+ * rendering frame rate
+ */
+#define TRACER_INPUT_RATE 240.0
+/* camera moves by this distance per second */
+#define TRACER_MOVE_SPEED 3.0
+/* arrow keys turn camera by this angle per second */
+#define TRACER_LOOK_SPEED (PI * 0.15)
 #define TRACER_MOUSE_LOOK_STEP (1e-3)
 
-#define SPHERES_NUM 6
-#define SUN_DIRECTION normalize(FLOAT3(-1, 0.5, -0.3))
+/*
+ * frames enqueued before the oldest one is displayed, frame N is drawn while
+ * kernel of frame N + TRACER_FRAMES_IN_FLIGHT - 1 runs
+ */
+#define TRACER_FRAMES_IN_FLIGHT 2
+static_assert(TRACER_FRAMES_IN_FLIGHT >= 2 &&
+		      TRACER_FRAMES_IN_FLIGHT <= CLGL_MAX_TEXTURES,
+	      "displayed texture can not be written by next frame");
+
+/* frames between profiling reports when TRACER_PROFILE is set */
+#define TRACER_PROFILE_FRAMES 500
+
+/*
+ * work-groups per compute unit run by persistentKernel, TRACER_PERSISTENT
+ * environment variable enables it and may override this number
+ */
+#define TRACER_PERSISTENT_GROUPS 4
+
+/*
+ * bounces path makes at most, kept shallow so interactive frames are fast,
+ * TRACER_DEPTH environment variable overrides it
+ */
+#define TRACER_MAX_DEPTH 4
+
+/*
+ * filter iterations of denoiser, TRACER_DENOISE environment variable turns it
+ * on and may override this number, N key toggles it
+ */
+#define TRACER_DENOISE_ITERATIONS 4
+
+/*
+ * scene buffers are cut from device allocations of this size, so buffers
+ * replaced when scene grows are reused instead of allocated again
+ */
+#define TRACER_POOL_BLOCK (1 << 20)
+
+/* persistent kernel tile counter is reset from it before every frame */
+static const cl_uint g_zero_counter = 0;
 
 struct Camera {
 	float3 position;
@@ -25,22 +73,44 @@ struct Camera {
 	struct RotateMatrix matrix;
 };
 
+/*
+ * tracer_state is owned by main thread, GLFW callbacks and move_camera()
+ * update it there and publish_tracer_state() passes its snapshot to render
+ * thread
+ */
 struct tracer_state {
 	struct Camera camera;
-	float3 move_step;
-	float look_step[2];
+	/* direction of movement in camera space, set by held keys */
+	float3 move_dir;
+	/* direction of turn, set by held arrow keys */
+	float look_dir[2];
 	float mouse_pos[2];
 	bool mouse_move;
+	int viewport[2];
 	cl_int reset_frame;
+	bool denoise;
+	bool exit;
+};
+
+/*
+ * tracer_snapshot is the part of tracer_state render thread uses, main thread
+ * publishes it through mailbox_t after every input tick
+ */
+struct tracer_snapshot {
+	struct Camera camera;
+	int viewport[2];
+	cl_int reset_frame;
+	bool denoise;
 	bool exit;
 };
 
 struct tracer_state g_tracer_state = {
 	.camera = { .position = FLOAT3(4, 2.5, -3.5), .alpha = -0.5, .theta = 0.3 },
-	.move_step = FLOAT3(0, 0, 0),
-	.look_step = { 0, 0 },
+	.move_dir = FLOAT3(0, 0, 0),
+	.look_dir = { 0, 0 },
 	.mouse_move = false,
-	.reset_frame = 1,
+	.reset_frame = 0,
+	.denoise = false,
 	.exit = false
 };
 
@@ -54,28 +124,30 @@ static void key_callback(GLFWwindow *wind, int key, int scancode, int action,
 	if (action == GLFW_PRESS) {
 		switch (key) {
 		case GLFW_KEY_W:
-			g_tracer_state.move_step.z += TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.z += 1; break;
 		case GLFW_KEY_S:
-			g_tracer_state.move_step.z += -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.z += -1; break;
 		case GLFW_KEY_A:
-			g_tracer_state.move_step.x += -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.x += -1; break;
 		case GLFW_KEY_D:
-			g_tracer_state.move_step.x += TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.x += 1; break;
 		case GLFW_KEY_SPACE:
-			g_tracer_state.move_step.y += TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.y += 1; break;
 		case GLFW_KEY_LEFT_CONTROL:
 		case GLFW_KEY_RIGHT_CONTROL:
-			g_tracer_state.move_step.y += -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.y += -1; break;
 		case GLFW_KEY_UP:
-			g_tracer_state.look_step[0] += -TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[0] += -1; break;
 		case GLFW_KEY_DOWN:
-			g_tracer_state.look_step[0] += TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[0] += 1; break;
 		case GLFW_KEY_LEFT:
-			g_tracer_state.look_step[1] += -TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[1] += -1; break;
 		case GLFW_KEY_RIGHT:
-			g_tracer_state.look_step[1] += TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[1] += 1; break;
 		case GLFW_KEY_ENTER:
 			g_tracer_state.reset_frame ^= 1; break;
+		case GLFW_KEY_N:
+			g_tracer_state.denoise ^= true; break;
 		case GLFW_KEY_P: {
 			float3 p = g_tracer_state.camera.position;
 			float alpha = g_tracer_state.camera.alpha;
@@ -89,26 +161,26 @@ static void key_callback(GLFWwindow *wind, int key, int scancode, int action,
 	} else if (action == GLFW_RELEASE) {
 		switch (key) {
 		case GLFW_KEY_W:
-			g_tracer_state.move_step.z -= TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.z -= 1; break;
 		case GLFW_KEY_S:
-			g_tracer_state.move_step.z -= -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.z -= -1; break;
 		case GLFW_KEY_A:
-			g_tracer_state.move_step.x -= -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.x -= -1; break;
 		case GLFW_KEY_D:
-			g_tracer_state.move_step.x -= TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.x -= 1; break;
 		case GLFW_KEY_SPACE:
-			g_tracer_state.move_step.y -= TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.y -= 1; break;
 		case GLFW_KEY_LEFT_CONTROL:
 		case GLFW_KEY_RIGHT_CONTROL:
-			g_tracer_state.move_step.y -= -TRACER_MOVE_STEP; break;
+			g_tracer_state.move_dir.y -= -1; break;
 		case GLFW_KEY_UP:
-			g_tracer_state.look_step[0] -= -TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[0] -= -1; break;
 		case GLFW_KEY_DOWN:
-			g_tracer_state.look_step[0] -= TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[0] -= 1; break;
 		case GLFW_KEY_LEFT:
-			g_tracer_state.look_step[1] -= -TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[1] -= -1; break;
 		case GLFW_KEY_RIGHT:
-			g_tracer_state.look_step[1] -= TRACER_LOOK_STEP; break;
+			g_tracer_state.look_dir[1] -= 1; break;
 		case GLFW_KEY_ESCAPE:
 			g_tracer_state.exit = true; break;
 		}
@@ -130,18 +202,26 @@ static void mouse_callback(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
-void move_camera(GLFWwindow *window)
+/**
+ * move_camera() integrates camera movement over time passed since previous
+ * input tick, so camera speed does not depend on tick or frame rate
+ *
+ * @param dt seconds passed since previous call
+ */
+void move_camera(GLFWwindow *window, double dt)
 {
-	float3 move_step = g_tracer_state.move_step;
+	struct Camera *camera = &g_tracer_state.camera;
+	float3 move_step = g_tracer_state.move_dir;
+	float move = TRACER_MOVE_SPEED * dt;
+	float look = TRACER_LOOK_SPEED * dt;
 
-	compute_rotation_matrix(&g_tracer_state.camera.matrix,
-				g_tracer_state.camera.alpha,
-				g_tracer_state.camera.theta);
-	rotate_vector(&move_step, &g_tracer_state.camera.matrix);
-	vec_iadd(&g_tracer_state.camera.position, move_step);
+	move_step = FLOAT3(move_step.x * move, move_step.y * move,
+			   move_step.z * move);
+	rotate_vector(&move_step, &camera->matrix);
+	vec_iadd(&camera->position, move_step);
 
-	g_tracer_state.camera.theta += g_tracer_state.look_step[0];
-	g_tracer_state.camera.alpha += g_tracer_state.look_step[1];
+	camera->theta += g_tracer_state.look_dir[0] * look;
+	camera->alpha += g_tracer_state.look_dir[1] * look;
 
 	if (g_tracer_state.mouse_move) {
 		double x, y;
@@ -150,56 +230,165 @@ void move_camera(GLFWwindow *window)
 		float dx = (float)x - g_tracer_state.mouse_pos[0];
 		float dy = (float)y - g_tracer_state.mouse_pos[1];
 
-		g_tracer_state.camera.alpha += dx * TRACER_MOUSE_LOOK_STEP;
-		g_tracer_state.camera.theta += dy * TRACER_MOUSE_LOOK_STEP;
+		camera->alpha += dx * TRACER_MOUSE_LOOK_STEP;
+		camera->theta += dy * TRACER_MOUSE_LOOK_STEP;
 
 		g_tracer_state.mouse_pos[0] = x;
 		g_tracer_state.mouse_pos[1] = y;
 	}
+	compute_rotation_matrix(&camera->matrix, camera->alpha, camera->theta);
+}
+
+/**
+ * publish_tracer_state() passes snapshot of tracer state to render thread
+ */
+static void publish_tracer_state(mailbox_t *mailbox)
+{
+	struct tracer_snapshot *snapshot = mailbox_slot(mailbox);
+
+	snapshot->camera = g_tracer_state.camera;
+	snapshot->viewport[0] = g_tracer_state.viewport[0];
+	snapshot->viewport[1] = g_tracer_state.viewport[1];
+	snapshot->reset_frame = g_tracer_state.reset_frame;
+	snapshot->denoise = g_tracer_state.denoise;
+	snapshot->exit = g_tracer_state.exit;
+	mailbox_publish(mailbox);
 }
 
-static bool update_tracer_state(GLFWwindow *window)
+/**
+ * wait_input_tick() handles events until next input tick is due. Events wake
+ * main thread at once, so callbacks see input without waiting for tick
+ *
+ * @param next time next tick is due at, advanced to the one after it
+ */
+static void wait_input_tick(double *next)
 {
-	if (g_tracer_state.exit) {
-		return true;
+	double now;
+
+	while ((now = glfwGetTime()) < *next) {
+		glfwWaitEventsTimeout(*next - now);
 	}
-	move_camera(window);
+	*next += 1.0 / TRACER_INPUT_RATE;
+	// ticks missed by stalled thread are skipped, dt covers them
+	if (*next < now) {
+		*next = now + 1.0 / TRACER_INPUT_RATE;
+	}
+}
 
-	return false;
+/**
+ * camera_moved() returns true if camera sees scene from other position or
+ * direction than previous camera
+ */
+static bool camera_moved(const struct Camera *prev, const struct Camera *cur)
+{
+	return !vec_equal(prev->position, cur->position) ||
+	       !vec_equal(prev->matrix.row1, cur->matrix.row1) ||
+	       !vec_equal(prev->matrix.row2, cur->matrix.row2) ||
+	       !vec_equal(prev->matrix.row3, cur->matrix.row3);
 }
 
+/*
+ * GL context is current on render thread, so viewport is set there from
+ * published snapshot
+ */
 static void framebuffer_size_callback(GLFWwindow *wind, int width, int height)
 {
 	(void)wind;
-	glViewport(0, 0, width, height);
+	g_tracer_state.viewport[0] = width;
+	g_tracer_state.viewport[1] = height;
 }
 
-void compute(queue_t queue, buffer_t image, kernel_t kernel)
+/**
+ * rank_interop_device() ranks only devices which share textures with GL
+ * context, so traced image is never copied through host. Devices waiting for
+ * GL fence themselves are preferred, host does not stall in glFinish() then
+ */
+static long rank_interop_device(const struct device_info *info)
 {
-	cl_command_queue qe = queue.__queue;
-	cl_mem img = image.__buffer;
+	if (!info->gl_sharing) {
+		return -1;
+	}
+	return device_rank_throughput(info) * (info->gl_event ? 2 : 1);
+}
 
+/**
+ * frame_t is one of TRACER_FRAMES_IN_FLIGHT frames, each frame has its own
+ * texture, so kernel of next frame runs while previous one is displayed
+ */
+typedef struct {
+	buffer_t image;
+	/* release of frame texture by OpenCL, frame is ready when completed */
+	cl_event done;
+	/* GL fence acquire of frame texture waited on */
+	cl_event fence_event;
+	GLsync fence;
+} frame_t;
+
+/**
+ * compute() enqueues path tracing to accumulation buffer and resolve of it to
+ * texture of frame `cur` without waiting for them. If reprojection is not
+ * NULL, its saved history is merged into traced frame. If denoiser is not
+ * NULL, filtered accumulation buffer is resolved. GL commands issued before,
+ * like drawing of the texture, are finished before texture is acquired
+ */
+void compute(queue_t queue, gl_sync_t *sync, frame_t *cur, kernel_t kernel,
+	     reprojection_t *reprojection, buffer_t accum,
+	     denoiser_t *denoiser, kernel_t resolve)
+{
+	cl_command_queue qe = queue.__queue;
+	cl_mem img = cur->image.__buffer;
 	cl_event event;
 	cl_int err;
 
-	glFinish();
+	run_kernel(queue, kernel);
+	if (reprojection != NULL) {
+		run_reprojection(queue, reprojection);
+	}
+	if (denoiser != NULL) {
+		accum = run_denoiser(queue, denoiser);
+	}
+	set_kernel_arg_at(resolve, accum, 1);
+
+	gl_sync_release(cur->fence_event, cur->fence);
+	cur->fence_event = gl_sync_fence(sync, &cur->fence);
 
-	err = clEnqueueAcquireGLObjects(qe, 1, &img, 0, NULL, &event);
+	err = clEnqueueAcquireGLObjects(qe, 1, &img,
+					cur->fence_event != NULL ? 1 : 0,
+					cur->fence_event != NULL ?
+						&cur->fence_event :
+						NULL,
+					&event);
 	cl_panic_on(err, "clEnqueueAcquireGLObjects", err);
+	profile_event(queue, "gl acquire", event);
+	clReleaseEvent(event);
 
-	err = clWaitForEvents(1, &event);
-	cl_panic_on(err, "clWaitForEvents", err);
+	run_kernel(queue, resolve);
 
-	run_kernel(queue, kernel);
+	err = clEnqueueReleaseGLObjects(qe, 1, &img, 0, NULL, &cur->done);
+	cl_panic_on(err, "clEnqueueReleaseGLObjects", err);
+	profile_event(queue, "gl release", cur->done);
 
-	err = clEnqueueReleaseGLObjects(qe, 1, &img, 0, NULL, &event);
-	cl_panic_on(err, "clWaitForEvents", err);
+	flush_queue(queue);
+}
+
+/**
+ * frame_wait() waits until frame texture is released by OpenCL and can be
+ * used by GL
+ */
+static void frame_wait(frame_t *frame)
+{
+	cl_int err;
 
-	err = clWaitForEvents(1, &event);
+	if (frame->done == NULL) {
+		return;
+	}
+	err = clWaitForEvents(1, &frame->done);
 	cl_panic_on(err, "clWaitForEvents", err);
+	clReleaseEvent(frame->done);
+	frame->done = NULL;
 }
 
-void render(shader_t shader)
+void render(shader_t shader, unsigned int index)
 {
 	const float matrix[] = {
 		1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
@@ -207,7 +396,7 @@ void render(shader_t shader)
 	};
 
 	GLuint program = shader.__program;
-	GLuint texture = shader.__texture;
+	GLuint texture = shader.__textures[index];
 	GLuint vao = shader.__vao;
 	GLint mat_loc, tex_loc;
 
@@ -230,24 +419,6 @@ void render(shader_t shader)
 	glBindVertexArray(0);
 }
 
-static buffer_t create_scene(context_t context, queue_t queue)
-{
-	struct Sphere spheres[SPHERES_NUM];
-	buffer_t scene;
-
-	// color, position, emission radius, reflective
-	spheres[0] = (struct Sphere){ WHITE, FLOAT3(3, -0.1, 7), 0, 1.5, 0.95, 0.0 };
-	spheres[1] = (struct Sphere){ LRED, FLOAT3(1.4, -0.2, 4.5), 0.0, 1, 0.0, 0.00 };
-	spheres[2] = (struct Sphere){ LGREEN, FLOAT3(0, -0.3, 3), 0.0, 0.8, 0.0, 0.0 };
-	spheres[3] = (struct Sphere){ LBLUE, FLOAT3(-1, -0.55, 2), 0.0, 0.5, 0.0, 0.0 };
-	spheres[4] = (struct Sphere){ GREY, FLOAT3(-1.8, -0.75, 1.3), 0, 0.3, 0.0, 0.0 };
-	spheres[5] = (struct Sphere){ LPURPLE, FLOAT3(0, -50, 0), 0.0, 49, 0.0, 0.0 };
-
-	scene = create_buffer(context, read_only, sizeof(spheres));
-	fill_buffer(queue, scene, sizeof(spheres), spheres, true);
-	return scene;
-}
-
 static void announce_fps()
 {
 	static struct timespec prev;
@@ -264,6 +435,127 @@ static void announce_fps()
 	prev = cur;
 }
 
+/*
+ * renderer is everything render thread uses, main thread creates it before
+ * render thread starts and releases it after render thread exits
+ */
+struct renderer {
+	GLFWwindow *window;
+	mailbox_t *mailbox;
+	device_t device;
+	queue_t queue;
+	kernel_t kernel;
+	kernel_t resolve;
+	shader_t shader;
+	gl_sync_t sync;
+	frame_t frames[TRACER_FRAMES_IN_FLIGHT];
+	buffer_t accum;
+	scene_t *scene;
+	denoiser_t *denoiser;
+	reprojection_t *reprojection;
+	buffer_t tile_counter;
+	bool persistent;
+	/* local size of kernel is tuned before the first frame */
+	bool tune;
+	bool profile;
+};
+
+/**
+ * render_loop() is body of render thread. It traces frames with the latest
+ * camera snapshot published by main thread until snapshot asks to exit, so
+ * slow frame delays only the image, not input handling
+ */
+static void *render_loop(void *arg)
+{
+	struct renderer *r = arg;
+	unsigned int frameNumber = 1;
+	unsigned long frame = 0;
+	int viewport[2] = { 0, 0 };
+	// camera frames in accumulation buffer were traced with
+	struct Camera traced;
+
+	glfwMakeContextCurrent(r->window);
+	while (true) {
+		struct tracer_snapshot state =
+			*(const struct tracer_snapshot *)mailbox_latest(
+				r->mailbox);
+
+		if (state.exit) {
+			break;
+		}
+		if (state.viewport[0] != viewport[0] ||
+		    state.viewport[1] != viewport[1]) {
+			viewport[0] = state.viewport[0];
+			viewport[1] = state.viewport[1];
+			glViewport(0, 0, viewport[0], viewport[1]);
+		}
+		if (state.reset_frame) {
+			frameNumber = 1;
+		}
+
+		struct Camera *camera = &state.camera;
+		bool moved = frame > 0 && camera_moved(&traced, camera);
+		// history of moved camera is reprojected to traced frame
+		bool reproject = moved && !state.reset_frame;
+		cl_int reset = frame == 0 || state.reset_frame || moved;
+
+		unsigned int index = frame % TRACER_FRAMES_IN_FLIGHT;
+		frame_t *cur = &r->frames[index];
+		unsigned int shown = (frame + 1) % TRACER_FRAMES_IN_FLIGHT;
+
+		// render oldest frame, its texture is not used by next kernel
+		if (frame + 1 >= TRACER_FRAMES_IN_FLIGHT) {
+			frame_wait(&r->frames[shown]);
+			render(r->shader, shown);
+		}
+
+		if (reproject) {
+			save_reprojection_history(r->queue, r->reprojection,
+						  traced.position,
+						  traced.matrix,
+						  camera->position,
+						  camera->matrix);
+		}
+		traced = *camera;
+		set_kernel_arg_at(r->kernel, camera->position, 2);
+		set_kernel_arg_at(r->kernel, camera->matrix, 3);
+		set_kernel_arg_at(r->kernel, reset, 4);
+		set_kernel_arg_at(r->kernel, frameNumber, 5);
+		set_scene_args(&r->kernel, r->scene, 1, 6, 7);
+		set_scene_light_args(&r->kernel, r->scene, 10, 11);
+		set_kernel_arg_at(r->resolve, cur->image, 0);
+		if (r->persistent) {
+			fill_buffer(r->queue, r->tile_counter, sizeof(cl_uint),
+				    (void *)&g_zero_counter, false);
+		}
+		// tuning runs are overwritten, the first frame resets canvas
+		if (frame == 0 && r->tune) {
+			tune_kernel(r->queue, r->device, r->kernel);
+		}
+		// process call, runs while frame is swapped
+		compute(r->queue, &r->sync, cur, r->kernel,
+			reproject ? r->reprojection : NULL, r->accum,
+			state.denoise ? r->denoiser : NULL, r->resolve);
+		// swap front and back buffers
+		glfwSwapBuffers(r->window);
+
+		announce_fps();
+		++frame;
+		if (r->profile && frame % TRACER_PROFILE_FRAMES == 0) {
+			profile_dump(r->queue, stdout);
+			profile_reset(r->queue);
+		}
+		++frameNumber;
+	}
+
+	for (unsigned int i = 0; i < TRACER_FRAMES_IN_FLIGHT; ++i) {
+		frame_wait(&r->frames[i]);
+		gl_sync_release(r->frames[i].fence_event, r->frames[i].fence);
+	}
+	glfwMakeContextCurrent(NULL);
+	return NULL;
+}
+
 int main()
 {
 	srandom(time(NULL));
@@ -273,72 +565,187 @@ int main()
 	unsigned int width, height;
 	GLFWwindow *window = winlib_init(&width, &height);
 
-	device_t device = create_device(gpu_type);
+	device_t device = select_device(gpu_type, rank_interop_device);
+	struct device_info info = device_info(device);
 	context_t context = create_gl_context(device, window);
-	queue_t queue = create_queue(context, device);
+	bool profile = getenv("TRACER_PROFILE") != NULL;
+	queue_t queue = profile ? create_profiling_queue(context, device) :
+				  create_queue(context, device);
 
 	float3 sun_dir = SUN_DIRECTION;
 	printed = sprintf(compile_flags,
 			  "-I . -I source "
 			  "-D SCREEN_WIDTH=%d -D SCREEN_HEIGHT=%d "
-			  "-D SPHERES_NUM=%d -D RAYS_PER_PIXEL=%d "
+			  "-D RAYS_PER_PIXEL=%d "
 			  "-D SUN_DIRECTION=FLOAT3(%f,%f,%f)",
-			  width, height, SPHERES_NUM, RAYS_PER_PIXEL,
+			  width, height, RAYS_PER_PIXEL,
 			  sun_dir.x, sun_dir.y, sun_dir.z);
 	panic_on(printed == 0 || printed > sizeof(compile_flags),
 		 "buffer overflow");
+	device_info_dump(&info, stdout);
+	const char *persistent_env = getenv("TRACER_PERSISTENT");
+	bool persistent = persistent_env != NULL;
+	size_t persistent_local = PERSISTENT_TILE_SIZE * PERSISTENT_TILE_SIZE;
+
+	if (persistent && persistent_local > info.max_work_group_size) {
+		warn("persistent tile exceeds work-group, using runKernel");
+		persistent = false;
+	}
 	kernel_t kernel = create_kernel(device, context,
-					"#include <source/path_tracer.cl>",
-					"runKernel", compile_flags);
-
-	shader_t shader = create_shader(width, height);
-	buffer_t image = create_image(context, shader, read_write);
-
-	buffer_t scene = create_scene(context, queue);
-
-	set_kernel_arg(kernel, image);
-	set_kernel_arg(kernel, scene);
-	set_kernel_arg_at(kernel, image, 5);
+					"#include <source/denoise.cl>\n"
+					"#include <source/reproject.cl>",
+					persistent ? "persistentKernel" :
+						     "runKernel",
+					compile_flags);
+	kernel_t resolve = create_program_kernel(kernel, "resolveKernel");
+
+	shader_t shader = create_shader(width, height, TRACER_FRAMES_IN_FLIGHT);
+	gl_sync_t sync = create_gl_sync(device, context);
+
+	buffer_t accum = create_buffer(context, read_write,
+				       width * height * sizeof(cl_float4));
+	buffer_t moments = create_buffer(context, read_write,
+					 width * height * sizeof(cl_float));
+	buffer_t features = create_buffer(context, read_write | no_access,
+					  width * height *
+						  sizeof(struct PixelFeatures));
+	// adaptive sampling is used only by offline renderer
+	buffer_t no_mask = { .__buffer = NULL };
+	const char *depth_env = getenv("TRACER_DEPTH");
+	cl_uint max_depth = depth_env != NULL ?
+				    strtoul(depth_env, NULL, 10) :
+				    TRACER_MAX_DEPTH;
+	const char *denoise_env = getenv("TRACER_DENOISE");
+	unsigned int iterations = denoise_env != NULL ?
+					  strtoul(denoise_env, NULL, 10) :
+					  0;
+
+	if (iterations == 0) {
+		iterations = TRACER_DENOISE_ITERATIONS;
+	}
+	g_tracer_state.denoise = denoise_env != NULL;
+	denoiser_t denoiser = create_denoiser(context, kernel, width, height,
+					      iterations);
+	reprojection_t reprojection = create_reprojection(context, kernel,
+							  width, height);
+
+	pool_t pool = create_pool(context, device, TRACER_POOL_BLOCK);
+	scene_t scene = create_pooled_scene(&pool, queue, 8);
+
+	scene_add_demo(&scene);
+
+	set_kernel_arg_at(kernel, accum, 0);
+	set_kernel_arg_at(kernel, moments, 8);
+	set_kernel_arg_at(kernel, no_mask, 9);
+	set_kernel_arg_at(kernel, max_depth, 12);
+	set_kernel_arg_at(kernel, features, 13);
+	set_denoiser_args(&denoiser, accum, moments, features);
+	set_reprojection_args(&reprojection, accum, moments, features);
+	set_kernel_size_2d(resolve, width, height);
+
+	buffer_t tile_counter = { .__buffer = NULL };
+	if (persistent) {
+		size_t local = persistent_local;
+		unsigned int groups = strtoul(persistent_env, NULL, 10);
+
+		if (groups == 0) {
+			groups = TRACER_PERSISTENT_GROUPS;
+		}
+		groups *= info.compute_units;
+		tile_counter = create_buffer(context, read_write,
+					     sizeof(cl_uint));
+		set_kernel_arg_at(kernel, tile_counter, 14);
+		set_kernel_size_1d(kernel, groups * local);
+		set_kernel_local_size_1d(kernel, local);
+		printf("persistent kernel: %u work-groups\n", groups);
+	} else {
 #if MULTIRAY
-	set_kernel_size_3d(kernel, width, height, RAYS_PER_PIXEL);
-	set_kernel_local_size_3d(kernel, 1, 1, RAYS_PER_PIXEL);
+		set_kernel_size_3d(kernel, width, height, RAYS_PER_PIXEL);
+		set_kernel_local_size_3d(kernel, 1, 1, RAYS_PER_PIXEL);
 #else
-	set_kernel_size_2d(kernel, width, height);
+		set_kernel_size_2d(kernel, width, height);
 #endif
+	}
 
 	glfwSetKeyCallback(window, key_callback);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetMouseButtonCallback(window, mouse_callback);
 	glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
 
-	unsigned int frameNumber = 0;
-
-	while (!glfwWindowShouldClose(window)) {
-
-		if (update_tracer_state(window)) {
-			break;
-		}
-		if (g_tracer_state.reset_frame) {
-			frameNumber = 1;
-		}
-
-		set_kernel_arg_at(kernel, g_tracer_state.camera.position, 2);
-		set_kernel_arg_at(kernel, g_tracer_state.camera.matrix, 3);
-		set_kernel_arg_at(kernel, g_tracer_state.reset_frame, 4);
-		set_kernel_arg_at(kernel, frameNumber, 6);
-		// process call
-		compute(queue, image, kernel);
-		// render call
-		render(shader);
-		// swap front and back buffers
-		glfwSwapBuffers(window);
-		// poll for events
-		glfwPollEvents();
+	mailbox_t mailbox = create_mailbox(sizeof(struct tracer_snapshot));
+	struct renderer renderer = {
+		.window = window,
+		.mailbox = &mailbox,
+		.device = device,
+		.queue = queue,
+		.kernel = kernel,
+		.resolve = resolve,
+		.shader = shader,
+		.sync = sync,
+		.accum = accum,
+		.scene = &scene,
+		.denoiser = &denoiser,
+		.reprojection = &reprojection,
+		.tile_counter = tile_counter,
+		.persistent = persistent,
+		.tune = !persistent && !MULTIRAY,
+		.profile = profile,
+	};
+	pthread_t render_thread;
+	int err;
 
-		announce_fps();
-		++frameNumber;
+	for (unsigned int i = 0; i < TRACER_FRAMES_IN_FLIGHT; ++i) {
+		renderer.frames[i].image = create_image(context, shader, i,
+							read_write);
+	}
+	glfwGetFramebufferSize(window, &g_tracer_state.viewport[0],
+			       &g_tracer_state.viewport[1]);
+	// the first snapshot is published before render thread reads mailbox
+	move_camera(window, 0);
+	publish_tracer_state(&mailbox);
+
+	// GLFW handles events only on main thread, so rendering moves away
+	glfwMakeContextCurrent(NULL);
+	err = pthread_create(&render_thread, NULL, render_loop, &renderer);
+	panic_on(err != 0, "pthread_create");
+
+	double next = glfwGetTime();
+	double prev = next;
+
+	while (!glfwWindowShouldClose(window) && !g_tracer_state.exit) {
+		double now;
+
+		wait_input_tick(&next);
+		now = glfwGetTime();
+		move_camera(window, now - prev);
+		prev = now;
+		publish_tracer_state(&mailbox);
 	}
+	g_tracer_state.exit = true;
+	publish_tracer_state(&mailbox);
+	pthread_join(render_thread, NULL);
 
+	destroy_mailbox(&mailbox);
+	if (persistent) {
+		release_buffer(tile_counter);
+	}
+	destroy_reprojection(&reprojection);
+	destroy_denoiser(&denoiser);
+	release_buffer(features);
+	release_buffer(moments);
+	release_buffer(accum);
+	destroy_scene(&scene);
+	if (profile) {
+		struct pool_stats stats = pool_stats(&pool);
+
+		printf("scene pool: %zu bytes used, %zu peak, %zu reserved\n",
+		       stats.used, stats.peak, stats.reserved);
+	}
+	destroy_pool(&pool);
+	release_kernel(resolve);
+	release_kernel(kernel);
+	release_queue(queue);
+	release_context(context);
 	glfwDestroyWindow(window);
 
 	glfwTerminate();
@@ -0,0 +1,425 @@
+#include <getopt.h>
+#include <time.h>
+
+#include <cllib/cllib.h>
+#include <image.h>
+
+typedef cl_float3 float3;
+#define FLOAT3(X, Y, Z)(float3){ .x = X, .y = Y, .z = Z }
+#include "source/struct.cl"
+
+#include <linalg.h>
+#include <scene.h>
+#include <split.h>
+#include <wavefront.h>
+
+/* most paths traced per pixel in one kernel launch */
+#define OFFLINE_MAX_RAYS_PER_LAUNCH 16
+/* launches made before pixel variance is trusted by adaptive sampling */
+#define OFFLINE_MIN_ADAPTIVE_LAUNCHES 4
+/* bounces path makes at most, russian roulette ends most paths much earlier */
+#define OFFLINE_MAX_DEPTH 16
+
+struct offline_options {
+	unsigned int width;
+	unsigned int height;
+	unsigned int samples;
+	float error;
+	unsigned int depth;
+	float3 position;
+	float alpha;
+	float theta;
+	enum device_type device;
+	bool split;
+	bool wavefront;
+	int sampler;
+	const char *output;
+	enum image_format format;
+};
+
+static __noreturn void usage(const char *name)
+{
+	printf("usage: %s [options] -o output.{ppm,pfm,exr}\n"
+	       "  -W width        image width, 1000 by default\n"
+	       "  -H height       image height, 1000 by default\n"
+	       "  -s samples      samples per pixel, 256 by default\n"
+	       "  -e error        stop sampling tiles which relative error is\n"
+	       "                  below error, -s sets maximum samples then\n"
+	       "  -b bounces      most bounces of path, 16 by default\n"
+	       "  -p x,y,z        camera position\n"
+	       "  -a alpha        camera yaw in radians\n"
+	       "  -t theta        camera pitch in radians\n"
+	       "  -d cpu|gpu|all  OpenCL device type, cpu by default\n"
+	       "  -m              split every frame across all devices of\n"
+	       "                  -d type, bands are balanced by speed of\n"
+	       "                  devices, only with -k mega\n"
+	       "  -k mega|wave    trace whole path per work-item or run\n"
+	       "                  wavefront stage kernels, mega by default\n"
+	       "  -r white|sobol|blue\n"
+	       "                  sample sequence, sobol by default\n",
+	       name);
+	exit(1);
+}
+
+static struct offline_options parse_options(int argc, char **argv)
+{
+	struct offline_options options = {
+		.width = 1000,
+		.height = 1000,
+		.samples = 256,
+		.error = 0,
+		.depth = OFFLINE_MAX_DEPTH,
+		.position = FLOAT3(4, 2.5, -3.5),
+		.alpha = -0.5,
+		.theta = 0.3,
+		.device = cpu_type,
+		.split = false,
+		.wavefront = false,
+		.sampler = SAMPLER_SOBOL,
+		.output = NULL,
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "W:H:s:e:b:p:a:t:d:mk:r:o:")) != -1) {
+		switch (opt) {
+		case 'W':
+			options.width = strtoul(optarg, NULL, 10); break;
+		case 'H':
+			options.height = strtoul(optarg, NULL, 10); break;
+		case 's':
+			options.samples = strtoul(optarg, NULL, 10); break;
+		case 'e':
+			options.error = strtof(optarg, NULL); break;
+		case 'b':
+			options.depth = strtoul(optarg, NULL, 10); break;
+		case 'p': {
+			float3 *p = &options.position;
+			if (sscanf(optarg, "%f,%f,%f", &p->x, &p->y, &p->z) !=
+			    3) {
+				usage(argv[0]);
+			}
+			break;
+		} case 'a':
+			options.alpha = strtof(optarg, NULL); break;
+		case 't':
+			options.theta = strtof(optarg, NULL); break;
+		case 'd':
+			if (strcmp(optarg, "cpu") == 0) {
+				options.device = cpu_type;
+			} else if (strcmp(optarg, "gpu") == 0) {
+				options.device = gpu_type;
+			} else if (strcmp(optarg, "all") == 0) {
+				options.device = all_type;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case 'm':
+			options.split = true; break;
+		case 'k':
+			if (strcmp(optarg, "mega") == 0) {
+				options.wavefront = false;
+			} else if (strcmp(optarg, "wave") == 0) {
+				options.wavefront = true;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case 'r':
+			if (strcmp(optarg, "white") == 0) {
+				options.sampler = SAMPLER_WHITE_NOISE;
+			} else if (strcmp(optarg, "sobol") == 0) {
+				options.sampler = SAMPLER_SOBOL;
+			} else if (strcmp(optarg, "blue") == 0) {
+				options.sampler = SAMPLER_BLUE_NOISE;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case 'o':
+			options.output = optarg; break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (options.output == NULL || options.width == 0 ||
+	    options.height == 0 || options.samples == 0 ||
+	    !image_format_from_path(options.output, &options.format)) {
+		usage(argv[0]);
+	}
+	if (options.split && options.wavefront) {
+		printf("%s: -m splits only megakernel frames, "
+		       "-k wave can not be used with it\n",
+		       argv[0]);
+		exit(1);
+	}
+	return options;
+}
+
+/**
+ * rays_per_launch() returns number of paths traced per pixel in one launch.
+ * It divides samples number, so exactly requested number of samples is taken
+ */
+static unsigned int rays_per_launch(unsigned int samples)
+{
+	unsigned int rays = OFFLINE_MAX_RAYS_PER_LAUNCH;
+
+	while (samples % rays != 0) {
+		--rays;
+	}
+	return rays;
+}
+
+/**
+ * update_tile_mask() marks converged tiles and reads mask back
+ *
+ * @return number of tiles still sampled
+ */
+static unsigned int update_tile_mask(queue_t queue, kernel_t *kernel,
+				     buffer_t mask, char *tiles,
+				     size_t tiles_num)
+{
+	unsigned int active = 0;
+
+	run_kernel(queue, *kernel);
+	dump_buffer(queue, mask, tiles_num, tiles, true);
+	for (size_t i = 0; i < tiles_num; ++i) {
+		active += tiles[i] != 0;
+	}
+	return active;
+}
+
+static double seconds(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void print_progress(unsigned int samples, unsigned int total,
+			   unsigned int active, size_t tiles_num)
+{
+	printf("\r%u/%u samples, %u/%zu tiles active", samples, total, active,
+	       tiles_num);
+	fflush(stdout);
+}
+
+/**
+ * render_device() renders image on device of options type ranked the highest
+ * by select_device(), CLLIB_DEVICE environment variable may pick other one
+ *
+ * @param flags build options of path tracer program
+ * @param rgba place where accumulated pixels are stored
+ * @return seconds spent rendering
+ */
+static double render_device(struct offline_options *options,
+			    const char *flags, unsigned int rays, float *rgba)
+{
+	unsigned int launches = options->samples / rays;
+	size_t pixels = (size_t)options->width * options->height;
+	struct RotateMatrix matrix;
+	double start;
+
+	device_t device = create_device(options->device);
+	context_t context = create_context(device);
+	queue_t queue = create_queue(context, device);
+
+	kernel_t kernel = create_kernel(
+		device, context,
+		options->wavefront ? "#include <source/wavefront.cl>" :
+				     "#include <source/path_tracer.cl>",
+		options->wavefront ? "generateKernel" : "runKernel", flags);
+
+	buffer_t accum = create_buffer(context, read_write | dump_only,
+				       pixels * sizeof(cl_float4));
+	buffer_t moments = create_buffer(context, read_write | no_access,
+					 pixels * sizeof(cl_float));
+
+	bool adaptive = options->error > 0;
+	unsigned int tiles_x = (options->width + ADAPTIVE_TILE_SIZE - 1) /
+			       ADAPTIVE_TILE_SIZE;
+	unsigned int tiles_y = (options->height + ADAPTIVE_TILE_SIZE - 1) /
+			       ADAPTIVE_TILE_SIZE;
+	size_t tiles_num = (size_t)tiles_x * tiles_y;
+	unsigned int active = tiles_num;
+	char *tiles = malloc(tiles_num);
+	buffer_t mask = create_buffer(context, read_write, tiles_num);
+	/* NULL mask makes every tile active */
+	buffer_t kernel_mask = { .__buffer = NULL };
+	/* denoiser is used only by interactive tracer */
+	buffer_t no_features = { .__buffer = NULL };
+	kernel_t error_kernel = create_program_kernel(kernel,
+						      "tileErrorKernel");
+
+	panic_on(tiles == NULL, "malloc");
+	memset(tiles, 1, tiles_num);
+	fill_buffer(queue, mask, tiles_num, tiles, true);
+	set_kernel_arg_at(error_kernel, accum, 0);
+	set_kernel_arg_at(error_kernel, moments, 1);
+	set_kernel_arg_at(error_kernel, mask, 2);
+	set_kernel_arg_at(error_kernel, options->error, 3);
+	set_kernel_size_2d(error_kernel, tiles_x, tiles_y);
+	scene_t scene = create_scene(context, queue, 8);
+	scene_add_demo(&scene);
+
+	compute_rotation_matrix(&matrix, options->alpha, options->theta);
+	if (adaptive) {
+		kernel_mask = mask;
+	}
+
+	wavefront_t wavefront = { .__rays_per_pixel = rays };
+	if (options->wavefront) {
+		wavefront = create_wavefront(context, kernel, options->width,
+					     options->height, rays,
+					     options->depth);
+		set_wavefront_args(&wavefront, &scene, accum, moments,
+				   kernel_mask);
+		set_wavefront_camera(&wavefront, options->position, matrix);
+	} else {
+		set_kernel_arg_at(kernel, accum, 0);
+		set_kernel_arg_at(kernel, options->position, 2);
+		set_kernel_arg_at(kernel, matrix, 3);
+		set_scene_args(&kernel, &scene, 1, 6, 7);
+		set_scene_light_args(&kernel, &scene, 10, 11);
+		set_kernel_arg_at(kernel, moments, 8);
+		set_kernel_arg_at(kernel, kernel_mask, 9);
+		set_kernel_arg_at(kernel, options->depth, 12);
+		set_kernel_arg_at(kernel, no_features, 13);
+		set_kernel_size_2d(kernel, options->width, options->height);
+	}
+
+	start = seconds();
+	for (cl_uint frame = 1; frame <= launches && active > 0; ++frame) {
+		cl_int reset = frame == 1;
+
+		if (options->wavefront) {
+			run_wavefront(queue, &wavefront, frame, reset);
+		} else {
+			set_kernel_arg_at(kernel, reset, 4);
+			set_kernel_arg_at(kernel, frame, 5);
+			run_kernel(queue, kernel);
+		}
+		flush_queue(queue);
+		if (adaptive && frame >= OFFLINE_MIN_ADAPTIVE_LAUNCHES) {
+			active = update_tile_mask(queue, &error_kernel, mask,
+						  tiles, tiles_num);
+		}
+		if (frame % 8 == 0 || frame == launches || active == 0) {
+			clFinish(queue.__queue);
+			print_progress(frame * rays, options->samples, active,
+				       tiles_num);
+		}
+	}
+	dump_buffer(queue, accum, pixels * sizeof(cl_float4), rgba, true);
+	start = seconds() - start;
+
+	free(tiles);
+	release_buffer(mask);
+	release_buffer(moments);
+	release_buffer(accum);
+	if (options->wavefront) {
+		destroy_wavefront(&wavefront);
+	}
+	destroy_scene(&scene);
+	release_kernel(error_kernel);
+	release_kernel(kernel);
+	release_queue(queue);
+	release_context(context);
+	return start;
+}
+
+/**
+ * render_split() renders image with every frame split across all devices of
+ * options type, bands of devices are balanced by their measured speed
+ *
+ * @param flags build options of path tracer program
+ * @param rgba place where accumulated pixels are stored
+ * @return seconds spent rendering
+ */
+static double render_split(struct offline_options *options,
+			   const char *flags, unsigned int rays, float *rgba)
+{
+	unsigned int launches = options->samples / rays;
+	size_t pixels = (size_t)options->width * options->height;
+	device_t devices[SPLIT_MAX_DEVICES];
+	unsigned int count = create_devices(options->device, devices,
+					    SPLIT_MAX_DEVICES);
+	bool adaptive = options->error > 0;
+	size_t tiles_num = (size_t)((options->width + ADAPTIVE_TILE_SIZE - 1) /
+				    ADAPTIVE_TILE_SIZE) *
+			   ((options->height + ADAPTIVE_TILE_SIZE - 1) /
+			    ADAPTIVE_TILE_SIZE);
+	unsigned int active = tiles_num;
+	struct RotateMatrix matrix;
+	double start;
+
+	split_t split = create_split(devices, count, options->width,
+				     options->height,
+				     "#include <source/path_tracer.cl>", flags,
+				     scene_add_demo);
+
+	compute_rotation_matrix(&matrix, options->alpha, options->theta);
+	set_split_args(&split, options->position, matrix, options->depth,
+		       options->error);
+
+	start = seconds();
+	for (cl_uint frame = 1; frame <= launches && active > 0; ++frame) {
+		run_split(&split, frame);
+		if (adaptive && frame >= OFFLINE_MIN_ADAPTIVE_LAUNCHES) {
+			active = update_split_mask(&split);
+		}
+		if (frame % 8 == 0 || frame == launches || active == 0) {
+			print_progress(frame * rays, options->samples, active,
+				       tiles_num);
+		}
+	}
+	memcpy(rgba, gather_split(&split), pixels * sizeof(cl_float4));
+	start = seconds() - start;
+
+	printf("\n");
+	split_dump(&split, stdout);
+	destroy_split(&split);
+	return start;
+}
+
+int main(int argc, char **argv)
+{
+	struct offline_options options = parse_options(argc, argv);
+	unsigned int rays = rays_per_launch(options.samples);
+	size_t pixels = (size_t)options.width * options.height;
+	char compile_flags[255];
+	size_t printed;
+	double time;
+
+	float3 sun_dir = SUN_DIRECTION;
+	printed = snprintf(compile_flags, sizeof(compile_flags),
+			   "-I . -I source "
+			   "-D SCREEN_WIDTH=%u -D SCREEN_HEIGHT=%u "
+			   "-D RAYS_PER_PIXEL=%u -D SAMPLER=%d "
+			   "-D SUN_DIRECTION=FLOAT3(%f,%f,%f)",
+			   options.width, options.height, rays,
+			   options.sampler, sun_dir.x, sun_dir.y, sun_dir.z);
+	panic_on(printed == 0 || printed >= sizeof(compile_flags),
+		 "buffer overflow");
+
+	float *rgba = malloc(pixels * sizeof(cl_float4));
+	double total = 0;
+	panic_on(rgba == NULL, "malloc");
+	if (options.split) {
+		time = render_split(&options, compile_flags, rays, rgba);
+	} else {
+		time = render_device(&options, compile_flags, rays, rgba);
+	}
+	for (size_t i = 0; i < pixels; ++i) {
+		total += rgba[i * 4 + 3];
+	}
+	printf("\nrendered %.1f samples per pixel in %.2fs\n",
+	       total * rays / pixels, time);
+
+	write_image(options.output, options.format, rgba, options.width,
+		    options.height);
+
+	free(rgba);
+	return 0;
+}
@@ -0,0 +1,435 @@
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifndef CLCPP_PACKET_WIDTH
+#if defined(__AVX__)
+#define CLCPP_PACKET_WIDTH 8
+#elif defined(__SSE2__) || defined(__ARM_NEON)
+#define CLCPP_PACKET_WIDTH 4
+#else
+#define CLCPP_PACKET_WIDTH 1
+#endif
+#endif /* CLCPP_PACKET_WIDTH */
+
+/**
+ * packet<W> is W-wide float register used by clcpp to test one ray against W
+ * spheres at once. Every supported width is a separate specialization, so
+ * width is chosen at compile time with CLCPP_PACKET_WIDTH and no runtime
+ * dispatch is made. Comparisons return packets with all bits set in active
+ * lanes, which are used as lane masks. Masks are built from ones(), not from
+ * set1(-1), as bitwise select of SSE and NEON needs every bit set
+ */
+template <int W>
+struct packet;
+
+template <>
+struct packet<1> {
+	float v;
+
+	static packet load(const float *p)
+	{
+		return { *p };
+	}
+	static packet set1(float f)
+	{
+		return { f };
+	}
+	static packet ones()
+	{
+		return { -1.0f };
+	}
+	static packet lanes(float first)
+	{
+		return { first };
+	}
+	void store(float *p) const
+	{
+		*p = v;
+	}
+	friend packet operator+(packet a, packet b)
+	{
+		return { a.v + b.v };
+	}
+	friend packet operator-(packet a, packet b)
+	{
+		return { a.v - b.v };
+	}
+	friend packet operator*(packet a, packet b)
+	{
+		return { a.v * b.v };
+	}
+	friend packet operator/(packet a, packet b)
+	{
+		return { a.v / b.v };
+	}
+	friend packet sqrt(packet a)
+	{
+		return { std::sqrt(a.v) };
+	}
+	friend packet min(packet a, packet b)
+	{
+		return { a.v < b.v ? a.v : b.v };
+	}
+	friend packet max(packet a, packet b)
+	{
+		return { a.v > b.v ? a.v : b.v };
+	}
+	friend packet operator<(packet a, packet b)
+	{
+		return { a.v < b.v ? -1.0f : 0.0f };
+	}
+	friend packet operator&(packet a, packet b)
+	{
+		return { a.v != 0 && b.v != 0 ? -1.0f : 0.0f };
+	}
+	friend packet andnot(packet mask, packet a)
+	{
+		return { mask.v != 0 ? 0.0f : a.v };
+	}
+	friend packet select(packet mask, packet a, packet b)
+	{
+		return { mask.v != 0 ? a.v : b.v };
+	}
+	friend bool any(packet mask)
+	{
+		return mask.v != 0;
+	}
+};
+
+#if defined(__SSE2__)
+template <>
+struct packet<4> {
+	__m128 v;
+
+	static packet load(const float *p)
+	{
+		return { _mm_load_ps(p) };
+	}
+	static packet set1(float f)
+	{
+		return { _mm_set1_ps(f) };
+	}
+	static packet ones()
+	{
+		return { _mm_castsi128_ps(_mm_set1_epi32(-1)) };
+	}
+	static packet lanes(float first)
+	{
+		return { _mm_setr_ps(first, first + 1, first + 2, first + 3) };
+	}
+	void store(float *p) const
+	{
+		_mm_store_ps(p, v);
+	}
+	friend packet operator+(packet a, packet b)
+	{
+		return { _mm_add_ps(a.v, b.v) };
+	}
+	friend packet operator-(packet a, packet b)
+	{
+		return { _mm_sub_ps(a.v, b.v) };
+	}
+	friend packet operator*(packet a, packet b)
+	{
+		return { _mm_mul_ps(a.v, b.v) };
+	}
+	friend packet operator/(packet a, packet b)
+	{
+		return { _mm_div_ps(a.v, b.v) };
+	}
+	friend packet sqrt(packet a)
+	{
+		return { _mm_sqrt_ps(a.v) };
+	}
+	friend packet min(packet a, packet b)
+	{
+		return { _mm_min_ps(a.v, b.v) };
+	}
+	friend packet max(packet a, packet b)
+	{
+		return { _mm_max_ps(a.v, b.v) };
+	}
+	friend packet operator<(packet a, packet b)
+	{
+		return { _mm_cmplt_ps(a.v, b.v) };
+	}
+	friend packet operator&(packet a, packet b)
+	{
+		return { _mm_and_ps(a.v, b.v) };
+	}
+	friend packet andnot(packet mask, packet a)
+	{
+		return { _mm_andnot_ps(mask.v, a.v) };
+	}
+	friend packet select(packet mask, packet a, packet b)
+	{
+		return { _mm_or_ps(_mm_and_ps(mask.v, a.v),
+				   _mm_andnot_ps(mask.v, b.v)) };
+	}
+	friend bool any(packet mask)
+	{
+		return _mm_movemask_ps(mask.v) != 0;
+	}
+};
+#elif defined(__ARM_NEON)
+template <>
+struct packet<4> {
+	float32x4_t v;
+
+	static packet load(const float *p)
+	{
+		return { vld1q_f32(p) };
+	}
+	static packet set1(float f)
+	{
+		return { vdupq_n_f32(f) };
+	}
+	static packet ones()
+	{
+		return { vreinterpretq_f32_u32(vdupq_n_u32(~0u)) };
+	}
+	static packet lanes(float first)
+	{
+		const float l[4] = { first, first + 1, first + 2, first + 3 };
+		return { vld1q_f32(l) };
+	}
+	void store(float *p) const
+	{
+		vst1q_f32(p, v);
+	}
+	friend packet operator+(packet a, packet b)
+	{
+		return { vaddq_f32(a.v, b.v) };
+	}
+	friend packet operator-(packet a, packet b)
+	{
+		return { vsubq_f32(a.v, b.v) };
+	}
+	friend packet operator*(packet a, packet b)
+	{
+		return { vmulq_f32(a.v, b.v) };
+	}
+	friend packet operator/(packet a, packet b)
+	{
+		return { vdivq_f32(a.v, b.v) };
+	}
+	friend packet sqrt(packet a)
+	{
+		return { vsqrtq_f32(a.v) };
+	}
+	friend packet min(packet a, packet b)
+	{
+		return { vminq_f32(a.v, b.v) };
+	}
+	friend packet max(packet a, packet b)
+	{
+		return { vmaxq_f32(a.v, b.v) };
+	}
+	friend packet operator<(packet a, packet b)
+	{
+		return { vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)) };
+	}
+	friend packet operator&(packet a, packet b)
+	{
+		return { vreinterpretq_f32_u32(
+			vandq_u32(vreinterpretq_u32_f32(a.v),
+				  vreinterpretq_u32_f32(b.v))) };
+	}
+	friend packet andnot(packet mask, packet a)
+	{
+		return { vreinterpretq_f32_u32(
+			vbicq_u32(vreinterpretq_u32_f32(a.v),
+				  vreinterpretq_u32_f32(mask.v))) };
+	}
+	friend packet select(packet mask, packet a, packet b)
+	{
+		return { vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v) };
+	}
+	friend bool any(packet mask)
+	{
+		return vmaxvq_u32(vreinterpretq_u32_f32(mask.v)) != 0;
+	}
+};
+#endif /* __SSE2__ */
+
+#if defined(__AVX__)
+template <>
+struct packet<8> {
+	__m256 v;
+
+	static packet load(const float *p)
+	{
+		return { _mm256_load_ps(p) };
+	}
+	static packet set1(float f)
+	{
+		return { _mm256_set1_ps(f) };
+	}
+	static packet ones()
+	{
+		return { _mm256_castsi256_ps(_mm256_set1_epi32(-1)) };
+	}
+	static packet lanes(float first)
+	{
+		return { _mm256_setr_ps(first, first + 1, first + 2, first + 3,
+					first + 4, first + 5, first + 6,
+					first + 7) };
+	}
+	void store(float *p) const
+	{
+		_mm256_store_ps(p, v);
+	}
+	friend packet operator+(packet a, packet b)
+	{
+		return { _mm256_add_ps(a.v, b.v) };
+	}
+	friend packet operator-(packet a, packet b)
+	{
+		return { _mm256_sub_ps(a.v, b.v) };
+	}
+	friend packet operator*(packet a, packet b)
+	{
+		return { _mm256_mul_ps(a.v, b.v) };
+	}
+	friend packet operator/(packet a, packet b)
+	{
+		return { _mm256_div_ps(a.v, b.v) };
+	}
+	friend packet sqrt(packet a)
+	{
+		return { _mm256_sqrt_ps(a.v) };
+	}
+	friend packet min(packet a, packet b)
+	{
+		return { _mm256_min_ps(a.v, b.v) };
+	}
+	friend packet max(packet a, packet b)
+	{
+		return { _mm256_max_ps(a.v, b.v) };
+	}
+	friend packet operator<(packet a, packet b)
+	{
+		return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) };
+	}
+	friend packet operator&(packet a, packet b)
+	{
+		return { _mm256_and_ps(a.v, b.v) };
+	}
+	friend packet andnot(packet mask, packet a)
+	{
+		return { _mm256_andnot_ps(mask.v, a.v) };
+	}
+	friend packet select(packet mask, packet a, packet b)
+	{
+		return { _mm256_blendv_ps(b.v, a.v, mask.v) };
+	}
+	friend bool any(packet mask)
+	{
+		return _mm256_movemask_ps(mask.v) != 0;
+	}
+};
+#endif /* __AVX__ */
+
+/**
+ * intersectSpheresPacket() finds closest sphere intersected by ray in range
+ * [first, first + num), testing W spheres per iteration. Spheres are gathered
+ * to SoA registers from scene array, lanes past the end of range are masked
+ * out. On equal distances sphere with lowest index wins
+ *
+ * @param hitDistance distance to closest hit found so far, updated if closer
+ * 	sphere is found
+ * @param ray the ray with which the intersection is calculated
+ * @param spheres array of inspecting spheres
+ * @param first index of first sphere in range
+ * @param num number of spheres in range
+ * @return index of closest sphere or -1 if ray did not hit anything closer
+ * 	then *hitDistance
+ */
+template <int W>
+int intersectSpheresPacket(float *hitDistance, const struct Ray *ray,
+			   const struct Sphere *spheres, int first, int num)
+{
+	typedef packet<W> pf;
+	alignas(32) float x[W];
+	alignas(32) float y[W];
+	alignas(32) float z[W];
+	alignas(32) float r2[W];
+	alignas(32) float dist[W];
+	alignas(32) float index[W];
+
+	const pf ox = pf::set1(ray->origin.x);
+	const pf oy = pf::set1(ray->origin.y);
+	const pf oz = pf::set1(ray->origin.z);
+	const pf dx = pf::set1(ray->direction.x);
+	const pf dy = pf::set1(ray->direction.y);
+	const pf dz = pf::set1(ray->direction.z);
+	const pf eps = pf::set1(EPS);
+	const pf end = pf::set1((float)(first + num));
+
+	float a = dot(ray->direction, ray->direction);
+	const pf four_a = pf::set1(4 * a);
+	const pf two_a = pf::set1(2 * a);
+
+	pf best = pf::set1(*hitDistance);
+	pf best_id = pf::set1(-1);
+
+	for (int i = first; i < first + num; i += W) {
+		for (int l = 0; l < W; ++l) {
+			const struct Sphere *sphere =
+				&spheres[min(i + l, first + num - 1)];
+
+			x[l] = sphere->position.x;
+			y[l] = sphere->position.y;
+			z[l] = sphere->position.z;
+			r2[l] = sphere->radius * sphere->radius;
+		}
+
+		pf id = pf::lanes((float)i);
+		pf cx = ox - pf::load(x);
+		pf cy = oy - pf::load(y);
+		pf cz = oz - pf::load(z);
+
+		pf b = pf::set1(2) * (cx * dx + cy * dy + cz * dz);
+		pf c = (cx * cx + cy * cy + cz * cz) - pf::load(r2);
+		pf disc = b * b - four_a * c;
+		pf active = (id < end) & andnot(disc < eps, pf::ones());
+		if (!any(active)) {
+			continue;
+		}
+
+		disc = sqrt(max(disc, pf::set1(0)));
+		pf x1 = (pf::set1(0) - b + disc) / two_a;
+		pf x2 = (pf::set1(0) - b - disc) / two_a;
+		pf root = min(x1, x2);
+		root = select(root < eps, max(x1, x2), root);
+		active = active & andnot(root < eps, pf::ones());
+		active = active & (root < best);
+
+		best = select(active, root, best);
+		best_id = select(active, id, best_id);
+	}
+
+	best.store(dist);
+	best_id.store(index);
+
+	int closest = -1;
+	for (int l = 0; l < W; ++l) {
+		if (index[l] < 0) {
+			continue;
+		}
+		if (closest == -1 || dist[l] < *hitDistance ||
+		    (dist[l] == *hitDistance && index[l] < closest)) {
+			*hitDistance = dist[l];
+			closest = (int)index[l];
+		}
+	}
+	return closest;
+}
+
+#endif /* PACKET_HPP */
@@ -0,0 +1,102 @@
+#include <reproject.h>
+
+/**
+ * create_reprojection() creates reprojection kernel and history buffers for
+ * image of given size
+ *
+ * @param kernel any kernel of program built from source/reproject.cl, with
+ * 	SCREEN_WIDTH and SCREEN_HEIGHT equal to width and height
+ */
+reprojection_t create_reprojection(context_t context, kernel_t kernel,
+				   unsigned int width, unsigned int height)
+{
+	size_t pixels = (size_t)width * height;
+	reprojection_t reprojection = {
+		.__reproject = create_program_kernel(kernel,
+						     "reprojectKernel"),
+		.__history = create_buffer(context, read_write | no_access,
+					   pixels * sizeof(cl_float4)),
+		.__history_moments = create_buffer(context,
+						   read_write | no_access,
+						   pixels * sizeof(cl_float)),
+		.__history_features = create_buffer(
+			context, read_write | no_access,
+			pixels * sizeof(struct PixelFeatures)),
+		.__pixels = pixels,
+	};
+
+	set_kernel_arg_at(reprojection.__reproject, reprojection.__history,
+			  3);
+	set_kernel_arg_at(reprojection.__reproject,
+			  reprojection.__history_moments, 4);
+	set_kernel_arg_at(reprojection.__reproject,
+			  reprojection.__history_features, 5);
+	set_kernel_size_2d(reprojection.__reproject, width, height);
+	return reprojection;
+}
+
+void destroy_reprojection(reprojection_t *reprojection)
+{
+	release_buffer(reprojection->__history);
+	release_buffer(reprojection->__history_moments);
+	release_buffer(reprojection->__history_features);
+	release_kernel(reprojection->__reproject);
+}
+
+/**
+ * set_reprojection_args() binds buffers frames are accumulated to
+ *
+ * @param accum accumulation buffer of runKernel()
+ * @param moments second moments of pixels luminance
+ * @param features pixel features runKernel() writes, reprojection needs
+ * 	depth and normal of the first hit
+ */
+void set_reprojection_args(reprojection_t *reprojection, buffer_t accum,
+			   buffer_t moments, buffer_t features)
+{
+	reprojection->__accum = accum;
+	reprojection->__moments = moments;
+	reprojection->__features = features;
+	set_kernel_arg_at(reprojection->__reproject, accum, 0);
+	set_kernel_arg_at(reprojection->__reproject, moments, 1);
+	set_kernel_arg_at(reprojection->__reproject, features, 2);
+}
+
+/**
+ * save_reprojection_history() enqueues copy of frames accumulated by
+ * previous camera, it must be called before the first frame of moved camera
+ * is traced
+ *
+ * @param prev_position camera position frames were accumulated from
+ * @param prev_matrix camera rotation frames were accumulated with
+ * @param position position of moved camera
+ * @param matrix rotation of moved camera
+ */
+void save_reprojection_history(queue_t queue, reprojection_t *reprojection,
+			       float3 prev_position,
+			       struct RotateMatrix prev_matrix,
+			       float3 position, struct RotateMatrix matrix)
+{
+	size_t pixels = reprojection->__pixels;
+
+	copy_buffer(queue, reprojection->__accum, reprojection->__history,
+		    pixels * sizeof(cl_float4));
+	copy_buffer(queue, reprojection->__moments,
+		    reprojection->__history_moments, pixels * sizeof(cl_float));
+	copy_buffer(queue, reprojection->__features,
+		    reprojection->__history_features,
+		    pixels * sizeof(struct PixelFeatures));
+	set_kernel_arg_at(reprojection->__reproject, position, 6);
+	set_kernel_arg_at(reprojection->__reproject, matrix, 7);
+	set_kernel_arg_at(reprojection->__reproject, prev_position, 8);
+	set_kernel_arg_at(reprojection->__reproject, prev_matrix, 9);
+}
+
+/**
+ * run_reprojection() enqueues merge of saved history into frame traced with
+ * reset canvas by moved camera
+ */
+void run_reprojection(queue_t queue, reprojection_t *reprojection)
+{
+	run_kernel(queue, reprojection->__reproject);
+}
@@ -0,0 +1,704 @@
+#include <float.h>
+#include <math.h>
+
+#include <scene.h>
+#include <bvh.h>
+
+static void __sphere_box(const struct Sphere *sphere, float3 *min, float3 *max)
+{
+	float r = sphere->radius;
+
+	*min = FLOAT3(sphere->position.x - r, sphere->position.y - r,
+		      sphere->position.z - r);
+	*max = FLOAT3(sphere->position.x + r, sphere->position.y + r,
+		      sphere->position.z + r);
+}
+
+static void __box_grow(float3 *min, float3 *max, float3 other_min,
+		       float3 other_max)
+{
+	min->x = fminf(min->x, other_min.x);
+	min->y = fminf(min->y, other_min.y);
+	min->z = fminf(min->z, other_min.z);
+	max->x = fmaxf(max->x, other_max.x);
+	max->y = fmaxf(max->y, other_max.y);
+	max->z = fmaxf(max->z, other_max.z);
+}
+
+static float __box_area(float3 min, float3 max)
+{
+	float x = max.x - min.x;
+	float y = max.y - min.y;
+	float z = max.z - min.z;
+
+	return 2 * (x * y + y * z + z * x);
+}
+
+static void *__grow_array(void *array, unsigned int size, size_t elem)
+{
+	array = realloc(array, size * elem);
+	panic_on(array == NULL, "realloc");
+	return array;
+}
+
+/**
+ * __scene_buffer() creates device buffer of scene, it is cut from scene pool if
+ * scene has one
+ */
+static buffer_t __scene_buffer(scene_t *scene, size_t size)
+{
+	if (scene->__pool != NULL) {
+		return pool_alloc(scene->__pool, read_only, size);
+	}
+	return create_buffer(scene->__context, read_only, size);
+}
+
+static void __scene_release(scene_t *scene, buffer_t buffer)
+{
+	if (scene->__pool != NULL) {
+		pool_free(scene->__pool, buffer);
+	} else {
+		release_buffer(buffer);
+	}
+}
+
+/**
+ * __grow_buffer() replaces device buffer with bigger one, copying `used` bytes
+ * of old buffer content on device
+ */
+static void __grow_buffer(scene_t *scene, buffer_t *buffer, size_t used,
+			  size_t size)
+{
+	buffer_t grown = __scene_buffer(scene, size);
+
+	if (used > 0) {
+		copy_buffer(scene->__queue, *buffer, grown, used);
+	}
+	__scene_release(scene, *buffer);
+	*buffer = grown;
+}
+
+static void __reserve_spheres(scene_t *scene, unsigned int size, bool copy)
+{
+	unsigned int capacity = scene->__capacity;
+
+	if (size <= capacity) {
+		return;
+	}
+	while (capacity < size) {
+		capacity *= 2;
+	}
+	scene->__spheres = __grow_array(scene->__spheres, capacity,
+					sizeof(struct Sphere));
+	scene->__slot_id = __grow_array(scene->__slot_id, capacity,
+					sizeof(unsigned int));
+	scene->__leaf = __grow_array(scene->__leaf, capacity,
+				     sizeof(unsigned int));
+	scene->__light_of = __grow_array(scene->__light_of, capacity,
+					 sizeof(unsigned int));
+	__grow_buffer(scene, &scene->__spheres_buffer,
+		      copy ? scene->__size * sizeof(struct Sphere) : 0,
+		      capacity * sizeof(struct Sphere));
+	scene->__capacity = capacity;
+}
+
+static void __reserve_nodes(scene_t *scene, unsigned int size, bool copy)
+{
+	unsigned int capacity = scene->__nodes_capacity;
+
+	if (size <= capacity) {
+		return;
+	}
+	while (capacity < size) {
+		capacity *= 2;
+	}
+	scene->__nodes = __grow_array(scene->__nodes, capacity,
+				      sizeof(struct BVHNode));
+	scene->__parent = __grow_array(scene->__parent, capacity, sizeof(int));
+	__grow_buffer(scene, &scene->__nodes_buffer,
+		      copy ? scene->__nodes_size * sizeof(struct BVHNode) : 0,
+		      capacity * sizeof(struct BVHNode));
+	scene->__nodes_capacity = capacity;
+}
+
+/**
+ * __mark_dirty() adds range to elements uploaded at the end of edit. Range
+ * touching the last one is merged with it, so refit walk which marks nodes
+ * one by one uploads runs of adjacent nodes at once
+ */
+static void __mark_dirty(struct __scene_dirty *dirty, unsigned int first,
+			 unsigned int count)
+{
+	if (dirty->size > 0) {
+		struct __scene_range *last = &dirty->ranges[dirty->size - 1];
+		unsigned int end = last->first + last->count;
+
+		if (first <= end && first + count >= last->first) {
+			end = first + count > end ? first + count : end;
+			last->first = first < last->first ? first : last->first;
+			last->count = end - last->first;
+			return;
+		}
+	}
+	if (dirty->size == dirty->capacity) {
+		dirty->capacity = dirty->capacity * 2 + 8;
+		dirty->ranges = __grow_array(dirty->ranges, dirty->capacity,
+					     sizeof(struct __scene_range));
+	}
+	dirty->ranges[dirty->size++] = (struct __scene_range){
+		.first = first, .count = count
+	};
+}
+
+static size_t __dirty_bytes(const struct __scene_dirty *dirty, size_t elem)
+{
+	size_t bytes = 0;
+
+	for (unsigned int i = 0; i < dirty->size; ++i) {
+		bytes += dirty->ranges[i].count * elem;
+	}
+	return bytes;
+}
+
+/**
+ * __write_dirty() copies dirty ranges of array to staging memory and enqueues
+ * their non-blocking writes from it
+ *
+ * @return staging memory following copied ranges
+ */
+static char *__write_dirty(scene_t *scene, struct __scene_dirty *dirty,
+			   buffer_t buffer, const void *array, size_t elem,
+			   char *staging)
+{
+	for (unsigned int i = 0; i < dirty->size; ++i) {
+		size_t offset = dirty->ranges[i].first * elem;
+		size_t size = dirty->ranges[i].count * elem;
+
+		memcpy(staging, (const char *)array + offset, size);
+		fill_buffer_range(scene->__queue, buffer, offset, size,
+				  staging, false);
+		staging += size;
+	}
+	dirty->size = 0;
+	return staging;
+}
+
+/**
+ * __scene_flush() uploads everything edit changed. Host arrays are changed by
+ * next edit while writes may still wait for running frames, so writes read
+ * copy of changes, which is freed when they complete
+ */
+static void __scene_flush(scene_t *scene)
+{
+	size_t bytes = __dirty_bytes(&scene->__dirty_spheres,
+				     sizeof(struct Sphere)) +
+		       __dirty_bytes(&scene->__dirty_nodes,
+				     sizeof(struct BVHNode)) +
+		       __dirty_bytes(&scene->__dirty_lights,
+				     sizeof(unsigned int));
+	char *staging;
+	char *pos;
+
+	if (bytes == 0) {
+		scene->__dirty_spheres.size = 0;
+		scene->__dirty_nodes.size = 0;
+		scene->__dirty_lights.size = 0;
+		return;
+	}
+	staging = malloc(bytes);
+	panic_on(staging == NULL, "malloc");
+	pos = __write_dirty(scene, &scene->__dirty_spheres,
+			    scene->__spheres_buffer, scene->__spheres,
+			    sizeof(struct Sphere), staging);
+	pos = __write_dirty(scene, &scene->__dirty_nodes, scene->__nodes_buffer,
+			    scene->__nodes, sizeof(struct BVHNode), pos);
+	__write_dirty(scene, &scene->__dirty_lights, scene->__lights_buffer,
+		      scene->__lights, sizeof(unsigned int), pos);
+	free_after_queue(scene->__queue, staging);
+}
+
+static void __upload_spheres(scene_t *scene, unsigned int first,
+			     unsigned int count)
+{
+	__mark_dirty(&scene->__dirty_spheres, first, count);
+}
+
+static void __upload_nodes(scene_t *scene, unsigned int first,
+			   unsigned int count)
+{
+	__mark_dirty(&scene->__dirty_nodes, first, count);
+}
+
+static bool __is_light(const scene_t *scene, unsigned int slot)
+{
+	return scene->__slot_id[slot] != SCENE_NO_SPHERE &&
+	       scene->__spheres[slot].emissionStrength > 0 &&
+	       scene->__spheres[slot].radius > 0;
+}
+
+static void __upload_lights(scene_t *scene, unsigned int first,
+			    unsigned int count)
+{
+	__mark_dirty(&scene->__dirty_lights, first, count);
+}
+
+static void __reserve_lights(scene_t *scene, unsigned int size)
+{
+	unsigned int capacity = scene->__lights_capacity;
+
+	if (size <= capacity) {
+		return;
+	}
+	while (capacity < size) {
+		capacity *= 2;
+	}
+	scene->__lights = __grow_array(scene->__lights, capacity,
+				       sizeof(unsigned int));
+	__grow_buffer(scene, &scene->__lights_buffer,
+		      scene->__lights_size * sizeof(unsigned int),
+		      capacity * sizeof(unsigned int));
+	scene->__lights_capacity = capacity;
+}
+
+/**
+ * __update_light() adds slot to light list or removes it after sphere in slot
+ * was edited, so edit uploads at most one light list entry. Removed entry is
+ * replaced by the last one, so order of lights is not kept
+ */
+static void __update_light(scene_t *scene, unsigned int slot)
+{
+	unsigned int light = scene->__light_of[slot];
+	unsigned int last;
+
+	if (__is_light(scene, slot) == (light != SCENE_NO_SPHERE)) {
+		return;
+	}
+	if (light == SCENE_NO_SPHERE) {
+		__reserve_lights(scene, scene->__lights_size + 1);
+		light = scene->__lights_size++;
+		scene->__lights[light] = slot;
+		scene->__light_of[slot] = light;
+		__upload_lights(scene, light, 1);
+		return;
+	}
+	last = --scene->__lights_size;
+	scene->__light_of[slot] = SCENE_NO_SPHERE;
+	if (light != last) {
+		scene->__lights[light] = scene->__lights[last];
+		scene->__light_of[scene->__lights[light]] = light;
+		__upload_lights(scene, light, 1);
+	}
+}
+
+/**
+ * __collect_lights() collects slots of alive emissive spheres again and
+ * uploads whole light list. Rebuild moves spheres to other slots, so the list
+ * can not be kept up to date by __update_light() then
+ */
+static void __collect_lights(scene_t *scene)
+{
+	unsigned int size = 0;
+
+	for (unsigned int i = 0; i < scene->__size; ++i) {
+		size += __is_light(scene, i);
+	}
+	__reserve_lights(scene, size);
+	size = 0;
+	for (unsigned int i = 0; i < scene->__size; ++i) {
+		scene->__light_of[i] = SCENE_NO_SPHERE;
+		if (__is_light(scene, i)) {
+			scene->__light_of[i] = size;
+			scene->__lights[size++] = i;
+		}
+	}
+	scene->__lights_size = size;
+	if (size > 0) {
+		__upload_lights(scene, 0, size);
+	}
+}
+
+/**
+ * __index_node() restores parent links of subtree and leaf of every sphere in
+ * it after nodes are moved or rebuilt
+ */
+static void __index_node(scene_t *scene, unsigned int node_id, int parent)
+{
+	struct BVHNode *node = &scene->__nodes[node_id];
+
+	scene->__parent[node_id] = parent;
+	if (node->count > 0) {
+		for (int i = node->leftFirst; i < node->leftFirst + node->count;
+		     ++i) {
+			scene->__leaf[i] = node_id;
+		}
+		return;
+	}
+	__index_node(scene, node->leftFirst, node_id);
+	__index_node(scene, node->leftFirst + 1, node_id);
+}
+
+/**
+ * __refit() recomputes bounding boxes from node up to the root and uploads
+ * changed nodes. Walk stops at first node which box did not change
+ */
+static void __refit(scene_t *scene, int node_id)
+{
+	while (node_id != -1) {
+		struct BVHNode *node = &scene->__nodes[node_id];
+		float3 min = FLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		float3 max = FLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		if (node->count > 0) {
+			for (int i = node->leftFirst;
+			     i < node->leftFirst + node->count; ++i) {
+				float3 smin, smax;
+
+				if (scene->__slot_id[i] == SCENE_NO_SPHERE) {
+					continue;
+				}
+				__sphere_box(&scene->__spheres[i], &smin,
+					     &smax);
+				__box_grow(&min, &max, smin, smax);
+			}
+		} else {
+			struct BVHNode *left = &scene->__nodes[node->leftFirst];
+			struct BVHNode *right = left + 1;
+
+			__box_grow(&min, &max, left->boxMin, left->boxMax);
+			__box_grow(&min, &max, right->boxMin, right->boxMax);
+		}
+		if (memcmp(&min, &node->boxMin, sizeof(min)) == 0 &&
+		    memcmp(&max, &node->boxMax, sizeof(max)) == 0) {
+			return;
+		}
+		node->boxMin = min;
+		node->boxMax = max;
+		__upload_nodes(scene, node_id, 1);
+		node_id = scene->__parent[node_id];
+	}
+}
+
+static scene_t __create_scene(context_t context, pool_t *pool, queue_t queue,
+			      unsigned int capacity)
+{
+	scene_t scene;
+
+	capacity = capacity > 0 ? capacity : 1;
+	memset(&scene, 0, sizeof(scene));
+	scene.__context = context;
+	scene.__pool = pool;
+	scene.__queue = queue;
+
+	scene.__capacity = capacity;
+	scene.__spheres = __grow_array(NULL, capacity, sizeof(struct Sphere));
+	scene.__slot_id = __grow_array(NULL, capacity, sizeof(unsigned int));
+	scene.__leaf = __grow_array(NULL, capacity, sizeof(unsigned int));
+	scene.__light_of = __grow_array(NULL, capacity, sizeof(unsigned int));
+	scene.__spheres_buffer = __scene_buffer(&scene, capacity *
+							sizeof(struct Sphere));
+
+	scene.__ids_capacity = capacity;
+	scene.__id_slot = __grow_array(NULL, capacity, sizeof(unsigned int));
+
+	scene.__nodes_capacity = 2 * capacity;
+	scene.__nodes = __grow_array(NULL, 2 * capacity,
+				     sizeof(struct BVHNode));
+	scene.__parent = __grow_array(NULL, 2 * capacity, sizeof(int));
+	scene.__nodes_buffer = __scene_buffer(&scene, 2 * capacity *
+						      sizeof(struct BVHNode));
+
+	scene.__lights_capacity = capacity;
+	scene.__lights = __grow_array(NULL, capacity, sizeof(unsigned int));
+	scene.__lights_buffer = __scene_buffer(&scene, capacity *
+						       sizeof(unsigned int));
+
+	scene_rebuild(&scene);
+	return scene;
+}
+
+/**
+ * create_scene() creates empty scene with device buffers for `capacity`
+ * spheres. Buffers grow when more spheres are added
+ *
+ * @param context context where scene buffers are created
+ * @param queue queue used for scene uploads
+ * @param capacity number of spheres to preallocate memory for
+ */
+__must_check scene_t create_scene(context_t context, queue_t queue,
+				  unsigned int capacity)
+{
+	return __create_scene(context, NULL, queue, capacity);
+}
+
+/**
+ * create_pooled_scene() creates scene which device buffers are cut from pool.
+ * Buffers replaced when scene grows go back to pool, so repeated edits reuse
+ * the same device memory instead of allocating new buffers
+ *
+ * @param pool pool of scene buffers, it must outlive the scene
+ */
+__must_check scene_t create_pooled_scene(pool_t *pool, queue_t queue,
+					 unsigned int capacity)
+{
+	return __create_scene(pool->__context, pool, queue, capacity);
+}
+
+void destroy_scene(scene_t *scene)
+{
+	__scene_release(scene, scene->__spheres_buffer);
+	__scene_release(scene, scene->__nodes_buffer);
+	__scene_release(scene, scene->__lights_buffer);
+	free(scene->__spheres);
+	free(scene->__slot_id);
+	free(scene->__leaf);
+	free(scene->__light_of);
+	free(scene->__id_slot);
+	free(scene->__nodes);
+	free(scene->__parent);
+	free(scene->__lights);
+	free(scene->__dirty_spheres.ranges);
+	free(scene->__dirty_nodes.ranges);
+	free(scene->__dirty_lights.ranges);
+	memset(scene, 0, sizeof(*scene));
+}
+
+/**
+ * __rebuild() builds new bvh and marks whole scene for upload, ranges marked
+ * before are dropped as every slot moves
+ */
+static void __rebuild(scene_t *scene)
+{
+	unsigned int alive = 0;
+	unsigned int *order;
+	unsigned int *ids;
+	bvh_t bvh;
+
+	scene->__dirty_spheres.size = 0;
+	scene->__dirty_nodes.size = 0;
+	scene->__dirty_lights.size = 0;
+
+	order = malloc((scene->__size + 1) * sizeof(unsigned int));
+	ids = malloc((scene->__size + 1) * sizeof(unsigned int));
+	panic_on(order == NULL || ids == NULL, "malloc");
+
+	for (unsigned int i = 0; i < scene->__size; ++i) {
+		if (scene->__slot_id[i] != SCENE_NO_SPHERE) {
+			scene->__spheres[alive] = scene->__spheres[i];
+			ids[alive] = scene->__slot_id[i];
+			++alive;
+		}
+	}
+	bvh = create_bvh(scene->__spheres, alive, BVH_LEAF_SIZE, order);
+	for (unsigned int i = 0; i < alive; ++i) {
+		scene->__slot_id[i] = ids[order[i]];
+		scene->__id_slot[ids[order[i]]] = i;
+	}
+	scene->__size = alive;
+	scene->__alive = alive;
+
+	__reserve_nodes(scene, bvh.__size, false);
+	memcpy(scene->__nodes, bvh.__nodes, bvh.__size * sizeof(struct BVHNode));
+	scene->__nodes_size = bvh.__size;
+	scene->__parent[0] = -1;
+	if (alive > 0) {
+		__index_node(scene, 0, -1);
+		__upload_spheres(scene, 0, alive);
+	}
+	__upload_nodes(scene, 0, scene->__nodes_size);
+	__collect_lights(scene);
+
+	destroy_bvh(bvh);
+	free(ids);
+	free(order);
+}
+
+/**
+ * scene_rebuild() builds new SAH bvh over alive spheres, dropping removed ones,
+ * and uploads whole scene. Incremental edits degrade bvh quality, so it is
+ * worth to call the function after big batch of edits
+ */
+void scene_rebuild(scene_t *scene)
+{
+	__rebuild(scene);
+	__scene_flush(scene);
+}
+
+static unsigned int __add_sphere(scene_t *scene, struct Sphere sphere)
+{
+	unsigned int slot = scene->__size;
+	unsigned int id = scene->__ids;
+	unsigned int node_id = 0;
+	unsigned int depth = 0;
+	float3 smin, smax;
+
+	if (id == scene->__ids_capacity) {
+		scene->__ids_capacity *= 2;
+		scene->__id_slot = __grow_array(scene->__id_slot,
+						scene->__ids_capacity,
+						sizeof(unsigned int));
+	}
+	__reserve_spheres(scene, slot + 1, true);
+	__reserve_nodes(scene, scene->__nodes_size + 2, true);
+
+	++scene->__ids;
+	++scene->__size;
+	++scene->__alive;
+	scene->__spheres[slot] = sphere;
+	scene->__slot_id[slot] = id;
+	scene->__id_slot[id] = slot;
+	scene->__light_of[slot] = SCENE_NO_SPHERE;
+	__upload_spheres(scene, slot, 1);
+
+	if (scene->__alive == 1) {
+		__rebuild(scene);
+		return id;
+	}
+
+	__sphere_box(&sphere, &smin, &smax);
+	while (scene->__nodes[node_id].count == 0) {
+		struct BVHNode *left =
+			&scene->__nodes[scene->__nodes[node_id].leftFirst];
+		float cost[2];
+
+		for (int c = 0; c < 2; ++c) {
+			float3 min = left[c].boxMin;
+			float3 max = left[c].boxMax;
+
+			__box_grow(&min, &max, smin, smax);
+			cost[c] = __box_area(min, max) -
+				  __box_area(left[c].boxMin, left[c].boxMax);
+		}
+		node_id = scene->__nodes[node_id].leftFirst +
+			  (cost[1] < cost[0]);
+		++depth;
+	}
+	if (depth + 2 >= BVH_STACK_SIZE) {
+		__rebuild(scene);
+		return id;
+	}
+
+	unsigned int pair = scene->__nodes_size;
+	scene->__nodes_size += 2;
+	scene->__nodes[pair] = scene->__nodes[node_id];
+	scene->__nodes[pair + 1] = (struct BVHNode){ .boxMin = smin,
+						     .boxMax = smax,
+						     .leftFirst = slot,
+						     .count = 1 };
+	scene->__nodes[node_id].leftFirst = pair;
+	scene->__nodes[node_id].count = 0;
+	__index_node(scene, node_id, scene->__parent[node_id]);
+
+	__upload_nodes(scene, pair, 2);
+	__upload_nodes(scene, node_id, 1);
+	__refit(scene, node_id);
+	__update_light(scene, slot);
+	return id;
+}
+
+/**
+ * scene_add_sphere() adds sphere to the scene. Sphere is inserted as a new leaf
+ * next to leaf which box grows least, so only new sphere and nodes on the path
+ * to the root are uploaded. If path becomes deeper then kernel traversal stack
+ * whole bvh is rebuilt
+ *
+ * @return id of added sphere
+ */
+unsigned int scene_add_sphere(scene_t *scene, struct Sphere sphere)
+{
+	unsigned int id = __add_sphere(scene, sphere);
+
+	__scene_flush(scene);
+	return id;
+}
+
+/**
+ * scene_update_sphere() replaces sphere in scene, uploading only the sphere
+ * and bvh nodes which boxes changed
+ */
+void scene_update_sphere(scene_t *scene, unsigned int id, struct Sphere sphere)
+{
+	panic_on(id >= scene->__ids || scene->__id_slot[id] == SCENE_NO_SPHERE,
+		 "invalid sphere id");
+	unsigned int slot = scene->__id_slot[id];
+
+	scene->__spheres[slot] = sphere;
+	__upload_spheres(scene, slot, 1);
+	__refit(scene, scene->__leaf[slot]);
+	__update_light(scene, slot);
+	__scene_flush(scene);
+}
+
+/**
+ * scene_remove_sphere() removes sphere from scene. Sphere slot is left in leaf
+ * with zero radius, so it is never intersected. Scene is compacted when
+ * removed spheres outnumber alive ones
+ */
+void scene_remove_sphere(scene_t *scene, unsigned int id)
+{
+	panic_on(id >= scene->__ids || scene->__id_slot[id] == SCENE_NO_SPHERE,
+		 "invalid sphere id");
+	unsigned int slot = scene->__id_slot[id];
+
+	scene->__id_slot[id] = SCENE_NO_SPHERE;
+	scene->__slot_id[slot] = SCENE_NO_SPHERE;
+	scene->__spheres[slot].radius = 0;
+	--scene->__alive;
+
+	if (scene->__size - scene->__alive > scene->__alive) {
+		__rebuild(scene);
+	} else {
+		__upload_spheres(scene, slot, 1);
+		__refit(scene, scene->__leaf[slot]);
+		__update_light(scene, slot);
+	}
+	__scene_flush(scene);
+}
+
+/**
+ * scene_add_demo() adds spheres of demo scene shown by interactive and offline
+ * renderers
+ */
+void scene_add_demo(scene_t *scene)
+{
+	// color, position, emission radius, reflective
+	scene_add_sphere(scene, (struct Sphere){ WHITE, FLOAT3(3, -0.1, 7), 0, 1.5, 0.95, 0.0 });
+	scene_add_sphere(scene, (struct Sphere){ LRED, FLOAT3(1.4, -0.2, 4.5), 0.0, 1, 0.0, 0.00 });
+	scene_add_sphere(scene, (struct Sphere){ LGREEN, FLOAT3(0, -0.3, 3), 0.0, 0.8, 0.0, 0.0 });
+	scene_add_sphere(scene, (struct Sphere){ LBLUE, FLOAT3(-1, -0.55, 2), 0.0, 0.5, 0.0, 0.0 });
+	scene_add_sphere(scene, (struct Sphere){ GREY, FLOAT3(-1.8, -0.75, 1.3), 0, 0.3, 0.0, 0.0 });
+	scene_add_sphere(scene, (struct Sphere){ LPURPLE, FLOAT3(0, -50, 0), 0.0, 49, 0.0, 0.0 });
+	scene_rebuild(scene);
+}
+
+/**
+ * set_scene_args() binds scene buffers and spheres number to kernel arguments.
+ * Buffers are replaced when scene grows, so arguments should be set again after
+ * scene is edited
+ */
+void set_scene_args(kernel_t *kernel, scene_t *scene, unsigned int spheres_pos,
+		    unsigned int nodes_pos, unsigned int num_pos)
+{
+	cl_uint spheres_num = scene->__size;
+
+	__set_kernel_arg(kernel->__kernel, spheres_pos, sizeof(cl_mem),
+			 &scene->__spheres_buffer.__buffer);
+	__set_kernel_arg(kernel->__kernel, nodes_pos, sizeof(cl_mem),
+			 &scene->__nodes_buffer.__buffer);
+	__set_kernel_arg(kernel->__kernel, num_pos, sizeof(cl_uint),
+			 &spheres_num);
+}
+
+/**
+ * set_scene_light_args() binds light list and its size to kernel arguments.
+ * Like set_scene_args(), it should be called again after scene is edited
+ */
+void set_scene_light_args(kernel_t *kernel, scene_t *scene,
+			  unsigned int lights_pos, unsigned int num_pos)
+{
+	cl_uint lights_num = scene->__lights_size;
+
+	__set_kernel_arg(kernel->__kernel, lights_pos, sizeof(cl_mem),
+			 &scene->__lights_buffer.__buffer);
+	__set_kernel_arg(kernel->__kernel, num_pos, sizeof(cl_uint),
+			 &lights_num);
+}
@@ -0,0 +1,384 @@
+#include <cllib/common.h>
+#include <split.h>
+
+/* weight of the last frame in averaged device speed */
+#define SPLIT_SMOOTHING 0.5
+
+/**
+ * create_split() builds runKernel() for every device and creates its buffers
+ * and scene. Frame is split evenly until device speeds are measured
+ *
+ * @param devices devices to split frame across, at most SPLIT_MAX_DEVICES
+ * @param source program source which includes source/path_tracer.cl
+ * @param options build options, with SCREEN_WIDTH and SCREEN_HEIGHT equal to
+ * 	width and height
+ * @param fill_scene adds spheres to scene of every device, it must add the
+ * 	same spheres every time
+ */
+split_t create_split(const device_t *devices, unsigned int count,
+		     unsigned int width, unsigned int height,
+		     const char *source, const char *options,
+		     void (*fill_scene)(scene_t *scene))
+{
+	size_t pixels = (size_t)width * height;
+	unsigned int granules = (height + ADAPTIVE_TILE_SIZE - 1) /
+				ADAPTIVE_TILE_SIZE;
+	unsigned int tiles_x = (width + ADAPTIVE_TILE_SIZE - 1) /
+			       ADAPTIVE_TILE_SIZE;
+	size_t tiles_num = (size_t)tiles_x * granules;
+	split_t split = {
+		.__devices = calloc(count, sizeof(struct split_device)),
+		.__count = count,
+		.__width = width,
+		.__height = height,
+		.__granules = granules,
+		.__tiles_x = tiles_x,
+		.__accum = calloc(pixels, sizeof(cl_float4)),
+		.__moments = calloc(pixels, sizeof(cl_float)),
+		.__tiles = malloc(tiles_num),
+	};
+
+	panic_on(count == 0 || count > SPLIT_MAX_DEVICES, "devices number");
+	panic_on(granules < count, "image is too small to split");
+	panic_on(split.__devices == NULL || split.__accum == NULL ||
+			 split.__moments == NULL || split.__tiles == NULL,
+		 "malloc");
+	memset(split.__tiles, 1, tiles_num);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		struct split_device *dev = &split.__devices[i];
+
+		dev->device = devices[i];
+		dev->context = create_context(devices[i]);
+		dev->queue = create_profiling_queue(dev->context, devices[i]);
+		dev->kernel = create_kernel(devices[i], dev->context, source,
+					    "runKernel", options);
+		dev->error = create_program_kernel(dev->kernel,
+						   "tileErrorKernel");
+		dev->scene = create_scene(dev->context, dev->queue, 8);
+		fill_scene(&dev->scene);
+
+		/* pixel without samples adds the first one as reset does */
+		dev->accum = create_buffer(dev->context, read_write,
+					   pixels * sizeof(cl_float4));
+		dev->moments = create_buffer(dev->context, read_write,
+					     pixels * sizeof(cl_float));
+		dev->mask = create_buffer(dev->context, read_write, tiles_num);
+		fill_buffer(dev->queue, dev->accum, pixels * sizeof(cl_float4),
+			    split.__accum, true);
+		fill_buffer(dev->queue, dev->moments, pixels * sizeof(cl_float),
+			    split.__moments, true);
+		fill_buffer(dev->queue, dev->mask, tiles_num, split.__tiles,
+			    true);
+
+		dev->start = (unsigned long)granules * i / count;
+		dev->end = (unsigned long)granules * (i + 1) / count;
+		dev->speed = 0;
+	}
+	return split;
+}
+
+void destroy_split(split_t *split)
+{
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+
+		release_buffer(dev->mask);
+		release_buffer(dev->moments);
+		release_buffer(dev->accum);
+		destroy_scene(&dev->scene);
+		release_kernel(dev->error);
+		release_kernel(dev->kernel);
+		release_queue(dev->queue);
+		release_context(dev->context);
+	}
+	free(split->__tiles);
+	free(split->__moments);
+	free(split->__accum);
+	free(split->__devices);
+}
+
+/**
+ * set_split_args() binds camera and buffers of every device
+ *
+ * @param error relative error tile is converged at, if it is 0, adaptive
+ * 	sampling is off and every pixel is traced
+ */
+void set_split_args(split_t *split, float3 position, struct RotateMatrix matrix,
+		    cl_uint max_depth, float error)
+{
+	/* denoiser is used only by interactive tracer */
+	buffer_t no_features = { .__buffer = NULL };
+	buffer_t no_mask = { .__buffer = NULL };
+	cl_int reset = 0;
+
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+
+		set_kernel_arg_at(dev->kernel, dev->accum, 0);
+		set_kernel_arg_at(dev->kernel, position, 2);
+		set_kernel_arg_at(dev->kernel, matrix, 3);
+		set_kernel_arg_at(dev->kernel, reset, 4);
+		set_scene_args(&dev->kernel, &dev->scene, 1, 6, 7);
+		set_scene_light_args(&dev->kernel, &dev->scene, 10, 11);
+		set_kernel_arg_at(dev->kernel, dev->moments, 8);
+		if (error > 0) {
+			set_kernel_arg_at(dev->kernel, dev->mask, 9);
+		} else {
+			set_kernel_arg_at(dev->kernel, no_mask, 9);
+		}
+		set_kernel_arg_at(dev->kernel, max_depth, 12);
+		set_kernel_arg_at(dev->kernel, no_features, 13);
+
+		set_kernel_arg_at(dev->error, dev->accum, 0);
+		set_kernel_arg_at(dev->error, dev->moments, 1);
+		set_kernel_arg_at(dev->error, dev->mask, 2);
+		set_kernel_arg_at(dev->error, error, 3);
+	}
+}
+
+static unsigned int split_rows(split_t *split, unsigned int granule)
+{
+	unsigned int row = granule * ADAPTIVE_TILE_SIZE;
+
+	return row < split->__height ? row : split->__height;
+}
+
+/**
+ * split_kernel_time() returns milliseconds device spent in runKernel() since
+ * previous call
+ */
+static double split_kernel_time(queue_t queue)
+{
+	unsigned int num = profile_stats(queue, NULL, 0);
+	struct profile_stats stats[num > 0 ? num : 1];
+	double time = 0;
+
+	profile_stats(queue, stats, num);
+	for (unsigned int i = 0; i < num; ++i) {
+		if (strcmp(stats[i].name, "runKernel") == 0) {
+			time = stats[i].mean * stats[i].count;
+		}
+	}
+	profile_reset(queue);
+	return time;
+}
+
+/**
+ * split_owner() returns index of device which band holds granule
+ *
+ * @param bounds band of device i is granules [bounds[i], bounds[i + 1])
+ */
+static unsigned int split_owner(const unsigned int *bounds,
+				unsigned int granule)
+{
+	unsigned int i = 0;
+
+	while (granule >= bounds[i + 1]) {
+		++i;
+	}
+	return i;
+}
+
+/**
+ * split_move_rows() moves accumulated samples and tile mask of granules
+ * [first, last) from device `from` to device `to`
+ */
+static void split_move_rows(split_t *split, unsigned int from, unsigned int to,
+			    unsigned int first, unsigned int last)
+{
+	struct split_device *src = &split->__devices[from];
+	struct split_device *dst = &split->__devices[to];
+	size_t offset = (size_t)split_rows(split, first) * split->__width;
+	size_t pixels = (size_t)split_rows(split, last) * split->__width -
+			offset;
+	size_t tiles = (size_t)first * split->__tiles_x;
+	size_t tiles_num = (size_t)(last - first) * split->__tiles_x;
+
+	dump_buffer_range(src->queue, src->accum, offset * sizeof(cl_float4),
+			  pixels * sizeof(cl_float4), split->__accum + offset,
+			  false);
+	dump_buffer_range(src->queue, src->moments, offset * sizeof(cl_float),
+			  pixels * sizeof(cl_float), split->__moments + offset,
+			  false);
+	dump_buffer_range(src->queue, src->mask, tiles, tiles_num,
+			  split->__tiles + tiles, true);
+	fill_buffer_range(dst->queue, dst->accum, offset * sizeof(cl_float4),
+			  pixels * sizeof(cl_float4), split->__accum + offset,
+			  false);
+	fill_buffer_range(dst->queue, dst->moments, offset * sizeof(cl_float),
+			  pixels * sizeof(cl_float), split->__moments + offset,
+			  false);
+	fill_buffer_range(dst->queue, dst->mask, tiles, tiles_num,
+			  split->__tiles + tiles, true);
+}
+
+/**
+ * split_rebalance() resizes bands in proportion to device speeds. Every
+ * device keeps at least one granule, so its speed is still measured
+ */
+static void split_rebalance(split_t *split)
+{
+	unsigned int bounds[SPLIT_MAX_DEVICES + 1];
+	unsigned int prev[SPLIT_MAX_DEVICES + 1];
+	unsigned int count = split->__count;
+	unsigned int granules = split->__granules;
+	double total = 0;
+	double sum = 0;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		total += split->__devices[i].speed;
+		prev[i] = split->__devices[i].start;
+	}
+	prev[count] = granules;
+	if (total <= 0) {
+		return;
+	}
+
+	bounds[0] = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int end;
+
+		sum += split->__devices[i].speed;
+		end = (unsigned int)(granules * sum / total + 0.5);
+		end = end > bounds[i] + 1 ? end : bounds[i] + 1;
+		end = end < granules - (count - 1 - i) ?
+			      end :
+			      granules - (count - 1 - i);
+		bounds[i + 1] = end;
+	}
+
+	for (unsigned int g = 0; g < granules;) {
+		unsigned int from = split_owner(prev, g);
+		unsigned int to = split_owner(bounds, g);
+		unsigned int end = g + 1;
+
+		while (end < granules && split_owner(prev, end) == from &&
+		       split_owner(bounds, end) == to) {
+			++end;
+		}
+		if (from != to) {
+			split_move_rows(split, from, to, g, end);
+		}
+		g = end;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		split->__devices[i].start = bounds[i];
+		split->__devices[i].end = bounds[i + 1];
+	}
+}
+
+/**
+ * run_split() traces frame on all devices, waits for them and resizes bands
+ * from time every device took
+ *
+ * @param frame frame number, frames are numbered from 1
+ */
+void run_split(split_t *split, cl_uint frame)
+{
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+		unsigned int row = split_rows(split, dev->start);
+
+		set_kernel_arg_at(dev->kernel, frame, 5);
+		set_kernel_offset_2d(dev->kernel, 0, row);
+		set_kernel_size_2d(dev->kernel, split->__width,
+				   split_rows(split, dev->end) - row);
+		run_kernel(dev->queue, dev->kernel);
+		flush_queue(dev->queue);
+	}
+
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+		double time = split_kernel_time(dev->queue);
+		double speed;
+
+		if (time <= 0) {
+			continue;
+		}
+		speed = (dev->end - dev->start) / time;
+		dev->speed = dev->speed > 0 ?
+				     dev->speed * (1 - SPLIT_SMOOTHING) +
+					     speed * SPLIT_SMOOTHING :
+				     speed;
+	}
+	split_rebalance(split);
+}
+
+/**
+ * update_split_mask() marks converged tiles of every band and reads mask back
+ *
+ * @return number of tiles still sampled
+ */
+unsigned int update_split_mask(split_t *split)
+{
+	size_t tiles_num = (size_t)split->__tiles_x * split->__granules;
+	unsigned int active = 0;
+
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+		size_t first = (size_t)dev->start * split->__tiles_x;
+		size_t num = (size_t)(dev->end - dev->start) * split->__tiles_x;
+
+		set_kernel_offset_2d(dev->error, 0, dev->start);
+		set_kernel_size_2d(dev->error, split->__tiles_x,
+				   dev->end - dev->start);
+		run_kernel(dev->queue, dev->error);
+		dump_buffer_range(dev->queue, dev->mask, first, num,
+				  split->__tiles + first, false);
+		flush_queue(dev->queue);
+	}
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		cl_int err = clFinish(split->__devices[i].queue.__queue);
+
+		cl_panic_on(err, "clFinish", err);
+	}
+	for (size_t i = 0; i < tiles_num; ++i) {
+		active += split->__tiles[i] != 0;
+	}
+	return active;
+}
+
+/**
+ * gather_split() reads band of every device into one image
+ *
+ * @return accumulated pixels, valid until next call of split function
+ */
+const cl_float4 *gather_split(split_t *split)
+{
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+		size_t offset = (size_t)split_rows(split, dev->start) *
+				split->__width;
+		size_t pixels = (size_t)split_rows(split, dev->end) *
+					split->__width -
+				offset;
+
+		dump_buffer_range(dev->queue, dev->accum,
+				  offset * sizeof(cl_float4),
+				  pixels * sizeof(cl_float4),
+				  split->__accum + offset, true);
+	}
+	return split->__accum;
+}
+
+/**
+ * split_dump() prints band of every device and its measured speed
+ */
+void split_dump(split_t *split, FILE *file)
+{
+	for (unsigned int i = 0; i < split->__count; ++i) {
+		struct split_device *dev = &split->__devices[i];
+		unsigned int rows = split_rows(split, dev->end) -
+				    split_rows(split, dev->start);
+		char name[128];
+		cl_int err;
+
+		err = clGetDeviceInfo(dev->device.__device, CL_DEVICE_NAME,
+				      sizeof(name), name, NULL);
+		cl_panic_on(err, "clGetDeviceInfo", err);
+		fprintf(file, "device %u: %s, %u rows (%.1f%%), %.2f rows/ms\n",
+			i, name, rows, 100.0 * rows / split->__height,
+			dev->speed * ADAPTIVE_TILE_SIZE);
+	}
+}
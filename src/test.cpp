@@ -1,8 +1,12 @@
 
 #define SPHERES_NUM 5
+#define MAX_DEPTH 5
+#define SUN_DIRECTION normalize(FLOAT3(-1, 0.5, -0.3))
 
 #include <source/path_tracer.cl>
 #include <linalg.h>
+#include <bvh.h>
+#include <executor.hpp>
 
 EXTERN_C
 
@@ -22,50 +26,94 @@ static struct Sphere *init_scene(void)
 	spheres[0] = { .color = RED,
 		       .position = FLOAT3(-0.3, -0.8, 9),
 		       .emissionStrength = 0.0,
-		       .radius = 1 };
+		       .radius = 1,
+		       .reflective = 0.0,
+		       .specular = 0.0 };
 	spheres[1] = { .color = PURPLE,
 		       .position = FLOAT3(0, -100, 0),
 		       .emissionStrength = 0.0,
-		       .radius = 99 };
+		       .radius = 99,
+		       .reflective = 0.0,
+		       .specular = 0.0 };
 	spheres[2] = { .color = BLUE,
 		       .position = FLOAT3(0, 0, 7),
 		       .emissionStrength = 0.0,
-		       .radius = 0.8 };
+		       .radius = 0.8,
+		       .reflective = 0.0,
+		       .specular = 0.0 };
 	spheres[3] = { .color = WHITE,
 		       .position = FLOAT3(-8, 8, 10),
 		       .emissionStrength = 1,
-		       .radius = 10 };
+		       .radius = 10,
+		       .reflective = 0.0,
+		       .specular = 0.0 };
 	spheres[4] = { .color = CYAN,
 		       .position = FLOAT3(1.3, -0.3, 7),
 		       .emissionStrength = 0.0,
-		       .radius = 0.7 };
+		       .radius = 0.7,
+		       .reflective = 0.0,
+		       .specular = 0.0 };
 
 	return spheres;
 }
 
+/**
+ * init_lights() fills lights with indices of emissive spheres
+ *
+ * @return number of lights
+ */
+static unsigned int init_lights(const struct Sphere *spheres,
+				unsigned int *lights)
+{
+	unsigned int num = 0;
+
+	for (unsigned int i = 0; i < SPHERES_NUM; ++i) {
+		if (spheres[i].emissionStrength > 0) {
+			lights[num++] = i;
+		}
+	}
+	return num;
+}
+
 unsigned int *run()
 {
 	g_canvas = (unsigned int *)malloc(SCREEN_WIDTH * SCREEN_HEIGHT *
 					  sizeof(unsigned int));
+	float4 *accum = (float4 *)malloc(SCREEN_WIDTH * SCREEN_HEIGHT *
+					 sizeof(float4));
+	float *moments = (float *)malloc(SCREEN_WIDTH * SCREEN_HEIGHT *
+					 sizeof(float));
 	struct Sphere *scene = init_scene();
+	bvh_t bvh = create_bvh(scene, SPHERES_NUM, CLCPP_PACKET_WIDTH, NULL);
+	unsigned int lights[SPHERES_NUM];
+	unsigned int lights_num = init_lights(scene, lights);
 	struct Camera camera = { .position = FLOAT3(0, 0, 0),
 				 .alpha = 0,
-				 .theta = 0 };
+				 .theta = 0,
+				 .matrix = {} };
+
+	static tile_pool pool(executor_threads());
 
 	compute_rotation_matrix(&camera.matrix, camera.alpha, camera.theta);
 	printf("   ");
-	for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-		__dim.y = y;
-		printf("\b\b\b%2d%%", y * 100 / SCREEN_HEIGHT);
-		fflush(stdout);
-		for (int x = 0; x < SCREEN_WIDTH; ++x) {
-			__dim.x = x;
-			runKernel(g_canvas, scene, camera.position,
-				  camera.matrix);
-		}
-	}
+	pool.run_2d(
+		SCREEN_WIDTH, SCREEN_HEIGHT,
+		[&] {
+			runKernel(accum, scene, camera.position, camera.matrix,
+				  true, 1, bvh.__nodes, SPHERES_NUM, moments,
+				  NULL, lights, lights_num, MAX_DEPTH, NULL);
+		},
+		[](size_t done, size_t total) {
+			printf("\b\b\b%2d%%", (int)(done * 100 / total));
+			fflush(stdout);
+		});
 	printf("\b\b\b");
 	fflush(stdout);
+	pool.run_2d(SCREEN_WIDTH, SCREEN_HEIGHT,
+		    [&] { resolveKernel(g_canvas, accum); });
+	free(moments);
+	free(accum);
+	destroy_bvh(bvh);
 	return g_canvas;
 }
 
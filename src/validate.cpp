@@ -1,51 +1,594 @@
-
 #include <source/random.cl>
+#include <executor.hpp>
 
-EXTERN_C
+/* samples generated by one work-item of batch functions */
+#define VALIDATE_CHUNK 65536
 
-struct float_seed {
-	float number;
-	unsigned int seed;
+/**
+ * verdict is result of statistical test. Hypothesis that samples come from
+ * expected distribution is rejected if p_value is small, 1e-4 or less
+ */
+struct verdict {
+	double statistic;
+	double p_value;
 };
 
-struct float3_seed {
-	float x;
-	float y;
-	float z;
-	unsigned int seed;
+/**
+ * stream_layout selects random streams samples of batch are taken from
+ */
+enum stream_layout {
+	/* sample i is the first number of stream of pixel i */
+	across_pixels = 0,
+	/* sample i is the dimension i of stream of pixel 0 */
+	along_dimensions = 1,
 };
 
-__used int _call_nextRandomInt(unsigned int seed)
+/**
+ * __for_chunks() calls fn(begin, end) for VALIDATE_CHUNK sized ranges of
+ * [0, n) on executor threads
+ */
+template <typename Fn> static void __for_chunks(size_t n, Fn fn)
+{
+	static tile_pool pool(executor_threads());
+	unsigned int chunks = (n + VALIDATE_CHUNK - 1) / VALIDATE_CHUNK;
+
+	pool.run_2d(chunks, 1, [&] {
+		size_t begin = (size_t)get_global_id(0) * VALIDATE_CHUNK;
+
+		fn(begin, min(begin + VALIDATE_CHUNK, n));
+	});
+}
+
+/**
+ * __stream() returns random stream sample i of batch is generated from. Pixels
+ * across are numbered row by row in 65536 wide image
+ */
+static struct RandomState __stream(size_t i, unsigned int sample,
+				   enum stream_layout layout)
+{
+	struct RandomState rng;
+
+	if (layout == along_dimensions) {
+		initRandom(&rng, 0, 0, sample);
+		rng.dimension = i;
+	} else {
+		initRandom(&rng, i & 0xffff, i >> 16, sample);
+	}
+	return rng;
+}
+
+template <typename Generate>
+static void __batch(size_t n, unsigned int sample, enum stream_layout layout,
+		    Generate generate)
+{
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			struct RandomState rng = __stream(i, sample, layout);
+
+			generate(&rng, i);
+		}
+	});
+}
+
+/**
+ * __store_direction() stores sampled direction and, if pdfs is not NULL, its
+ * density
+ */
+static void __store_direction(float *out, float *pdfs, size_t i, float3 dir,
+			      float pdf)
 {
-	return nextRandomInt(seed);
+	out[i * 3] = dir.x;
+	out[i * 3 + 1] = dir.y;
+	out[i * 3 + 2] = dir.z;
+	if (pdfs != NULL) {
+		pdfs[i] = pdf;
+	}
 }
 
-__used struct float_seed _call_nextRandomFloat(unsigned int seed)
+/**
+ * __chi_square_p() returns probability that chi-square statistic with dof
+ * degrees of freedom is at least chi2, using Wilson-Hilferty approximation.
+ * It is accurate enough for tens of bins and more
+ */
+static double __chi_square_p(double chi2, double dof)
 {
-	float number = nextRandomFloat(&seed);
-	return { .number = number, .seed = seed };
+	double mean = 1 - 2 / (9 * dof);
+	double z = (std::cbrt(chi2 / dof) - mean) / std::sqrt(2 / (9 * dof));
+
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+static struct verdict __chi_square(const std::vector<size_t> &counts,
+				   size_t n)
+{
+	double expected = (double)n / counts.size();
+	double chi2 = 0;
+
+	for (size_t count : counts) {
+		chi2 += (count - expected) * (count - expected) / expected;
+	}
+	return { chi2, __chi_square_p(chi2, counts.size() - 1) };
 }
 
-__used struct float_seed _call_nextRandomFloatNeg(unsigned int seed)
+/**
+ * __histogram() counts values of [0, 1) in bins, every chunk is counted on
+ * its own thread and merged
+ */
+template <typename Bin>
+static std::vector<size_t> __histogram(size_t n, unsigned int bins, Bin bin)
 {
-	float number = nextRandomFloatNeg(&seed);
-	return { .number = number, .seed = seed };
+	std::vector<size_t> counts(bins);
+	std::mutex lock;
+
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		std::vector<size_t> local(bins);
+
+		for (size_t i = begin; i < end; ++i) {
+			local[min(bin(i), bins - 1)]++;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		for (unsigned int i = 0; i < bins; ++i) {
+			counts[i] += local[i];
+		}
+	});
+	return counts;
 }
 
-__used struct float3_seed _call_randomDirection(unsigned int seed)
+static unsigned int __bin(double u, unsigned int bins)
 {
-	float3 vector;
-	randomDirection(&vector, &seed);
-	return { .x = vector.x, .y = vector.y, .z = vector.z, .seed = seed };
+	return u <= 0 ? 0 : (unsigned int)(u * bins);
 }
 
-__used struct float3_seed _call_randomHemiSphere(unsigned int seed, float nx,
-						float ny, float nz)
+/**
+ * __test_directions() bins directions by cdf(cos(theta)) and azimuth around
+ * axis in bins x bins grid. cdf should map cosines of expected distribution
+ * to uniform [0, 1). Directions which are not unit or, unless sphere is
+ * true, are below hemisphere of axis fail test with p_value 0
+ */
+template <typename Cdf>
+static struct verdict __test_directions(const float *dirs, size_t n,
+					float3 axis, bool sphere,
+					unsigned int bins, Cdf cdf)
 {
-	float3 vector;
-	float3 normal = FLOAT3(nx, ny, nz);
-	randomHemiSphere(&normal, &vector, &seed);
-	return { .x = vector.x, .y = vector.y, .z = vector.z, .seed = seed };
+	float3 tangent;
+	float3 bitangent;
+	std::atomic<size_t> invalid(0);
+
+	orthonormalBasis(axis, &tangent, &bitangent);
+	std::vector<size_t> counts = __histogram(n, bins * bins, [&](size_t i) {
+		float3 dir = FLOAT3(dirs[i * 3], dirs[i * 3 + 1],
+				    dirs[i * 3 + 2]);
+		double c = dot(dir, axis);
+		double phi = std::atan2(dot(dir, bitangent),
+					dot(dir, tangent));
+
+		if (std::fabs(length(dir) - 1) > 1e-4 || (!sphere && c < 0)) {
+			invalid++;
+		}
+		return __bin(cdf(min(max(c, -1.0), 1.0)), bins) * bins +
+		       __bin((phi + PI) / (2 * PI), bins);
+	});
+
+	struct verdict verdict = __chi_square(counts, n);
+	if (invalid > 0) {
+		verdict.p_value = 0;
+	}
+	return verdict;
+}
+
+/**
+ * __packet_hit() is closest hit found by intersectSpheresPacket() of width W
+ */
+template <int W>
+static void __packet_hit(const struct Ray *ray, const struct Sphere *spheres,
+			 int num, float *distance, int *id)
+{
+	*distance = INFINITY;
+	*id = intersectSpheresPacket<W>(distance, ray, spheres, 0, num);
+}
+
+EXTERN_C
+
+__used void _batch_nextRandomInt(unsigned int *out, size_t n,
+				 unsigned int sample, enum stream_layout layout)
+{
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			struct RandomState rng = __stream(i, sample, layout);
+
+			out[i] = nextRandomInt(&rng);
+		}
+	});
+}
+
+/**
+ * _batch_sample2D() fills out with first n samples of dimension of pixel, 2
+ * floats each, drawn from sampler, one of SAMPLER_* values. Unlike other
+ * batches, consecutive samples of one stream are generated
+ */
+__used void _batch_sample2D(float *out, size_t n, unsigned int x,
+			    unsigned int y, unsigned int dimension,
+			    unsigned int sampler)
+{
+	unsigned int pixel = y << 16 | x;
+
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			unsigned int v[2];
+
+			if (sampler == SAMPLER_SOBOL) {
+				sobolSample2D(pixel, i, dimension, v);
+			} else if (sampler == SAMPLER_BLUE_NOISE) {
+				blueNoiseSample2D(pixel, i, dimension, v);
+			} else {
+				whiteNoiseSample2D(pixel, i, dimension, v);
+			}
+			out[i * 2] = randomUnit(v[0]);
+			out[i * 2 + 1] = randomUnit(v[1]);
+		}
+	});
+}
+
+__used void _batch_nextRandomFloat(float *out, size_t n, unsigned int sample,
+				   enum stream_layout layout)
+{
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		out[i] = nextRandomFloat(rng);
+	});
+}
+
+__used void _batch_nextRandomFloatNeg(float *out, size_t n, unsigned int sample,
+				      enum stream_layout layout)
+{
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		out[i] = nextRandomFloatNeg(rng);
+	});
+}
+
+__used void _batch_nextRandomFloatNormal(float *out, size_t n,
+					 unsigned int sample,
+					 enum stream_layout layout)
+{
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		out[i] = nextRandomFloatNormal(rng);
+	});
+}
+
+/**
+ * _batch_randomDirection() fills out with n directions, 3 floats each, and
+ * pdfs, if it is not NULL, with their densities
+ */
+__used void _batch_randomDirection(float *out, float *pdfs, size_t n,
+				   unsigned int sample,
+				   enum stream_layout layout)
+{
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		__store_direction(out, pdfs, i, randomDirection(rng),
+				  uniformSpherePdf());
+	});
+}
+
+/**
+ * _batch_randomHemiSphere() fills out with n directions around normal, 3
+ * floats each, and pdfs, if it is not NULL, with their densities
+ */
+__used void _batch_randomHemiSphere(float *out, float *pdfs, size_t n,
+				    unsigned int sample,
+				    enum stream_layout layout, float nx,
+				    float ny, float nz)
+{
+	float3 normal = normalize(FLOAT3(nx, ny, nz));
+
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		__store_direction(out, pdfs, i, randomHemiSphere(normal, rng),
+				  uniformHemiSpherePdf());
+	});
+}
+
+__used void _batch_randomCosineHemiSphere(float *out, float *pdfs, size_t n,
+					  unsigned int sample,
+					  enum stream_layout layout, float nx,
+					  float ny, float nz)
+{
+	float3 normal = normalize(FLOAT3(nx, ny, nz));
+
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		float3 dir = randomCosineHemiSphere(normal, rng);
+
+		__store_direction(out, pdfs, i, dir,
+				  cosineHemiSpherePdf(normal, dir));
+	});
+}
+
+__used void _batch_randomCone(float *out, float *pdfs, size_t n,
+			      unsigned int sample, enum stream_layout layout,
+			      float ax, float ay, float az, float cosMax)
+{
+	float3 axis = normalize(FLOAT3(ax, ay, az));
+
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		__store_direction(out, pdfs, i, randomCone(axis, cosMax, rng),
+				  conePdf(cosMax));
+	});
+}
+
+__used void _batch_randomGGXLobe(float *out, float *pdfs, size_t n,
+				 unsigned int sample, enum stream_layout layout,
+				 float ax, float ay, float az, float alpha)
+{
+	float3 axis = normalize(FLOAT3(ax, ay, az));
+
+	__batch(n, sample, layout, [&](struct RandomState *rng, size_t i) {
+		float3 dir = randomGGXLobe(axis, alpha, rng);
+
+		__store_direction(out, pdfs, i, dir,
+				  ggxLobePdf(axis, alpha, dir));
+	});
+}
+
+/**
+ * _test_uniform() is chi-square test of values being uniform in [lo, hi)
+ *
+ * @param values array of n * stride floats, values[i * stride] are tested
+ * @param bins number of equal histogram bins
+ */
+__used struct verdict _test_uniform(const float *values, size_t n,
+				    unsigned int stride, unsigned int bins,
+				    double lo, double hi)
+{
+	std::vector<size_t> counts = __histogram(n, bins, [&](size_t i) {
+		return __bin((values[i * stride] - lo) / (hi - lo), bins);
+	});
+	return __chi_square(counts, n);
+}
+
+/**
+ * _test_uniform_2d() is chi-square test of points being uniform in unit
+ * square, which is split in bins x bins cells
+ *
+ * @param values array of n points, 2 floats each
+ */
+__used struct verdict _test_uniform_2d(const float *values, size_t n,
+				       unsigned int bins)
+{
+	std::vector<size_t> counts = __histogram(n, bins * bins, [&](size_t i) {
+		return __bin(values[i * 2], bins) * bins +
+		       __bin(values[i * 2 + 1], bins);
+	});
+	return __chi_square(counts, n);
+}
+
+/**
+ * _test_stratified() checks that every of bins x bins cells of unit square
+ * gets exactly n / bins^2 points, as (0, m, 2)-net does for any power of two
+ * bins with bins^2 dividing n. Statistic is the largest count deviation
+ *
+ * @param values array of n points, 2 floats each
+ */
+__used struct verdict _test_stratified(const float *values, size_t n,
+				       unsigned int bins)
+{
+	std::vector<size_t> counts = __histogram(n, bins * bins, [&](size_t i) {
+		return __bin(values[i * 2], bins) * bins +
+		       __bin(values[i * 2 + 1], bins);
+	});
+	double expected = (double)n / (bins * bins);
+	double deviation = 0;
+
+	for (size_t count : counts) {
+		deviation = max(deviation, std::fabs(count - expected));
+	}
+	return { deviation, deviation == 0 ? 1.0 : 0.0 };
+}
+
+/**
+ * _test_normal() is chi-square test of values being standard normal. Values
+ * are mapped to [0, 1) with normal distribution function first
+ */
+__used struct verdict _test_normal(const float *values, size_t n,
+				   unsigned int bins)
+{
+	std::vector<size_t> counts = __histogram(n, bins, [&](size_t i) {
+		double u = 0.5 * std::erfc(-values[i] / std::sqrt(2.0));
+		return __bin(u, bins);
+	});
+	return __chi_square(counts, n);
+}
+
+/**
+ * _test_serial() tests values for correlation with values lag samples later.
+ * Statistic is Pearson correlation coefficient, it is approximately normal
+ * with variance 1 / n for independent samples
+ *
+ * @param values array of n * stride floats, values[i * stride] are tested
+ */
+__used struct verdict _test_serial(const float *values, size_t n,
+				   unsigned int stride, unsigned int lag)
+{
+	double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+	size_t m = n > lag ? n - lag : 0;
+	std::mutex lock;
+
+	__for_chunks(m, [&](size_t begin, size_t end) {
+		double x = 0, y = 0, xx = 0, yy = 0, xy = 0;
+
+		for (size_t i = begin; i < end; ++i) {
+			double a = values[i * stride];
+			double b = values[(i + lag) * stride];
+
+			x += a, y += b, xx += a * a, yy += b * b, xy += a * b;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		sx += x, sy += y, sxx += xx, syy += yy, sxy += xy;
+	});
+	if (m < 2) {
+		return { 0, 0 };
+	}
+
+	double cov = sxy / m - sx / m * sy / m;
+	double vx = sxx / m - sx / m * sx / m;
+	double vy = syy / m - sy / m * sy / m;
+	double r = cov / std::sqrt(vx * vy);
+	return { r, std::erfc(std::fabs(r) * std::sqrt((double)m / 2)) };
+}
+
+/**
+ * _test_directions() is chi-square test of directions distribution around
+ * normal. Directions are expected to have density proportional to
+ * cos(theta)^exponent on hemisphere, or to be uniform on sphere if sphere is
+ * true. Then both cos(theta)^(exponent + 1) (or (cos(theta) + 1) / 2 on
+ * sphere) and azimuth are uniform and independent
+ *
+ * @param dirs array of n directions, 3 floats each
+ */
+__used struct verdict _test_directions(const float *dirs, size_t n, float nx,
+				       float ny, float nz, float exponent,
+				       bool sphere, unsigned int bins)
+{
+	float3 normal = normalize(FLOAT3(nx, ny, nz));
+
+	return __test_directions(dirs, n, normal, sphere, bins, [&](double c) {
+		return sphere ? (c + 1) / 2 : std::pow(max(c, 0.0),
+						      exponent + 1);
+	});
+}
+
+/**
+ * _test_ggx_lobe() is chi-square test of directions being distributed as
+ * randomGGXLobe() around axis. For GGX lobe
+ * (1 - cos^2) / (1 + (alpha^2 - 1) * cos^2) is uniform
+ */
+__used struct verdict _test_ggx_lobe(const float *dirs, size_t n, float ax,
+				     float ay, float az, float alpha,
+				     unsigned int bins)
+{
+	float3 axis = normalize(FLOAT3(ax, ay, az));
+	double a2 = (double)alpha * alpha;
+
+	return __test_directions(dirs, n, axis, false, bins, [&](double c) {
+		return (1 - c * c) / (1 + (a2 - 1) * c * c);
+	});
+}
+
+/**
+ * _test_cone() is chi-square test of directions being uniform in cone around
+ * axis, so (1 - cos(theta)) / (1 - cosMax) is uniform
+ */
+__used struct verdict _test_cone(const float *dirs, size_t n, float ax,
+				 float ay, float az, float cosMax,
+				 unsigned int bins)
+{
+	float3 axis = normalize(FLOAT3(ax, ay, az));
+
+	return __test_directions(dirs, n, axis, cosMax < 0, bins,
+				 [&](double c) {
+		return (1 - c) / (1 - cosMax);
+	});
+}
+
+/**
+ * _test_pdf() checks that pdfs are densities directions were sampled with.
+ * Mean of cos(theta)^2 / pdf, where theta is angle to axis, estimates integral
+ * of cos(theta)^2 over sampled domain, which is
+ * 2 * PI * (1 - cosMax^3) / 3 for cone of directions with cosine at least
+ * cosMax: cosMax is 0 for hemisphere and -1 for sphere. Statistic is the
+ * estimate
+ *
+ * @param dirs array of n directions, 3 floats each
+ * @param pdfs array of n densities
+ * @param cosMax cosine of half-angle of sampled domain
+ */
+__used struct verdict _test_pdf(const float *dirs, const float *pdfs, size_t n,
+				float ax, float ay, float az, float cosMax)
+{
+	float3 axis = normalize(FLOAT3(ax, ay, az));
+	double expected = 2 * PI * (1 - std::pow((double)cosMax, 3)) / 3;
+	double sum = 0, sum2 = 0;
+	std::mutex lock;
+
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		double s = 0, s2 = 0;
+
+		for (size_t i = begin; i < end; ++i) {
+			float3 dir = FLOAT3(dirs[i * 3], dirs[i * 3 + 1],
+					    dirs[i * 3 + 2]);
+			double c = dot(dir, axis);
+			double v = pdfs[i] > 0 ? c * c / pdfs[i] : 0;
+
+			s += v, s2 += v * v;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		sum += s, sum2 += s2;
+	});
+
+	double mean = sum / n;
+	double sd = std::sqrt(max(sum2 / n - mean * mean, 0.0) / n);
+	double z = (mean - expected) / max(sd, 1e-12);
+	return { mean, std::erfc(std::fabs(z) / std::sqrt(2.0)) };
+}
+
+
+/**
+ * _test_packet_hits() casts n random rays at random sets of spheres and checks
+ * that every packet width clcpp is built with finds the same closest hit,
+ * distance and sphere, as width 1. Every set repeats some spheres, so ties
+ * are resolved to the lowest index like the scalar loop does. Statistic is
+ * number of rays whose hit differs, p-value is 1 only if there are none
+ */
+__used struct verdict _test_packet_hits(size_t n, unsigned int spheres_num)
+{
+	size_t mismatches = 0;
+	std::mutex lock;
+
+	__for_chunks(n, [&](size_t begin, size_t end) {
+		std::vector<struct Sphere> spheres(spheres_num);
+		size_t bad = 0;
+
+		for (size_t i = begin; i < end; ++i) {
+			struct RandomState rng = __stream(i, 0, across_pixels);
+			struct Ray ray;
+			float d1;
+			int id1;
+
+			for (unsigned int s = 0; s < spheres_num; ++s) {
+				if (s > 0 && nextRandomFloat(&rng) < 0.25f) {
+					spheres[s] = spheres[s - 1];
+					continue;
+				}
+				spheres[s] = {};
+				spheres[s].position =
+					FLOAT3(nextRandomFloatNeg(&rng) * 4,
+					       nextRandomFloatNeg(&rng) * 4,
+					       nextRandomFloat(&rng) * 8 + 2);
+				spheres[s].radius =
+					nextRandomFloat(&rng) * 1.5f + 0.1f;
+			}
+			ray.origin = FLOAT3(0, 0, 0);
+			ray.direction = randomCone(FLOAT3(0, 0, 1), 0.8f,
+						   &rng);
+			__packet_hit<1>(&ray, spheres.data(), spheres_num,
+					&d1, &id1);
+#if defined(__SSE2__) || defined(__ARM_NEON)
+			float d4;
+			int id4;
+
+			__packet_hit<4>(&ray, spheres.data(), spheres_num,
+					&d4, &id4);
+			bad += id4 != id1 || (id1 != -1 && d4 != d1);
+#endif
+#if defined(__AVX__)
+			float d8;
+			int id8;
+
+			__packet_hit<8>(&ray, spheres.data(), spheres_num,
+					&d8, &id8);
+			bad += id8 != id1 || (id1 != -1 && d8 != d1);
+#endif
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		mismatches += bad;
+	});
+	return { (double)mismatches, mismatches == 0 ? 1.0 : 0.0 };
 }
 
 EXTERN_C_END
@@ -1,108 +1,244 @@
-
 import ctypes
-import matplotlib.pyplot as plt
-import numpy as np
-import seaborn as sns
-
-INT_MAX = 2 ** 32
-
-class FLOAT_SEED(ctypes.Structure):
-	_fields_ = [('number', ctypes.c_float),
-		    ('seed', ctypes.c_uint)]
+import sys
 
-class FLOAT3_SEED(ctypes.Structure):
-	_fields_ = [('x', ctypes.c_float),
-		    ('y', ctypes.c_float),
-		    ('z', ctypes.c_float),
-		    ('seed', ctypes.c_uint)]
-
-def distribution(name, array):
-	plt.title(name)
-	plt.grid()
-	sns.kdeplot(array)
-	plt.show()
+import numpy as np
 
-def distribution3d(name, array):
+SAMPLES = 1 << 22
+BINS = 256
+LAGS = (1, 2, 3, 7)
+GGX_ALPHAS = (0.05, 0.5, 1)
+# cosines of cone half-angles, the first is sun cone of path tracer
+CONES = (0.94, 0.999)
+# hypothesis is rejected if p-value is below it
+ALPHA = 1e-4
+
+ACROSS_PIXELS = 0
+ALONG_DIMENSIONS = 1
+
+SAMPLERS = (('white noise', 0), ('sobol', 1), ('blue noise', 2))
+# stratification of 2D nets is checked on STRATA x STRATA cells
+STRATA = 64
+# sphere counts packet widths are compared on, they leave partial packets
+PACKET_SPHERES = (1, 3, 4, 7, 8, 13, 32)
+PACKET_RAYS = 1 << 16
+
+class VERDICT(ctypes.Structure):
+	_fields_ = [('statistic', ctypes.c_double),
+		    ('p_value', ctypes.c_double)]
+
+def load(path='./pathtracer.so'):
+	tr = ctypes.CDLL(path)
+	floats = np.ctypeslib.ndpointer(dtype=np.float32, flags='C_CONTIGUOUS')
+	uints = np.ctypeslib.ndpointer(dtype=np.uint32, flags='C_CONTIGUOUS')
+	batch = [ctypes.c_size_t, ctypes.c_uint, ctypes.c_int]
+
+	# pdfs array of direction samplers may be NULL
+	pdfs = ctypes.c_void_p
+
+	tr._batch_nextRandomInt.argtypes = [uints] + batch
+	tr._batch_sample2D.argtypes = [floats, ctypes.c_size_t] + \
+		[ctypes.c_uint] * 4
+	for name in ('nextRandomFloat', 'nextRandomFloatNeg',
+		     'nextRandomFloatNormal'):
+		getattr(tr, '_batch_' + name).argtypes = [floats] + batch
+	tr._batch_randomDirection.argtypes = [floats, pdfs] + batch
+	for name in ('randomHemiSphere', 'randomCosineHemiSphere'):
+		getattr(tr, '_batch_' + name).argtypes = [floats, pdfs] + \
+			batch + [ctypes.c_float] * 3
+	for name in ('randomCone', 'randomGGXLobe'):
+		getattr(tr, '_batch_' + name).argtypes = [floats, pdfs] + \
+			batch + [ctypes.c_float] * 4
+
+	tr._test_uniform.argtypes = [floats, ctypes.c_size_t, ctypes.c_uint,
+				     ctypes.c_uint, ctypes.c_double,
+				     ctypes.c_double]
+	tr._test_normal.argtypes = [floats, ctypes.c_size_t, ctypes.c_uint]
+	for name in ('uniform_2d', 'stratified'):
+		getattr(tr, '_test_' + name).argtypes = [floats, ctypes.c_size_t,
+							 ctypes.c_uint]
+	tr._test_serial.argtypes = [floats, ctypes.c_size_t, ctypes.c_uint,
+				    ctypes.c_uint]
+	tr._test_directions.argtypes = [floats, ctypes.c_size_t] + \
+		[ctypes.c_float] * 4 + [ctypes.c_bool, ctypes.c_uint]
+	tr._test_ggx_lobe.argtypes = [floats, ctypes.c_size_t] + \
+		[ctypes.c_float] * 4 + [ctypes.c_uint]
+	tr._test_cone.argtypes = [floats, ctypes.c_size_t] + \
+		[ctypes.c_float] * 4 + [ctypes.c_uint]
+	tr._test_pdf.argtypes = [floats, floats, ctypes.c_size_t] + \
+		[ctypes.c_float] * 4
+	tr._test_packet_hits.argtypes = [ctypes.c_size_t, ctypes.c_uint]
+	for name in ('uniform', 'normal', 'serial', 'directions', 'ggx_lobe',
+		     'cone', 'pdf', 'uniform_2d', 'stratified', 'packet_hits'):
+		getattr(tr, '_test_' + name).restype = VERDICT
+	return tr
+
+def sample(tr, name, layout, *args, width=1):
+	array = np.zeros(SAMPLES * width, dtype=np.float32)
+	getattr(tr, '_batch_' + name)(array, SAMPLES, 1, layout, *args)
+	return array
+
+def sample_directions(tr, name, layout, *args):
+	"""
+	sample_directions() returns directions and their densities
+	"""
+	dirs = np.zeros(SAMPLES * 3, dtype=np.float32)
+	pdfs = np.zeros(SAMPLES, dtype=np.float32)
+	getattr(tr, '_batch_' + name)(dirs, pdfs.ctypes.data, SAMPLES, 1,
+				      layout, *args)
+	return dirs, pdfs
+
+def serial(tr, array, stride=1):
+	return [(f'serial lag {lag}',
+		 tr._test_serial(array, SAMPLES, stride, lag)) for lag in LAGS]
+
+def sequence_tests(tr):
+	"""
+	sequence_tests() yields (sampler, test, verdict) for consecutive samples
+	of the first dimension of pixel, which blue noise sampler dithers, drawn
+	from every sampler. Samples of Sobol sequence must be stratified, all of
+	them uniform
+	"""
+	for name, sampler in SAMPLERS:
+		array = np.zeros(SAMPLES * 2, dtype=np.float32)
+		tr._batch_sample2D(array, SAMPLES, 17, 5, 0, sampler)
+		results = [
+			('uniform x', tr._test_uniform(array, SAMPLES, 2, BINS,
+						       0, 1)),
+			('uniform y', tr._test_uniform(array[1:], SAMPLES, 2,
+						       BINS, 0, 1)),
+			('uniform 2d', tr._test_uniform_2d(array, SAMPLES, 32)),
+		]
+		if name == 'sobol':
+			results.append(('stratified', tr._test_stratified(
+				array, SAMPLES, STRATA)))
+		for test, verdict in results:
+			yield f'sample2D {name} (samples)', test, verdict
+
+def tests(tr):
+	"""
+	tests() yields (sampler, test, verdict) for every sampler and stream
+	layout
+	"""
+	layouts = (('pixels', ACROSS_PIXELS), ('dimensions', ALONG_DIMENSIONS))
+	normal = (0.3, 0.8, -0.2)
+
+	yield from sequence_tests(tr)
+
+	for num in PACKET_SPHERES:
+		yield 'intersectSpheresPacket', f'{num} spheres', \
+			tr._test_packet_hits(PACKET_RAYS, num)
+
+	for layout_name, layout in layouts:
+		ints = np.zeros(SAMPLES, dtype=np.uint32)
+		tr._batch_nextRandomInt(ints, SAMPLES, 1, layout)
+		low = ((ints & 0xffff) / 65536.0).astype(np.float32)
+		high = ((ints >> 16) / 65536.0).astype(np.float32)
+		suite = {
+			'nextRandomInt low bits': [
+				('uniform', tr._test_uniform(low, SAMPLES, 1,
+							     BINS, 0, 1))
+			] + serial(tr, low),
+			'nextRandomInt high bits': [
+				('uniform', tr._test_uniform(high, SAMPLES, 1,
+							     BINS, 0, 1))
+			] + serial(tr, high),
+		}
+
+		array = sample(tr, 'nextRandomFloat', layout)
+		suite['nextRandomFloat'] = [
+			('uniform', tr._test_uniform(array, SAMPLES, 1, BINS,
+						     0, 1))
+		] + serial(tr, array)
+
+		array = sample(tr, 'nextRandomFloatNeg', layout)
+		suite['nextRandomFloatNeg'] = [
+			('uniform', tr._test_uniform(array, SAMPLES, 1, BINS,
+						     -1, 1))
+		] + serial(tr, array)
+
+		array = sample(tr, 'nextRandomFloatNormal', layout)
+		suite['nextRandomFloatNormal'] = [
+			('normal', tr._test_normal(array, SAMPLES, BINS))
+		] + serial(tr, array)
+
+		array, pdfs = sample_directions(tr, 'randomDirection', layout)
+		suite['randomDirection'] = [
+			('sphere', tr._test_directions(array, SAMPLES, 0, 0, 1,
+						       0, True, 32)),
+			('pdf', tr._test_pdf(array, pdfs, SAMPLES, 0, 0, 1,
+					     -1)),
+		] + serial(tr, array, 3)
+
+		array, pdfs = sample_directions(tr, 'randomHemiSphere', layout,
+						*normal)
+		suite['randomHemiSphere'] = [
+			('hemisphere', tr._test_directions(array, SAMPLES,
+							   *normal, 0, False,
+							   32)),
+			('pdf', tr._test_pdf(array, pdfs, SAMPLES, *normal,
+					     0)),
+		] + serial(tr, array, 3)
+
+		array, pdfs = sample_directions(tr, 'randomCosineHemiSphere',
+						layout, *normal)
+		suite['randomCosineHemiSphere'] = [
+			('cosine', tr._test_directions(array, SAMPLES, *normal,
+						       1, False, 32)),
+			('pdf', tr._test_pdf(array, pdfs, SAMPLES, *normal,
+					     0)),
+		] + serial(tr, array, 3)
+
+		for alpha in GGX_ALPHAS:
+			array, pdfs = sample_directions(tr, 'randomGGXLobe',
+							layout, *normal, alpha)
+			suite[f'randomGGXLobe alpha {alpha}'] = [
+				('ggx', tr._test_ggx_lobe(array, SAMPLES,
+							  *normal, alpha, 32)),
+				('pdf', tr._test_pdf(array, pdfs, SAMPLES,
+						     *normal, 0)),
+			] + serial(tr, array, 3)
+
+		for cos_max in CONES:
+			array, pdfs = sample_directions(tr, 'randomCone',
+							layout, *normal,
+							cos_max)
+			suite[f'randomCone cos {cos_max}'] = [
+				('cone', tr._test_cone(array, SAMPLES, *normal,
+						       cos_max, 32)),
+				('pdf', tr._test_pdf(array, pdfs, SAMPLES,
+						     *normal, cos_max)),
+			] + serial(tr, array, 3)
+
+		for sampler, results in suite.items():
+			for test, verdict in results:
+				yield f'{sampler} ({layout_name})', test, verdict
+
+def plot(tr):
+	import matplotlib.pyplot as plt
+
+	array, _ = sample_directions(tr, 'randomCosineHemiSphere',
+				     ACROSS_PIXELS, 0, 1, 0)
+	array = array.reshape(-1, 3)[:5000]
 	fig = plt.figure()
-	plt.title(name)
+	plt.title('randomCosineHemiSphere')
 	ax = fig.add_subplot(projection='3d')
 	ax.scatter(array[:, 0], array[:, 1], array[:, 2])
 	plt.show()
 
-def nextRandomInt(times, seed):
-	tr = ctypes.CDLL('./pathtracer.so')
-	tr._call_nextRandomInt.argtypes = [ctypes.c_uint]
-	tr._call_nextRandomInt.restype = ctypes.c_uint
-
-	array = np.zeros(times, dtype=int)
-	for i in range(times):
-		seed = ctypes.c_uint(tr._call_nextRandomInt(seed)).value
-		array[i] = seed
-
-	distribution('nextRandomInt', array / INT_MAX)
-
-def nextRandomFloat(times, seed):
-	tr = ctypes.CDLL('./pathtracer.so')
-	tr._call_nextRandomFloat.argtypes = [ctypes.c_uint]
-	tr._call_nextRandomFloat.restype = FLOAT_SEED
-
-	array = np.zeros(times)
-	for i in range(times):
-		res = tr._call_nextRandomFloat(seed)
-		seed = res.seed
-		array[i] = res.number
-
-	distribution('nextRandomFloat', array)
-
-def nextRandomFloatNeg(times, seed):
-	tr = ctypes.CDLL('./pathtracer.so')
-	tr._call_nextRandomFloatNeg.argtypes = [ctypes.c_uint]
-	tr._call_nextRandomFloatNeg.restype = FLOAT_SEED
-
-	array = np.zeros(times)
-	for i in range(times):
-		res = tr._call_nextRandomFloatNeg(seed)
-		seed = res.seed
-		array[i] = res.number
-
-	distribution('nextRandomFloatNeg', array)
-
-def randomDirection(times, seed):
-	tr = ctypes.CDLL('./pathtracer.so')
-	tr._call_randomDirection.argtypes = [ctypes.c_uint]
-	tr._call_randomDirection.restype = FLOAT3_SEED
-
-	array = np.zeros((times, 3))
-	for i in range(times):
-		res = tr._call_randomDirection(seed)
-		seed = res.seed
-		array[i][0] = res.x
-		array[i][1] = res.y
-		array[i][2] = res.z
-
-	distribution3d('randomDirection', array)
-
-def randomHemiSphere(times, seed):
-	tr = ctypes.CDLL('./pathtracer.so')
-	tr._call_randomHemiSphere.argtypes = [ctypes.c_uint]
-	tr._call_randomHemiSphere.restype = FLOAT3_SEED
-
-	array = np.zeros((times, 3))
-	for i in range(times):
-		res = tr._call_randomHemiSphere(seed, 0, 1, 0)
-		seed = res.seed
-		array[i][0] = res.x
-		array[i][1] = res.y
-		array[i][2] = res.z
-
-	distribution3d('randomHemiSphere', array)
-
 def main():
-	nextRandomInt(10000, 123)
-	nextRandomFloat(10000, 123)
-	nextRandomFloatNeg(10000, 123)
-	randomDirection(5000, 123123)
-	randomHemiSphere(5000, 121343)
+	tr = load()
+	failed = 0
+
+	print(f'{"sampler":<44} {"test":<14} {"statistic":>12} {"p-value":>10}')
+	for sampler, test, verdict in tests(tr):
+		ok = verdict.p_value >= ALPHA
+		failed += not ok
+		print(f'{sampler:<44} {test:<14} {verdict.statistic:>12.4g} '
+		      f'{verdict.p_value:>10.3g} {"ok" if ok else "FAIL"}')
+	if '--plot' in sys.argv:
+		plot(tr)
+	print(f'{failed} tests failed')
+	sys.exit(1 if failed > 0 else 0)
 
 if __name__ == '__main__':
 	main()
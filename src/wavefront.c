@@ -0,0 +1,173 @@
+#include <wavefront.h>
+
+/**
+ * create_wavefront() creates wavefront stage kernels and buffers for image of
+ * given size. Queue counters are allocated for max_depth bounces
+ *
+ * @param kernel any kernel of program built from source/wavefront.cl, with
+ * 	SCREEN_WIDTH, SCREEN_HEIGHT and RAYS_PER_PIXEL equal to width, height
+ * 	and rays_per_pixel
+ * @param max_depth most bounces path makes before it is terminated
+ */
+wavefront_t create_wavefront(context_t context, kernel_t kernel,
+			     unsigned int width, unsigned int height,
+			     unsigned int rays_per_pixel,
+			     unsigned int max_depth)
+{
+	size_t paths = (size_t)width * height;
+	size_t counters = (size_t)(max_depth + 1) * WAVEFRONT_QUEUES;
+	wavefront_t wavefront = {
+		.__generate = create_program_kernel(kernel, "generateKernel"),
+		.__extend = create_program_kernel(kernel, "extendKernel"),
+		.__shade = create_program_kernel(kernel, "shadeKernel"),
+		.__miss = create_program_kernel(kernel, "missKernel"),
+		.__accumulate = create_program_kernel(kernel,
+						      "accumulateKernel"),
+		.__paths = create_buffer(context, read_write | no_access,
+					 paths * sizeof(struct PathState)),
+		.__counters = create_buffer(context, read_write,
+					    counters * sizeof(cl_uint)),
+		.__ray_queue = create_buffer(context, read_write | no_access,
+					2 * paths * sizeof(cl_uint)),
+		.__hit_queue = create_buffer(context, read_write | no_access,
+					paths * sizeof(cl_uint)),
+		.__miss_queue = create_buffer(context, read_write | no_access,
+					  paths * sizeof(cl_uint)),
+		.__rays_per_pixel = rays_per_pixel,
+		.__max_depth = max_depth,
+		/* run_wavefront() resets counters from it before every sample */
+		.__zero_counters = calloc(counters, sizeof(cl_uint)),
+	};
+
+	panic_on(wavefront.__zero_counters == NULL, "calloc");
+
+	set_kernel_arg_at(wavefront.__generate, wavefront.__paths, 0);
+	set_kernel_arg_at(wavefront.__generate, wavefront.__counters, 1);
+	set_kernel_arg_at(wavefront.__generate, wavefront.__ray_queue, 2);
+	set_kernel_size_2d(wavefront.__generate, width, height);
+
+	set_kernel_arg_at(wavefront.__extend, wavefront.__paths, 0);
+	set_kernel_arg_at(wavefront.__extend, wavefront.__counters, 1);
+	set_kernel_arg_at(wavefront.__extend, wavefront.__ray_queue, 2);
+	set_kernel_arg_at(wavefront.__extend, wavefront.__hit_queue, 3);
+	set_kernel_arg_at(wavefront.__extend, wavefront.__miss_queue, 4);
+
+	set_kernel_arg_at(wavefront.__shade, wavefront.__paths, 0);
+	set_kernel_arg_at(wavefront.__shade, wavefront.__counters, 1);
+	set_kernel_arg_at(wavefront.__shade, wavefront.__ray_queue, 2);
+	set_kernel_arg_at(wavefront.__shade, wavefront.__hit_queue, 3);
+	set_kernel_arg_at(wavefront.__shade, wavefront.__miss_queue, 4);
+	set_kernel_arg_at(wavefront.__shade, max_depth, 11);
+
+	set_kernel_arg_at(wavefront.__miss, wavefront.__paths, 0);
+	set_kernel_arg_at(wavefront.__miss, wavefront.__counters, 1);
+	set_kernel_arg_at(wavefront.__miss, wavefront.__miss_queue, 2);
+	/* extend, shade and miss are sized by run_wavefront() per bounce */
+
+	set_kernel_arg_at(wavefront.__accumulate, wavefront.__paths, 0);
+	set_kernel_size_2d(wavefront.__accumulate, width, height);
+	return wavefront;
+}
+
+void destroy_wavefront(wavefront_t *wavefront)
+{
+	release_buffer(wavefront->__paths);
+	release_buffer(wavefront->__counters);
+	release_buffer(wavefront->__ray_queue);
+	release_buffer(wavefront->__hit_queue);
+	release_buffer(wavefront->__miss_queue);
+	release_kernel(wavefront->__generate);
+	release_kernel(wavefront->__extend);
+	release_kernel(wavefront->__shade);
+	release_kernel(wavefront->__miss);
+	release_kernel(wavefront->__accumulate);
+	free(wavefront->__zero_counters);
+}
+
+/**
+ * set_wavefront_args() binds scene and output buffers to stage kernels. As
+ * with set_scene_args(), it should be called again after scene is edited
+ *
+ * @param tile_mask adaptive sampling mask, buffer with NULL handle makes
+ * 	every pixel sampled
+ */
+void set_wavefront_args(wavefront_t *wavefront, scene_t *scene,
+			buffer_t accum, buffer_t moments, buffer_t tile_mask)
+{
+	set_scene_args(&wavefront->__extend, scene, 5, 6, 7);
+	set_scene_args(&wavefront->__shade, scene, 5, 6, 7);
+	set_scene_light_args(&wavefront->__shade, scene, 9, 10);
+	set_kernel_arg_at(wavefront->__generate, tile_mask, 7);
+	set_kernel_arg_at(wavefront->__accumulate, accum, 1);
+	set_kernel_arg_at(wavefront->__accumulate, moments, 2);
+	set_kernel_arg_at(wavefront->__accumulate, tile_mask, 3);
+}
+
+void set_wavefront_camera(wavefront_t *wavefront, float3 position,
+			  struct RotateMatrix matrix)
+{
+	set_kernel_arg_at(wavefront->__generate, position, 3);
+	set_kernel_arg_at(wavefront->__generate, matrix, 4);
+}
+
+/**
+ * __queued_rays() waits until rays of bounce are queued and returns their
+ * number
+ */
+static cl_uint __queued_rays(queue_t queue, wavefront_t *wavefront,
+			     cl_uint bounce)
+{
+	cl_uint rays;
+
+	dump_buffer_range(queue, wavefront->__counters,
+			  (bounce * WAVEFRONT_QUEUES + WAVEFRONT_RAYS) *
+				  sizeof(cl_uint),
+			  sizeof(cl_uint), &rays, true);
+	return rays;
+}
+
+/**
+ * run_wavefront() enqueues tracing of RAYS_PER_PIXEL paths per pixel and
+ * accumulation of their mean, equivalent of one runKernel() launch. Ray queue
+ * size is read back before every bounce, so stages are run only over paths
+ * still alive and bounces after the last path terminated are skipped
+ *
+ * @param frame frame number random generator is seeded with
+ * @param reset if true, accumulated pixels are replaced instead of averaged
+ */
+void run_wavefront(queue_t queue, wavefront_t *wavefront, cl_uint frame,
+		   bool reset)
+{
+	cl_int reset_canvas = reset;
+
+	set_kernel_arg_at(wavefront->__generate, frame, 5);
+	for (cl_uint sample = 0; sample < wavefront->__rays_per_pixel;
+	     ++sample) {
+		fill_buffer(queue, wavefront->__counters,
+			    (wavefront->__max_depth + 1) * WAVEFRONT_QUEUES *
+				    sizeof(cl_uint),
+			    wavefront->__zero_counters, false);
+		set_kernel_arg_at(wavefront->__generate, sample, 6);
+		run_kernel(queue, wavefront->__generate);
+
+		for (cl_uint bounce = 0; bounce <= wavefront->__max_depth;
+		     ++bounce) {
+			cl_uint rays = __queued_rays(queue, wavefront, bounce);
+
+			if (rays == 0) {
+				break;
+			}
+			set_kernel_size_1d(wavefront->__extend, rays);
+			set_kernel_size_1d(wavefront->__shade, rays);
+			set_kernel_size_1d(wavefront->__miss, rays);
+			set_kernel_arg_at(wavefront->__extend, bounce, 8);
+			set_kernel_arg_at(wavefront->__shade, bounce, 8);
+			set_kernel_arg_at(wavefront->__miss, bounce, 3);
+			run_kernel(queue, wavefront->__extend);
+			run_kernel(queue, wavefront->__shade);
+			run_kernel(queue, wavefront->__miss);
+		}
+	}
+	set_kernel_arg_at(wavefront->__accumulate, reset_canvas, 4);
+	run_kernel(queue, wavefront->__accumulate);
+}